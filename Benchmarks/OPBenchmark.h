@@ -0,0 +1,117 @@
+// OPBenchmark.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *  Returns a monotonic timestamp in nanoseconds.
+ */
+uint64_t OPBenchmarkNow(void);
+
+
+/**
+ *  Timing samples gathered for a single benchmark, along with the parameters
+ *  it was run with.
+ */
+@interface OPBenchmarkResult : NSObject
+
+@property (copy, nonatomic, readonly) NSString *name;
+@property (copy, nonatomic, readonly) NSDictionary *parameters;
+
+/**
+ *  Number of operations performed in each sample. Used to derive the cost per
+ *  operation and throughput.
+ */
+@property (assign, nonatomic, readonly) NSUInteger operationsPerSample;
+
+/**
+ *  Duration of each sample, in nanoseconds, as `NSNumber`s
+ */
+@property (copy, nonatomic, readonly) NSArray *samples;
+
+- (instancetype)initWithName:(NSString *)name
+                  parameters:(NSDictionary *)parameters
+         operationsPerSample:(NSUInteger)operationsPerSample
+                     samples:(NSArray *)samples NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ *  A JSON-compatible dictionary with the summary statistics for the samples.
+ */
+- (NSDictionary *)dictionaryRepresentation;
+
+/**
+ *  A single human readable line summarizing the result.
+ */
+- (NSString *)summary;
+
+@end
+
+
+/**
+ *  Runs benchmarks and collects their results into a single report, which can
+ *  be written out as JSON so results may be compared between versions.
+ */
+@interface OPBenchmarkReporter : NSObject
+
+/**
+ *  Free-form label stored in the report, such as a version or commit.
+ */
+@property (copy, nonatomic) NSString *label;
+
+/**
+ *  When set, only benchmarks whose name contains this string are run.
+ */
+@property (copy, nonatomic) NSString *filter;
+
+@property (strong, nonatomic, readonly) NSArray *results;
+
+/**
+ *  @return `YES` if a benchmark with the given name passes the filter
+ */
+- (BOOL)shouldRun:(NSString *)name;
+
+/**
+ *  Runs `block` once to warm up, then `samples` more times, timing each run.
+ *
+ *  @param name                Name of the benchmark
+ *  @param parameters          JSON-compatible parameters to record with the result
+ *  @param operationsPerSample Number of operations `block` performs
+ *  @param samples             Number of timed runs
+ *  @param block               The work to be measured
+ */
+- (void)measure:(NSString *)name
+     parameters:(NSDictionary *)parameters
+     operations:(NSUInteger)operationsPerSample
+        samples:(NSUInteger)samples
+          block:(void (^)(void))block;
+
+/**
+ *  Records samples which were timed by the caller, for benchmarks which
+ *  measure the interval between two points inside the library.
+ */
+- (void)recordResult:(OPBenchmarkResult *)result;
+
+- (NSData *)JSONData;
+
+@end
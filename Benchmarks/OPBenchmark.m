@@ -0,0 +1,195 @@
+// OPBenchmark.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPBenchmark.h"
+
+#import <time.h>
+
+
+uint64_t OPBenchmarkNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static double OPBenchmarkPercentile(NSArray *sortedSamples, double percentile)
+{
+    NSUInteger count = [sortedSamples count];
+    if (count == 0) {
+        return 0;
+    }
+
+    NSUInteger idx = (NSUInteger)((count - 1) * percentile + 0.5);
+    return [sortedSamples[MIN(idx, count - 1)] doubleValue];
+}
+
+
+@implementation OPBenchmarkResult
+
+- (instancetype)initWithName:(NSString *)name
+                  parameters:(NSDictionary *)parameters
+         operationsPerSample:(NSUInteger)operationsPerSample
+                     samples:(NSArray *)samples
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _name = [name copy];
+    _parameters = [parameters copy] ?: @{};
+    _operationsPerSample = MAX(operationsPerSample, 1);
+    _samples = [samples copy];
+
+    return self;
+}
+
+- (NSDictionary *)dictionaryRepresentation
+{
+    NSArray *sorted = [self.samples sortedArrayUsingSelector:@selector(compare:)];
+
+    double total = 0;
+    for (NSNumber *sample in sorted) {
+        total += [sample doubleValue];
+    }
+
+    double mean = [sorted count] ? total / [sorted count] : 0;
+    double median = OPBenchmarkPercentile(sorted, 0.5);
+    double operations = (double)self.operationsPerSample;
+
+    return @{
+        @"name": self.name,
+        @"parameters": self.parameters,
+        @"samples": @([sorted count]),
+        @"operations_per_sample": @(self.operationsPerSample),
+        @"unit": @"ns",
+        @"min": @(OPBenchmarkPercentile(sorted, 0)),
+        @"median": @(median),
+        @"p90": @(OPBenchmarkPercentile(sorted, 0.9)),
+        @"p99": @(OPBenchmarkPercentile(sorted, 0.99)),
+        @"max": @(OPBenchmarkPercentile(sorted, 1)),
+        @"mean": @(mean),
+        @"ns_per_operation": @(median / operations),
+        @"operations_per_second": @(median > 0 ? operations * NSEC_PER_SEC / median : 0)
+    };
+}
+
+- (NSString *)summary
+{
+    NSDictionary *dictionary = [self dictionaryRepresentation];
+
+    NSMutableArray *parameters = [[NSMutableArray alloc] init];
+    for (NSString *key in [[self.parameters allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+        [parameters addObject:[NSString stringWithFormat:@"%@=%@", key, self.parameters[key]]];
+    }
+
+    return [NSString stringWithFormat:@"%-40s %-32s %12.1f ns/op %14.0f op/s  p99 %.0f ns",
+            [self.name UTF8String],
+            [[parameters componentsJoinedByString:@" "] UTF8String],
+            [dictionary[@"ns_per_operation"] doubleValue],
+            [dictionary[@"operations_per_second"] doubleValue],
+            [dictionary[@"p99"] doubleValue]];
+}
+
+@end
+
+
+@implementation OPBenchmarkReporter {
+    NSMutableArray *_results;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _results = [[NSMutableArray alloc] init];
+
+    return self;
+}
+
+- (NSArray *)results
+{
+    return [_results copy];
+}
+
+- (BOOL)shouldRun:(NSString *)name
+{
+    return [self.filter length] == 0 || [name rangeOfString:self.filter].location != NSNotFound;
+}
+
+- (void)measure:(NSString *)name
+     parameters:(NSDictionary *)parameters
+     operations:(NSUInteger)operationsPerSample
+        samples:(NSUInteger)samples
+          block:(void (^)(void))block
+{
+    if (![self shouldRun:name]) {
+        return;
+    }
+
+    @autoreleasepool {
+        block();
+    }
+
+    NSMutableArray *durations = [[NSMutableArray alloc] initWithCapacity:samples];
+    for (NSUInteger i = 0; i < samples; i++) {
+        @autoreleasepool {
+            uint64_t start = OPBenchmarkNow();
+            block();
+            [durations addObject:@(OPBenchmarkNow() - start)];
+        }
+    }
+
+    [self recordResult:[[OPBenchmarkResult alloc] initWithName:name
+                                                    parameters:parameters
+                                           operationsPerSample:operationsPerSample
+                                                       samples:durations]];
+}
+
+- (void)recordResult:(OPBenchmarkResult *)result
+{
+    [_results addObject:result];
+    fprintf(stderr, "%s\n", [[result summary] UTF8String]);
+}
+
+- (NSData *)JSONData
+{
+    NSMutableArray *results = [[NSMutableArray alloc] initWithCapacity:[_results count]];
+    for (OPBenchmarkResult *result in _results) {
+        [results addObject:[result dictionaryRepresentation]];
+    }
+
+    NSDictionary *report = @{
+        @"suite": @"Operative",
+        @"label": self.label ?: @"",
+        @"timestamp": @([[NSDate date] timeIntervalSince1970]),
+        @"processors": @([[NSProcessInfo processInfo] activeProcessorCount]),
+        @"results": results
+    };
+
+    return [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted error:nil];
+}
+
+@end
@@ -0,0 +1,531 @@
+// main.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+#import "OPBenchmark.h"
+#import "OPBlockObserver.h"
+#import "OPBlockOperation.h"
+#import "OPExclusivityController.h"
+#import "OPGroupOperation.h"
+#import "OPOperationGraph.h"
+#import "OPOperationConditionMutuallyExclusive.h"
+#import "OPOperationQueue.h"
+#import "OPWorkStealingExecutor.h"
+
+
+#pragma mark - Benchmark Condition
+#pragma mark -
+
+/**
+ *  A condition which is always satisfied synchronously, and optionally
+ *  reports when it is evaluated.
+ */
+@interface OPBenchmarkCondition : NSObject <OPOperationCondition>
+
+@property (copy, nonatomic) void (^evaluationHandler)(void);
+
+@end
+
+@implementation OPBenchmarkCondition
+
+- (NSString *)name
+{
+    return @"Benchmark";
+}
+
+- (BOOL)isMutuallyExclusive
+{
+    return NO;
+}
+
+- (NSOperation *)dependencyForOperation:(OPOperation *)operation
+{
+    return nil;
+}
+
+- (void)evaluateConditionForOperation:(OPOperation *)operation
+                           completion:(void (^)(OPOperationConditionResultStatus result, NSError *error))completion
+{
+    if (self.evaluationHandler) {
+        self.evaluationHandler();
+    }
+    completion(OPOperationConditionResultStatusSatisfied, nil);
+}
+
+@end
+
+
+#pragma mark - Helpers
+#pragma mark -
+
+static NSString *OPBenchmarkBackendName(BOOL useExecutor)
+{
+    return useExecutor ? @"work-stealing" : @"nsoperationqueue";
+}
+
+static OPOperationQueue *OPBenchmarkQueue(BOOL useExecutor)
+{
+    OPOperationQueue *queue = [[OPOperationQueue alloc] init];
+    queue.executor = useExecutor ? [OPWorkStealingExecutor sharedExecutor] : nil;
+    return queue;
+}
+
+static OPBlockOperation *OPBenchmarkEmptyOperation(void)
+{
+    return [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        completion();
+    }];
+}
+
+static NSArray *OPBenchmarkEmptyOperations(NSUInteger count)
+{
+    NSMutableArray *operations = [[NSMutableArray alloc] initWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [operations addObject:OPBenchmarkEmptyOperation()];
+    }
+    return operations;
+}
+
+
+#pragma mark - Enqueue Throughput
+#pragma mark -
+
+static void OPBenchmarkEnqueue(OPBenchmarkReporter *reporter, BOOL quick)
+{
+    NSUInteger count = quick ? 1000 : 10000;
+    NSUInteger samples = quick ? 5 : 20;
+
+    for (NSUInteger backend = 0; backend < 2; backend++) {
+        BOOL useExecutor = backend == 1;
+        NSDictionary *parameters = @{ @"backend": OPBenchmarkBackendName(useExecutor), @"operations": @(count) };
+
+        // Time spent in -addOperation: alone. The queue is suspended so that
+        // execution doesn't compete with enqueueing.
+        if ([reporter shouldRun:@"queue.enqueue"]) {
+            NSMutableArray *durations = [[NSMutableArray alloc] init];
+            for (NSUInteger sample = 0; sample < samples; sample++) {
+                @autoreleasepool {
+                    OPOperationQueue *queue = OPBenchmarkQueue(useExecutor);
+                    NSArray *operations = OPBenchmarkEmptyOperations(count);
+                    [queue setSuspended:YES];
+
+                    uint64_t start = OPBenchmarkNow();
+                    for (NSOperation *operation in operations) {
+                        [queue addOperation:operation];
+                    }
+                    [durations addObject:@(OPBenchmarkNow() - start)];
+
+                    [queue setSuspended:NO];
+                    [queue waitUntilAllOperationsAreFinished];
+                }
+            }
+            [reporter recordResult:[[OPBenchmarkResult alloc] initWithName:@"queue.enqueue" parameters:parameters operationsPerSample:count samples:durations]];
+        }
+
+        if ([reporter shouldRun:@"queue.enqueue_batch"]) {
+            NSMutableArray *durations = [[NSMutableArray alloc] init];
+            for (NSUInteger sample = 0; sample < samples; sample++) {
+                @autoreleasepool {
+                    OPOperationQueue *queue = OPBenchmarkQueue(useExecutor);
+                    NSArray *operations = OPBenchmarkEmptyOperations(count);
+                    [queue setSuspended:YES];
+
+                    uint64_t start = OPBenchmarkNow();
+                    [queue addOperations:operations waitUntilFinished:NO];
+                    [durations addObject:@(OPBenchmarkNow() - start)];
+
+                    [queue setSuspended:NO];
+                    [queue waitUntilAllOperationsAreFinished];
+                }
+            }
+            [reporter recordResult:[[OPBenchmarkResult alloc] initWithName:@"queue.enqueue_batch" parameters:parameters operationsPerSample:count samples:durations]];
+        }
+
+        // Enqueue through to every operation having finished.
+        [reporter measure:@"queue.throughput" parameters:parameters operations:count samples:samples block:^{
+            OPOperationQueue *queue = OPBenchmarkQueue(useExecutor);
+            for (NSUInteger i = 0; i < count; i++) {
+                [queue addOperation:OPBenchmarkEmptyOperation()];
+            }
+            [queue waitUntilAllOperationsAreFinished];
+        }];
+    }
+}
+
+
+#pragma mark - Lifecycle Latency
+#pragma mark -
+
+/**
+ *  Measures the time taken to reach each stage of an operation's life, one
+ *  operation at a time on an otherwise idle queue:
+ *
+ *  - enqueue:    `-addOperation:` called (Pending)
+ *  - evaluate:   condition evaluation begins (EvaluatingConditions)
+ *  - start:      observers told the operation started (Executing)
+ *  - execute:    `-execute` called
+ *  - finish:     observers told the operation finished (Finishing)
+ *  - completion: the completion block runs (Finished)
+ */
+static void OPBenchmarkLatency(OPBenchmarkReporter *reporter, BOOL quick)
+{
+    if (![reporter shouldRun:@"latency"]) {
+        return;
+    }
+
+    NSUInteger samples = quick ? 200 : 2000;
+    NSArray *phases = @[ @"enqueue_to_evaluate", @"evaluate_to_start", @"start_to_execute", @"execute_to_finish", @"finish_to_completion", @"end_to_end" ];
+
+    for (NSUInteger backend = 0; backend < 2; backend++) {
+        BOOL useExecutor = backend == 1;
+        OPOperationQueue *queue = OPBenchmarkQueue(useExecutor);
+
+        NSMutableArray *durations = [[NSMutableArray alloc] init];
+        for (NSUInteger phase = 0; phase < [phases count]; phase++) {
+            [durations addObject:[[NSMutableArray alloc] initWithCapacity:samples]];
+        }
+
+        for (NSUInteger sample = 0; sample < samples; sample++) {
+            @autoreleasepool {
+                uint64_t *timestamps = calloc(6, sizeof(uint64_t));
+                dispatch_semaphore_t done = dispatch_semaphore_create(0);
+
+                OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+                    timestamps[3] = OPBenchmarkNow();
+                    completion();
+                }];
+
+                OPBenchmarkCondition *condition = [[OPBenchmarkCondition alloc] init];
+                condition.evaluationHandler = ^{
+                    timestamps[1] = OPBenchmarkNow();
+                };
+                [operation addCondition:condition];
+
+                [operation addObserver:[[OPBlockObserver alloc] initWithStartHandler:^(OPOperation *operation) {
+                    timestamps[2] = OPBenchmarkNow();
+                } produceHandler:nil finishHandler:^(OPOperation *operation, NSArray *errors) {
+                    timestamps[4] = OPBenchmarkNow();
+                }]];
+
+                [operation setCompletionBlock:^{
+                    timestamps[5] = OPBenchmarkNow();
+                    dispatch_semaphore_signal(done);
+                }];
+
+                timestamps[0] = OPBenchmarkNow();
+                [queue addOperation:operation];
+                dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+
+                for (NSUInteger phase = 0; phase < 5; phase++) {
+                    [durations[phase] addObject:@(timestamps[phase + 1] - timestamps[phase])];
+                }
+                [durations[5] addObject:@(timestamps[5] - timestamps[0])];
+
+                free(timestamps);
+            }
+        }
+
+        for (NSUInteger phase = 0; phase < [phases count]; phase++) {
+            NSString *name = [@"latency." stringByAppendingString:phases[phase]];
+            [reporter recordResult:[[OPBenchmarkResult alloc] initWithName:name
+                                                                parameters:@{ @"backend": OPBenchmarkBackendName(useExecutor) }
+                                                       operationsPerSample:1
+                                                                   samples:durations[phase]]];
+        }
+    }
+}
+
+
+#pragma mark - Group Fan-out / Fan-in
+#pragma mark -
+
+static void OPBenchmarkGroup(OPBenchmarkReporter *reporter, BOOL quick)
+{
+    NSArray *sizes = quick ? @[ @10, @100, @1000, @10000 ] : @[ @10, @100, @1000, @10000, @100000 ];
+
+    for (NSUInteger backend = 0; backend < 2; backend++) {
+        BOOL useExecutor = backend == 1;
+
+        for (NSNumber *size in sizes) {
+            NSUInteger children = [size unsignedIntegerValue];
+            NSUInteger samples = children >= 10000 ? 3 : 10;
+            NSDictionary *parameters = @{ @"backend": OPBenchmarkBackendName(useExecutor), @"children": size };
+
+            [reporter measure:@"group.fan_out_fan_in" parameters:parameters operations:children samples:samples block:^{
+                OPOperationQueue *queue = OPBenchmarkQueue(useExecutor);
+                OPGroupOperation *group = [[OPGroupOperation alloc] initWithOperations:OPBenchmarkEmptyOperations(children)];
+                [queue addOperation:group];
+                [queue waitUntilAllOperationsAreFinished];
+            }];
+        }
+    }
+}
+
+
+#pragma mark - Dependency Graphs
+#pragma mark -
+
+/**
+ *  Builds and submits a layered graph in which each operation depends on
+ *  two operations of the layer before, once with `-addDependency:` and
+ *  `-addOperation:`, and once with `OPOperationGraph`. Only building and
+ *  submitting is timed; the queue is suspended until then.
+ */
+static void OPBenchmarkGraph(OPBenchmarkReporter *reporter, BOOL quick)
+{
+    NSUInteger width = 100;
+    NSUInteger count = quick ? 5000 : 50000;
+    NSUInteger samples = quick ? 3 : 10;
+
+    for (NSUInteger backend = 0; backend < 2; backend++) {
+        BOOL useExecutor = backend == 1;
+        NSDictionary *parameters = @{ @"backend": OPBenchmarkBackendName(useExecutor), @"operations": @(count), @"width": @(width) };
+
+        if ([reporter shouldRun:@"graph.add_dependency"]) {
+            NSMutableArray *durations = [[NSMutableArray alloc] init];
+            for (NSUInteger sample = 0; sample < samples; sample++) {
+                @autoreleasepool {
+                    OPOperationQueue *queue = OPBenchmarkQueue(useExecutor);
+                    NSArray *operations = OPBenchmarkEmptyOperations(count);
+                    [queue setSuspended:YES];
+
+                    uint64_t start = OPBenchmarkNow();
+                    for (NSUInteger node = width; node < count; node++) {
+                        NSUInteger column = node % width;
+                        NSUInteger previous = node - column - width;
+                        [operations[node] addDependency:operations[previous + column]];
+                        [operations[node] addDependency:operations[previous + (column + 1) % width]];
+                    }
+                    for (NSOperation *operation in operations) {
+                        [queue addOperation:operation];
+                    }
+                    [durations addObject:@(OPBenchmarkNow() - start)];
+
+                    [queue setSuspended:NO];
+                    [queue waitUntilAllOperationsAreFinished];
+                }
+            }
+            [reporter recordResult:[[OPBenchmarkResult alloc] initWithName:@"graph.add_dependency" parameters:parameters operationsPerSample:count samples:durations]];
+        }
+
+        if ([reporter shouldRun:@"graph.builder"]) {
+            NSMutableArray *durations = [[NSMutableArray alloc] init];
+            for (NSUInteger sample = 0; sample < samples; sample++) {
+                @autoreleasepool {
+                    OPOperationQueue *queue = OPBenchmarkQueue(useExecutor);
+                    NSArray *operations = OPBenchmarkEmptyOperations(count);
+                    [queue setSuspended:YES];
+
+                    uint64_t start = OPBenchmarkNow();
+                    OPOperationGraph *graph = [[OPOperationGraph alloc] initWithCapacity:count];
+                    for (OPOperation *operation in operations) {
+                        [graph addOperation:operation];
+                    }
+                    for (NSUInteger node = width; node < count; node++) {
+                        NSUInteger column = node % width;
+                        NSUInteger previous = node - column - width;
+                        [graph addDependencyFromIndex:node toIndex:previous + column];
+                        [graph addDependencyFromIndex:node toIndex:previous + (column + 1) % width];
+                    }
+                    [queue addOperationGraph:graph error:NULL];
+                    [durations addObject:@(OPBenchmarkNow() - start)];
+
+                    [queue setSuspended:NO];
+                    [queue waitUntilAllOperationsAreFinished];
+                }
+            }
+            [reporter recordResult:[[OPBenchmarkResult alloc] initWithName:@"graph.builder" parameters:parameters operationsPerSample:count samples:durations]];
+        }
+    }
+}
+
+
+#pragma mark - Exclusivity Contention
+#pragma mark -
+
+static void OPBenchmarkExclusivity(OPBenchmarkReporter *reporter, BOOL quick)
+{
+    NSUInteger total = quick ? 2000 : 20000;
+    NSUInteger samples = quick ? 3 : 10;
+
+    // The controller on its own, with many threads registering operations
+    // across a varying number of categories.
+    for (NSNumber *threadCount in @[ @1, @4, @16 ]) {
+        for (NSNumber *categoryCount in @[ @1, @16, @256 ]) {
+            NSUInteger threads = [threadCount unsignedIntegerValue];
+            NSUInteger perThread = total / threads;
+            NSUInteger categories = [categoryCount unsignedIntegerValue];
+
+            NSMutableArray *names = [[NSMutableArray alloc] initWithCapacity:categories];
+            for (NSUInteger i = 0; i < categories; i++) {
+                [names addObject:@[ [NSString stringWithFormat:@"Category%lu", (unsigned long)i] ]];
+            }
+
+            NSDictionary *parameters = @{ @"threads": threadCount, @"categories": categoryCount };
+            [reporter measure:@"exclusivity.controller" parameters:parameters operations:perThread * threads samples:samples block:^{
+                OPExclusivityController *controller = [OPExclusivityController sharedExclusivityController];
+                dispatch_apply(threads, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+                    for (NSUInteger i = 0; i < perThread; i++) {
+                        @autoreleasepool {
+                            OPOperation *operation = [[OPOperation alloc] init];
+                            NSArray *category = names[(thread + i) % categories];
+                            [controller addOperation:operation categories:category];
+                            [controller removeOperation:operation categories:category];
+                        }
+                    }
+                });
+            }];
+        }
+    }
+
+    // End to end, with mutually exclusive operations spread across queues.
+    for (NSNumber *queueCount in @[ @1, @4, @16 ]) {
+        NSUInteger queues = [queueCount unsignedIntegerValue];
+        NSUInteger perQueue = (total / 10) / queues;
+
+        [reporter measure:@"exclusivity.queues" parameters:@{ @"queues": queueCount } operations:perQueue * queues samples:samples block:^{
+            NSMutableArray *operationQueues = [[NSMutableArray alloc] initWithCapacity:queues];
+            for (NSUInteger i = 0; i < queues; i++) {
+                [operationQueues addObject:OPBenchmarkQueue(NO)];
+            }
+
+            dispatch_apply(queues, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t idx) {
+                for (NSUInteger i = 0; i < perQueue; i++) {
+                    OPBlockOperation *operation = OPBenchmarkEmptyOperation();
+                    [operation addCondition:[OPOperationConditionMutuallyExclusive mutuallyExclusiveWith:[OPBenchmarkCondition class]]];
+                    [operationQueues[idx] addOperation:operation];
+                }
+            });
+
+            for (OPOperationQueue *queue in operationQueues) {
+                [queue waitUntilAllOperationsAreFinished];
+            }
+        }];
+    }
+}
+
+
+#pragma mark - Conditions and Observers
+#pragma mark -
+
+static void OPBenchmarkConditionsAndObservers(OPBenchmarkReporter *reporter, BOOL quick)
+{
+    NSUInteger count = quick ? 1000 : 10000;
+    NSUInteger samples = quick ? 3 : 10;
+    NSArray *attachments = @[ @0, @1, @4, @16 ];
+
+    OPBenchmarkCondition *condition = [[OPBenchmarkCondition alloc] init];
+    OPBlockObserver *observer = [[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {}];
+
+    for (NSNumber *attachmentCount in attachments) {
+        NSUInteger attached = [attachmentCount unsignedIntegerValue];
+
+        [reporter measure:@"cost.conditions" parameters:@{ @"conditions": attachmentCount } operations:count samples:samples block:^{
+            OPOperationQueue *queue = OPBenchmarkQueue(NO);
+            for (NSUInteger i = 0; i < count; i++) {
+                OPBlockOperation *operation = OPBenchmarkEmptyOperation();
+                for (NSUInteger j = 0; j < attached; j++) {
+                    [operation addCondition:condition];
+                }
+                [queue addOperation:operation];
+            }
+            [queue waitUntilAllOperationsAreFinished];
+        }];
+
+        [reporter measure:@"cost.observers" parameters:@{ @"observers": attachmentCount } operations:count samples:samples block:^{
+            OPOperationQueue *queue = OPBenchmarkQueue(NO);
+            for (NSUInteger i = 0; i < count; i++) {
+                OPBlockOperation *operation = OPBenchmarkEmptyOperation();
+                for (NSUInteger j = 0; j < attached; j++) {
+                    [operation addObserver:observer];
+                }
+                [queue addOperation:operation];
+            }
+            [queue waitUntilAllOperationsAreFinished];
+        }];
+    }
+}
+
+
+#pragma mark - Main
+#pragma mark -
+
+static void OPBenchmarkUsage(void)
+{
+    fprintf(stderr,
+            "usage: OperativeBenchmarks [--quick] [--filter NAME] [--label LABEL] [--output FILE]\n"
+            "\n"
+            "  --quick         Run smaller problem sizes\n"
+            "  --filter NAME   Only run benchmarks whose name contains NAME\n"
+            "  --label LABEL   Label stored in the report, e.g. a version or commit\n"
+            "  --output FILE   Write the JSON report to FILE instead of stdout\n");
+}
+
+int main(int argc, const char *argv[])
+{
+    @autoreleasepool {
+        OPBenchmarkReporter *reporter = [[OPBenchmarkReporter alloc] init];
+        NSString *output = nil;
+        BOOL quick = NO;
+
+        for (int i = 1; i < argc; i++) {
+            NSString *argument = [NSString stringWithUTF8String:argv[i]];
+            NSString *value = i + 1 < argc ? [NSString stringWithUTF8String:argv[i + 1]] : nil;
+
+            if ([argument isEqualToString:@"--quick"]) {
+                quick = YES;
+            } else if ([argument isEqualToString:@"--filter"] && value) {
+                reporter.filter = value;
+                i++;
+            } else if ([argument isEqualToString:@"--label"] && value) {
+                reporter.label = value;
+                i++;
+            } else if ([argument isEqualToString:@"--output"] && value) {
+                output = value;
+                i++;
+            } else {
+                OPBenchmarkUsage();
+                return 1;
+            }
+        }
+
+        OPBenchmarkEnqueue(reporter, quick);
+        OPBenchmarkLatency(reporter, quick);
+        OPBenchmarkGroup(reporter, quick);
+        OPBenchmarkGraph(reporter, quick);
+        OPBenchmarkExclusivity(reporter, quick);
+        OPBenchmarkConditionsAndObservers(reporter, quick);
+
+        NSData *data = [reporter JSONData];
+        if (output) {
+            if (![data writeToFile:output atomically:YES]) {
+                fprintf(stderr, "Failed to write %s\n", [output UTF8String]);
+                return 1;
+            }
+        } else {
+            fwrite([data bytes], 1, [data length], stdout);
+            fputc('\n', stdout);
+        }
+    }
+
+    return 0;
+}
@@ -96,4 +96,92 @@
     [self waitForExpectationsWithTimeout:1 handler:nil];
 }
 
+- (void)testActivityGaugeCoalescesTransitions {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Gauge should report going idle after its operations"];
+    
+    OPActivityGauge *gauge = [[OPActivityGauge alloc] initWithName:@"Tests"];
+    gauge.minimumNotificationInterval = 0.05;
+    gauge.idleDelay = 0.1;
+    
+    NSUInteger operationCount = 500;
+    __block NSUInteger notificationCount = 0;
+    __block BOOL wasActive = NO;
+    
+    dispatch_queue_t queue = dispatch_queue_create("Tests.ActivityGauge", DISPATCH_QUEUE_SERIAL);
+    [gauge setChangeHandler:^(NSUInteger activityCount, BOOL active) {
+        notificationCount++;
+        if (active) {
+            wasActive = YES;
+        } else if (wasActive) {
+            XCTAssertEqual(activityCount, 0);
+            [expectation fulfill];
+        }
+    } queue:queue];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    for (NSUInteger i = 0; i < operationCount; i++) {
+        OPOperation *operation = [[OPOperation alloc] init];
+        [operation addObserver:[[OPActivityObserver alloc] initWithGauge:gauge]];
+        [operationQueue addOperation:operation];
+    }
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    XCTAssertEqual([gauge activityCount], 0);
+    XCTAssertLessThan(notificationCount, operationCount);
+}
+
+- (void)testActivityObserverIgnoresOperationsThatNeverStart {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Operations which never start should finish"];
+    
+    OPActivityGauge *gauge = [[OPActivityGauge alloc] initWithName:@"Tests"];
+    OPActivityObserver *observer = [[OPActivityObserver alloc] initWithGauge:gauge];
+    
+    // Keeps one activity running throughout.
+    dispatch_semaphore_t running = dispatch_semaphore_create(0);
+    dispatch_semaphore_t release = dispatch_semaphore_create(0);
+    OPBlockOperation *longRunning = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        dispatch_semaphore_signal(running);
+        dispatch_semaphore_wait(release, DISPATCH_TIME_FOREVER);
+        completion();
+    }];
+    [longRunning addObserver:observer];
+    
+    OPOperation *cancelled = [[OPOperation alloc] init];
+    [cancelled addObserver:observer];
+    [cancelled cancel];
+    
+    OPOperation *cancelledDependency = [[OPOperation alloc] init];
+    [cancelledDependency cancel];
+    OPOperation *failingCondition = [[OPOperation alloc] init];
+    [failingCondition addDependency:cancelledDependency];
+    [failingCondition addCondition:[[OPNoCancelledDependenciesCondition alloc] init]];
+    [failingCondition addObserver:observer];
+    
+    __block NSUInteger finishedCount = 0;
+    OPBlockObserver *finishObserver = [[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        @synchronized(self) {
+            if (++finishedCount == 2) {
+                [expectation fulfill];
+            }
+        }
+    }];
+    [cancelled addObserver:finishObserver];
+    [failingCondition addObserver:finishObserver];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    [operationQueue addOperation:longRunning];
+    dispatch_semaphore_wait(running, DISPATCH_TIME_FOREVER);
+    [operationQueue addOperations:@[cancelled, cancelledDependency, failingCondition] waitUntilFinished:NO];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    XCTAssertEqual([gauge activityCount], 1);
+    
+    dispatch_semaphore_signal(release);
+    [operationQueue waitUntilAllOperationsAreFinished];
+    
+    XCTAssertEqual([gauge activityCount], 0);
+}
+
 @end
@@ -0,0 +1,360 @@
+// ConditionsTests.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <XCTest/XCTest.h>
+
+#import <Operative/Operative.h>
+#import <Operative/OPOperationConditionEvaluator.h>
+
+
+@interface CountingCondition : NSObject <OPCacheableOperationCondition>
+
+@property (assign, nonatomic) NSUInteger evaluationCount;
+
+@property (assign, nonatomic) NSTimeInterval cacheTimeToLive;
+
+@end
+
+@implementation CountingCondition
+
+- (NSString *)name {
+    return @"Counting";
+}
+
+- (BOOL)isMutuallyExclusive {
+    return NO;
+}
+
+- (NSString *)cacheKey {
+    return @"key";
+}
+
+- (NSOperation *)dependencyForOperation:(OPOperation *)operation {
+    return nil;
+}
+
+- (void)evaluateConditionForOperation:(OPOperation *)operation
+                           completion:(void (^)(OPOperationConditionResultStatus result, NSError *error))completion {
+    @synchronized(self) {
+        self.evaluationCount++;
+    }
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(50 * NSEC_PER_MSEC)), dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+        completion(OPOperationConditionResultStatusSatisfied, nil);
+    });
+}
+
+@end
+
+
+@interface CountingReachabilityBackend : NSObject <OPReachabilityBackend>
+
+@property (assign, atomic) NSUInteger probeCount;
+
+@property (strong, nonatomic) NSMutableArray *forgottenHosts;
+
+@end
+
+@implementation CountingReachabilityBackend
+
+@synthesize changeHandler = _changeHandler;
+
+- (void)probeHost:(NSString *)host completion:(void (^)(BOOL reachable))completion {
+    self.probeCount++;
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(50 * NSEC_PER_MSEC)), dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+        completion(YES);
+    });
+}
+
+- (void)forgetHost:(NSString *)host {
+    @synchronized(self) {
+        if (!self.forgottenHosts) {
+            self.forgottenHosts = [[NSMutableArray alloc] init];
+        }
+        [self.forgottenHosts addObject:host];
+    }
+}
+
+@end
+
+
+/**
+ *  Completes synchronously unless given a delay, failing with `error` if set.
+ */
+@interface ScriptedCondition : NSObject <OPOperationCondition>
+
+@property (assign, nonatomic) NSTimeInterval delay;
+
+@property (strong, nonatomic) NSError *error;
+
+@end
+
+@implementation ScriptedCondition
+
+- (NSString *)name {
+    return @"Scripted";
+}
+
+- (BOOL)isMutuallyExclusive {
+    return NO;
+}
+
+- (NSOperation *)dependencyForOperation:(OPOperation *)operation {
+    return nil;
+}
+
+- (void)evaluateConditionForOperation:(OPOperation *)operation
+                           completion:(void (^)(OPOperationConditionResultStatus result, NSError *error))completion {
+    OPOperationConditionResultStatus status = self.error ? OPOperationConditionResultStatusFailed : OPOperationConditionResultStatusSatisfied;
+    NSError *error = self.error;
+    
+    if (self.delay <= 0) {
+        completion(status, error);
+        return;
+    }
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.delay * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+        completion(status, error);
+    });
+}
+
+@end
+
+
+@interface ConditionsTests : XCTestCase
+
+@end
+
+@implementation ConditionsTests
+
+- (void)setUp {
+    [super setUp];
+    [[OPConditionCache sharedCache] removeAllResults];
+}
+
+- (void)testOperationWithoutConditionsExecutes {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Operation without conditions should execute"];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    [operationQueue addOperation:[[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        [expectation fulfill];
+        completion();
+    }]];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+}
+
+- (void)testSynchronousConditionsAllowExecution {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Operation with synchronous conditions should execute"];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        [expectation fulfill];
+        completion();
+    }];
+    
+    [operation addCondition:[OPOperationConditionMutuallyExclusive mutuallyExclusiveWith:[ConditionsTests class]]];
+    [operation addCondition:[[OPNoCancelledDependenciesCondition alloc] init]];
+    
+    [operationQueue addOperation:operation];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+}
+
+- (void)testCachedConditionEvaluationsAreCoalesced {
+    NSUInteger operationCount = 20;
+    CountingCondition *condition = [[CountingCondition alloc] init];
+    condition.cacheTimeToLive = 60;
+    
+    OPConditionCache *cache = [OPConditionCache sharedCache];
+    NSUInteger hitCount = [cache hitCount];
+    NSUInteger missCount = [cache missCount];
+    NSUInteger coalescedCount = [cache coalescedCount];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    
+    for (NSUInteger idx = 0; idx < operationCount; idx++) {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"Operation %lu should execute", (unsigned long)idx]];
+        
+        OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+            [expectation fulfill];
+            completion();
+        }];
+        [operation addCondition:condition];
+        
+        [operationQueue addOperation:operation];
+    }
+    
+    [self waitForExpectationsWithTimeout:2 handler:nil];
+    
+    XCTAssertEqual(condition.evaluationCount, 1);
+    XCTAssertEqual([cache missCount] - missCount, 1);
+    XCTAssertEqual(([cache hitCount] - hitCount) + ([cache coalescedCount] - coalescedCount), operationCount - 1);
+}
+
+- (void)testUncachedConditionIsEvaluatedPerOperation {
+    CountingCondition *condition = [[CountingCondition alloc] init];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    
+    for (NSUInteger idx = 0; idx < 3; idx++) {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"Operation %lu should execute", (unsigned long)idx]];
+        
+        OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+            [expectation fulfill];
+            completion();
+        }];
+        [operation addCondition:condition];
+        
+        [operationQueue addOperation:operation];
+    }
+    
+    [self waitForExpectationsWithTimeout:2 handler:nil];
+    
+    XCTAssertEqual(condition.evaluationCount, 3);
+}
+
+- (void)testReachabilityRequestsShareProbesUntilNetworkChanges {
+    CountingReachabilityBackend *backend = [[CountingReachabilityBackend alloc] init];
+    OPReachabilityController *controller = [[OPReachabilityController alloc] initWithBackend:backend];
+    
+    NSUInteger requestCount = 20;
+    for (NSUInteger idx = 0; idx < requestCount; idx++) {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"Request %lu should complete", (unsigned long)idx]];
+        [controller requestReachabilityOfHost:@"example.com" completion:^(BOOL reachable) {
+            XCTAssertTrue(reachable);
+            [expectation fulfill];
+        }];
+    }
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    XCTAssertEqual(backend.probeCount, 1);
+    
+    // Answered from memory, before returning.
+    __block BOOL answered = NO;
+    [controller requestReachabilityOfHost:@"example.com" completion:^(BOOL reachable) {
+        answered = YES;
+    }];
+    XCTAssertTrue(answered);
+    XCTAssertEqual(backend.probeCount, 1);
+    
+    // A change reported by the backend discards the cached result.
+    backend.changeHandler(nil);
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request after a change should probe again"];
+    [controller requestReachabilityOfHost:@"example.com" completion:^(BOOL reachable) {
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    XCTAssertEqual(backend.probeCount, 2);
+}
+
+- (void)testReachabilityForgetsExpiredHostsThatAreNotRequestedAgain {
+    CountingReachabilityBackend *backend = [[CountingReachabilityBackend alloc] init];
+    OPReachabilityController *controller = [[OPReachabilityController alloc] initWithBackend:backend];
+    controller.resultTimeToLive = 0.2;
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"First host should resolve"];
+    [controller requestReachabilityOfHost:@"example.com" completion:^(BOOL reachable) {
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    usleep(300 * 1000);
+    
+    // Requesting any other host sweeps out the expired result.
+    expectation = [self expectationWithDescription:@"Second host should resolve"];
+    [controller requestReachabilityOfHost:@"example.org" completion:^(BOOL reachable) {
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    XCTAssertEqualObjects(backend.forgottenHosts, @[@"example.com"]);
+}
+
+#pragma mark - Evaluator
+
+- (void)testEvaluatorCompletesInlineWithoutConditions {
+    __block NSArray *failures = nil;
+    [OPOperationConditionEvaluator evaluateConditions:@[] operation:[[OPOperation alloc] init] completion:^(NSArray *result) {
+        failures = result;
+    }];
+    
+    XCTAssertEqualObjects(failures, @[]);
+}
+
+- (void)testEvaluatorCompletesSynchronousConditionsOnCallingThread {
+    NSMutableArray *conditions = [[NSMutableArray alloc] init];
+    for (NSUInteger idx = 0; idx < 5; idx++) {
+        [conditions addObject:[[ScriptedCondition alloc] init]];
+    }
+    
+    __block NSArray *failures = nil;
+    __block NSThread *completionThread = nil;
+    [OPOperationConditionEvaluator evaluateConditions:conditions operation:[[OPOperation alloc] init] completion:^(NSArray *result) {
+        failures = result;
+        completionThread = [NSThread currentThread];
+    }];
+    
+    XCTAssertEqualObjects(failures, @[]);
+    XCTAssertEqualObjects(completionThread, [NSThread currentThread]);
+}
+
+- (void)testEvaluatorWaitsForMixedConditionsAndKeepsErrorsInOrder {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Evaluation should complete once"];
+    
+    NSError *slowError = [NSError errorWithDomain:@"ConditionsTests" code:1 userInfo:nil];
+    NSError *fastError = [NSError errorWithDomain:@"ConditionsTests" code:2 userInfo:nil];
+    
+    ScriptedCondition *slow = [[ScriptedCondition alloc] init];
+    slow.delay = 0.1;
+    slow.error = slowError;
+    ScriptedCondition *asynchronous = [[ScriptedCondition alloc] init];
+    asynchronous.delay = 0.05;
+    ScriptedCondition *synchronous = [[ScriptedCondition alloc] init];
+    synchronous.error = fastError;
+    
+    __block NSUInteger completionCount = 0;
+    __block NSArray *failures = nil;
+    [OPOperationConditionEvaluator evaluateConditions:@[slow, asynchronous, synchronous] operation:[[OPOperation alloc] init] completion:^(NSArray *result) {
+        @synchronized(self) {
+            completionCount++;
+            failures = result;
+        }
+        [expectation fulfill];
+    }];
+    
+    // The asynchronous conditions are still outstanding.
+    @synchronized(self) {
+        XCTAssertEqual(completionCount, 0);
+    }
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    XCTAssertEqual(completionCount, 1);
+    // Errors follow the order of the conditions, not of their completion.
+    NSArray *expected = @[slowError, fastError];
+    XCTAssertEqualObjects(failures, expected);
+}
+
+@end
@@ -0,0 +1,554 @@
+// OperationQueueTests.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <XCTest/XCTest.h>
+
+#import <Operative/Operative.h>
+#import <Operative/NSError+Operative.h>
+
+@interface OperationQueueTests : XCTestCase <OPOperationQueueDelegate>
+
+@property (assign, nonatomic) NSUInteger batchCount;
+@property (assign, nonatomic) NSUInteger batchedOperationCount;
+
+@end
+
+@implementation OperationQueueTests
+
+#pragma mark - Exclusivity
+#pragma mark -
+
+- (void)testMutuallyExclusiveOperationsNeverOverlapAcrossQueues {
+    NSUInteger operationCount = 40;
+    NSMutableArray *expectations = [[NSMutableArray alloc] init];
+    NSMutableArray *queues = [[NSMutableArray alloc] init];
+    
+    for (NSUInteger idx = 0; idx < 4; idx++) {
+        [queues addObject:[[OPOperationQueue alloc] init]];
+    }
+    
+    __block NSInteger running = 0;
+    __block NSInteger maximumRunning = 0;
+    
+    for (NSUInteger idx = 0; idx < operationCount; idx++) {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"Operation %lu should finish", (unsigned long)idx]];
+        [expectations addObject:expectation];
+        
+        OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+            @synchronized(self) {
+                running++;
+                maximumRunning = MAX(running, maximumRunning);
+            }
+            
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(NSEC_PER_MSEC)), dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+                @synchronized(self) {
+                    running--;
+                }
+                completion();
+            });
+        }];
+        
+        [operation addCondition:[OPOperationConditionMutuallyExclusive mutuallyExclusiveWith:[OperationQueueTests class]]];
+        [operation addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+            [expectation fulfill];
+        }]];
+        
+        [queues[idx % [queues count]] addOperation:operation];
+    }
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    XCTAssertEqual(maximumRunning, 1);
+}
+
+#pragma mark - Batches
+#pragma mark -
+
+- (void)operationQueue:(OPOperationQueue *)operationQueue willAddOperations:(NSArray *)operations {
+    self.batchCount++;
+    self.batchedOperationCount += [operations count];
+}
+
+- (void)testAddOperationsNotifiesDelegateOncePerBatch {
+    NSUInteger operationCount = 100;
+    NSMutableArray *operations = [[NSMutableArray alloc] init];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    [operationQueue setSuspended:YES];
+    [operationQueue setDelegate:self];
+    
+    for (NSUInteger idx = 0; idx < operationCount; idx++) {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"Operation %lu should finish", (unsigned long)idx]];
+        
+        [operations addObject:[[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+            [expectation fulfill];
+            completion();
+        }]];
+    }
+    
+    [operationQueue addOperations:operations waitUntilFinished:NO];
+    
+    XCTAssertEqual(self.batchCount, 1);
+    XCTAssertEqual(self.batchedOperationCount, operationCount);
+    
+    [operationQueue setSuspended:NO];
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+#pragma mark - Executor
+#pragma mark -
+
+- (void)testExecutorRunsDependentOperationsInOrder {
+    NSUInteger operationCount = 50;
+    NSMutableArray *order = [[NSMutableArray alloc] init];
+    NSMutableArray *operations = [[NSMutableArray alloc] init];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    operationQueue.executor = [[OPWorkStealingExecutor alloc] initWithWorkerCount:4];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Last operation should finish"];
+    
+    for (NSUInteger idx = 0; idx < operationCount; idx++) {
+        OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+            @synchronized(order) {
+                [order addObject:@(idx)];
+            }
+            if (idx == operationCount - 1) {
+                [expectation fulfill];
+            }
+            completion();
+        }];
+        
+        if ([operations lastObject]) {
+            [operation addDependency:[operations lastObject]];
+        }
+        [operations addObject:operation];
+    }
+    
+    [operationQueue addOperations:[[operations reverseObjectEnumerator] allObjects] waitUntilFinished:NO];
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    for (NSUInteger idx = 0; idx < operationCount; idx++) {
+        XCTAssertEqualObjects(order[idx], @(idx));
+    }
+}
+
+- (void)testExecutorRunsProducedOperations {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Produced operation should execute"];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    operationQueue.executor = [[OPWorkStealingExecutor alloc] initWithWorkerCount:2];
+    
+    __block OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        [operation produceOperation:[[OPBlockOperation alloc] initWithBlock:^(void (^produced)(void)) {
+            [expectation fulfill];
+            produced();
+        }]];
+        operation = nil;
+        completion();
+    }];
+    
+    [operationQueue addOperation:operation];
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+- (void)testExecutorHonoursSuspension {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Operation should execute once resumed"];
+    __block BOOL resumed = NO;
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    operationQueue.executor = [[OPWorkStealingExecutor alloc] initWithWorkerCount:2];
+    [operationQueue setSuspended:YES];
+    
+    [operationQueue addOperation:[[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        XCTAssertTrue(resumed);
+        [expectation fulfill];
+        completion();
+    }]];
+    
+    XCTAssertEqual([operationQueue operationCount], 1);
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(100 * NSEC_PER_MSEC)), dispatch_get_main_queue(), ^{
+        resumed = YES;
+        [operationQueue setSuspended:NO];
+    });
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+- (void)testNestedGroupsShareExecutorAndHonourConcurrencyLimit {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Outer group should finish"];
+    
+    [OPGroupOperation setSharesExecutor:YES];
+    
+    __block NSInteger running = 0;
+    __block NSInteger maxRunning = 0;
+    __block NSInteger executed = 0;
+    
+    NSMutableArray *innerGroups = [[NSMutableArray alloc] init];
+    for (NSUInteger i = 0; i < 4; i++) {
+        NSMutableArray *children = [[NSMutableArray alloc] init];
+        for (NSUInteger j = 0; j < 10; j++) {
+            [children addObject:[[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+                @synchronized(self) {
+                    running++;
+                    maxRunning = MAX(maxRunning, running);
+                }
+                usleep(1000);
+                @synchronized(self) {
+                    running--;
+                    executed++;
+                }
+                completion();
+            }]];
+        }
+        
+        OPGroupOperation *innerGroup = [[OPGroupOperation alloc] initWithOperations:children];
+        innerGroup.maxConcurrentOperationCount = 1;
+        [innerGroups addObject:innerGroup];
+    }
+    
+    OPGroupOperation *outerGroup = [[OPGroupOperation alloc] initWithOperations:innerGroups];
+    outerGroup.maxConcurrentOperationCount = 2;
+    
+    [OPGroupOperation setSharesExecutor:NO];
+    
+    [outerGroup addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        [expectation fulfill];
+    }]];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    operationQueue.executor = [[OPWorkStealingExecutor alloc] initWithWorkerCount:4];
+    [operationQueue addOperation:outerGroup];
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    // Two inner groups at a time, each running one child at a time.
+    XCTAssertEqual(executed, 40);
+    XCTAssertLessThanOrEqual(maxRunning, 2);
+}
+
+#pragma mark - Capacity
+
+- (void)testProducedOperationsAreDeferredWhileQueueIsFull {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Every produced operation should execute"];
+    
+    NSUInteger producedCount = 20;
+    __block NSUInteger executedCount = 0;
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    operationQueue.capacity = 2;
+    
+    __block OPBlockOperation *producer = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        __block NSUInteger produced = 0;
+        __block void (^produceNext)(void);
+        
+        // Each operation is produced only once the previous one was accepted.
+        produceNext = ^{
+            if (produced == producedCount) {
+                // Break the cycle once this block has returned.
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    produceNext = nil;
+                });
+                producer = nil;
+                completion();
+                return;
+            }
+            produced++;
+            
+            OPBlockOperation *child = [[OPBlockOperation alloc] initWithBlock:^(void (^childCompletion)(void)) {
+                usleep(1000);
+                @synchronized(self) {
+                    if (++executedCount == producedCount) {
+                        [expectation fulfill];
+                    }
+                }
+                childCompletion();
+            }];
+            [producer produceOperation:child whenAccepted:produceNext];
+        };
+        produceNext();
+    }];
+    
+    [operationQueue addOperation:producer];
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    XCTAssertEqual(executedCount, producedCount);
+    XCTAssertLessThanOrEqual([operationQueue occupancyHighWaterMark], 2);
+    XCTAssertLessThanOrEqual([operationQueue deferredHighWaterMark], 1);
+}
+
+- (void)testPlainProducersAreThrottledByMaximumDeferredOperationCount {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Every produced operation should execute"];
+
+    NSUInteger producedCount = 20;
+    __block NSUInteger executedCount = 0;
+
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    operationQueue.capacity = 2;
+    operationQueue.maximumDeferredOperationCount = 3;
+
+    __block __weak OPBlockOperation *weakProducer;
+    OPBlockOperation *producer = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        for (NSUInteger idx = 0; idx < producedCount; idx++) {
+            OPBlockOperation *child = [[OPBlockOperation alloc] initWithBlock:^(void (^childCompletion)(void)) {
+                usleep(1000);
+                @synchronized(self) {
+                    if (++executedCount == producedCount) {
+                        [expectation fulfill];
+                    }
+                }
+                childCompletion();
+            }];
+            [weakProducer produceOperation:child];
+        }
+        completion();
+    }];
+    weakProducer = producer;
+
+    [operationQueue addOperation:producer];
+
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    XCTAssertEqual(executedCount, producedCount);
+    XCTAssertLessThanOrEqual([operationQueue occupancyHighWaterMark], 2);
+    XCTAssertLessThanOrEqual([operationQueue deferredHighWaterMark], 3);
+}
+
+#pragma mark - Deduplication
+
+- (void)testDuplicateOperationsAttachToInFlightOperation {
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    NSError *refreshError = [NSError errorWithDomain:@"OperationQueueTests" code:1 userInfo:nil];
+    
+    __block NSUInteger executedCount = 0;
+    NSMutableArray *operations = [[NSMutableArray alloc] init];
+    NSMutableArray *finishedErrors = [[NSMutableArray alloc] init];
+    
+    for (NSUInteger idx = 0; idx < 5; idx++) {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"Submission %lu should finish", (unsigned long)idx]];
+        
+        __block __weak OPBlockOperation *weakOperation;
+        OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+            @synchronized(self) {
+                executedCount++;
+            }
+            usleep(50000);
+            [weakOperation cancelWithError:refreshError];
+            completion();
+        }];
+        weakOperation = operation;
+        operation.deduplicationKey = @"refresh-user-123";
+        [operation addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+            @synchronized(self) {
+                [finishedErrors addObject:errors];
+            }
+            [expectation fulfill];
+        }]];
+        [operations addObject:operation];
+        
+        [operationQueue addOperation:operation];
+    }
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    XCTAssertEqual(executedCount, 1);
+    for (NSArray *errors in finishedErrors) {
+        XCTAssertEqualObjects(errors, @[refreshError]);
+    }
+    for (OPOperation *operation in operations) {
+        XCTAssertTrue([operation isCancelled]);
+    }
+    
+    // Once the first has finished, the key is free to run again.
+    XCTestExpectation *rerun = [self expectationWithDescription:@"A later submission should execute"];
+    OPBlockOperation *later = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        [rerun fulfill];
+        completion();
+    }];
+    later.deduplicationKey = @"refresh-user-123";
+    [operationQueue addOperation:later];
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+- (void)testDuplicateOperationsFinishWithInFlightResult {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Duplicate should finish"];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    NSData *payload = [[NSMutableData alloc] initWithLength:1024];
+    
+    __block __weak OPBlockOperation *weakLeader;
+    OPBlockOperation *leader = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        usleep(50000);
+        [weakLeader finishWithResult:payload];
+    }];
+    weakLeader = leader;
+    leader.deduplicationKey = @"export";
+    
+    OPOperation *duplicate = [[OPOperation alloc] init];
+    duplicate.deduplicationKey = @"export";
+    [duplicate addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        [expectation fulfill];
+    }]];
+    
+    [operationQueue addOperation:leader];
+    [operationQueue addOperation:duplicate];
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    XCTAssertEqual([duplicate result], payload);
+}
+
+#pragma mark - Graphs
+
+- (void)testOperationGraphRunsEachNodeAfterItsPredecessors {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Every node should run"];
+    
+    NSUInteger width = 50;
+    NSUInteger layers = 20;
+    NSUInteger nodeCount = width * layers;
+    uint64_t *finishOrder = calloc(nodeCount, sizeof(uint64_t));
+    __block uint64_t finished = 0;
+    
+    OPOperationGraph *graph = [[OPOperationGraph alloc] initWithCapacity:nodeCount];
+    __weak OPOperationGraph *weakGraph = graph;
+    for (NSUInteger node = 0; node < nodeCount; node++) {
+        OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+            // Predecessors have fully finished, not merely begun finishing.
+            if (node >= width) {
+                XCTAssertTrue([[weakGraph operationAtIndex:node - width] isFinished]);
+            }
+            @synchronized(self) {
+                finishOrder[node] = ++finished;
+                if (finished == nodeCount) {
+                    [expectation fulfill];
+                }
+            }
+            completion();
+        }];
+        [graph addOperation:operation];
+    }
+    
+    // Each node depends on two nodes of the layer before it.
+    for (NSUInteger layer = 1; layer < layers; layer++) {
+        for (NSUInteger column = 0; column < width; column++) {
+            NSUInteger node = layer * width + column;
+            [graph addDependencyFromIndex:node toIndex:(layer - 1) * width + column];
+            [graph addDependencyFromIndex:node toIndex:(layer - 1) * width + (column + 1) % width];
+        }
+    }
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    NSError *error = nil;
+    XCTAssertTrue([operationQueue addOperationGraph:graph error:&error]);
+    XCTAssertNil(error);
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    for (NSUInteger node = width; node < nodeCount; node++) {
+        NSUInteger layer = node / width;
+        NSUInteger column = node % width;
+        XCTAssertGreaterThan(finishOrder[node], finishOrder[(layer - 1) * width + column]);
+        XCTAssertGreaterThan(finishOrder[node], finishOrder[(layer - 1) * width + (column + 1) % width]);
+    }
+    free(finishOrder);
+    
+    // A graph with a cycle is refused without adding anything.
+    OPOperationGraph *cyclic = [[OPOperationGraph alloc] init];
+    for (NSString *name in @[@"a", @"b", @"c"]) {
+        OPOperation *operation = [[OPOperation alloc] init];
+        operation.name = name;
+        [cyclic addOperation:operation];
+    }
+    [cyclic addDependencyFromIndex:1 toIndex:0];
+    [cyclic addDependencyFromIndex:2 toIndex:1];
+    [cyclic addDependencyFromIndex:0 toIndex:2];
+    
+    XCTAssertFalse([operationQueue addOperationGraph:cyclic error:&error]);
+    XCTAssertEqual([error code], OPOperationErrorCodeDependencyCycle);
+    XCTAssertEqual([error.userInfo[kOPOperationDependencyCycleKey] count], 3);
+    XCTAssertNil([cyclic operationsInTopologicalOrder]);
+    
+    // As is a graph holding the same operation twice.
+    OPOperationGraph *duplicated = [[OPOperationGraph alloc] init];
+    OPOperation *repeated = [[OPOperation alloc] init];
+    [duplicated addOperation:repeated];
+    [duplicated addOperation:[[OPOperation alloc] init]];
+    [duplicated addOperation:repeated];
+    
+    XCTAssertFalse([operationQueue addOperationGraph:duplicated error:&error]);
+    XCTAssertEqual([error code], OPOperationErrorCodeDuplicateOperation);
+    XCTAssertNil([duplicated operationsInTopologicalOrder]);
+}
+
+#pragma mark - Priority
+
+- (void)testPriorityLanesAgeWaitingOperations {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Every operation should execute"];
+    
+    NSMutableArray *order = [[NSMutableArray alloc] init];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    operationQueue.executor = [[OPWorkStealingExecutor alloc] initWithWorkerCount:1];
+    OPPriorityPolicy *policy = [OPPriorityPolicy defaultPolicy];
+    policy.agingInterval = 0.01;
+    operationQueue.priorityPolicy = policy;
+    [operationQueue setSuspended:YES];
+    
+    OPBlockOperation *(^makeOperation)(NSString *, NSOperationQueuePriority) = ^(NSString *name, NSOperationQueuePriority priority) {
+        OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+            @synchronized(order) {
+                [order addObject:name];
+                if ([order count] == 3) {
+                    [expectation fulfill];
+                }
+            }
+            completion();
+        }];
+        operation.queuePriority = priority;
+        return operation;
+    };
+    
+    // Has waited long enough to overtake everything else.
+    [operationQueue addOperation:makeOperation(@"aged", NSOperationQueuePriorityVeryLow)];
+    usleep(100 * 1000);
+    
+    [operationQueue addOperation:makeOperation(@"low", NSOperationQueuePriorityLow)];
+    [operationQueue addOperation:makeOperation(@"high", NSOperationQueuePriorityVeryHigh)];
+    
+    [operationQueue setSuspended:NO];
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    NSArray *expected = @[ @"aged", @"high", @"low" ];
+    XCTAssertEqualObjects(order, expected);
+    
+    OPPriorityLaneStatistics *veryLow = [[operationQueue priorityLaneStatistics] firstObject];
+    XCTAssertEqual([veryLow startedCount], 1);
+    XCTAssertGreaterThanOrEqual([veryLow maxWaitTime], 0.1);
+}
+
+@end
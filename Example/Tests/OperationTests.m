@@ -0,0 +1,490 @@
+// OperationTests.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <XCTest/XCTest.h>
+
+#import <Operative/Operative.h>
+#import <Operative/NSError+Operative.h>
+#import <Operative/NSOperation+Operative.h>
+#import <Operative/OPOperation+Private.h>
+
+@interface OperationTests : XCTestCase
+
+@end
+
+@implementation OperationTests
+
+- (void)testConcurrentFinishNotifiesObserversOnce {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Operation should finish exactly once"];
+    
+    __block NSInteger finishCount = 0;
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        dispatch_apply(16, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^(size_t idx) {
+            completion();
+        });
+    }];
+    
+    [operation addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        @synchronized(self) {
+            finishCount++;
+        }
+    }]];
+    
+    [operation addCompletionBlock:^{
+        [expectation fulfill];
+    }];
+    
+    [operationQueue addOperation:operation];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    XCTAssertEqual(finishCount, 1);
+    XCTAssertTrue([operation isFinished]);
+    XCTAssertFalse([operation isExecuting]);
+}
+
+- (void)testExecutingStateIsVisibleDuringExecute {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Operation should be executing inside -execute"];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    __block OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        XCTAssertTrue([operation isExecuting]);
+        XCTAssertFalse([operation isFinished]);
+        completion();
+        XCTAssertFalse([operation isExecuting]);
+        XCTAssertTrue([operation isFinished]);
+        operation = nil;
+        [expectation fulfill];
+    }];
+    
+    [operationQueue addOperation:operation];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+}
+
+- (void)testCancelledOperationFinishesWithoutExecuting {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Cancelled operation should still finish"];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        XCTFail(@"Cancelled operation should not execute");
+        completion();
+    }];
+    
+    [operation addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        [expectation fulfill];
+    }]];
+    
+    [operation cancel];
+    [operationQueue addOperation:operation];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+}
+
+- (void)testFanInWaitsForEveryDependency {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Dependent should run after all dependencies"];
+    
+    __block NSInteger finishedDependencies = 0;
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    OPBlockOperation *dependent = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        @synchronized(self) {
+            XCTAssertEqual(finishedDependencies, 65);
+        }
+        completion();
+        [expectation fulfill];
+    }];
+    
+    NSMutableArray *dependencies = [[NSMutableArray alloc] init];
+    for (NSInteger i = 0; i < 64; i++) {
+        OPBlockOperation *dependency = [[OPBlockOperation alloc] initWithMainQueueBlock:^{
+            @synchronized(self) {
+                finishedDependencies++;
+            }
+        }];
+        [dependent addDependency:dependency];
+        [dependencies addObject:dependency];
+    }
+    
+    // Plain NSOperations are tracked too
+    NSBlockOperation *blockOperation = [NSBlockOperation blockOperationWithBlock:^{
+        @synchronized(self) {
+            finishedDependencies++;
+        }
+    }];
+    [dependent addDependency:blockOperation];
+    [dependencies addObject:blockOperation];
+    
+    XCTAssertEqual([[dependent dependencies] count], 65);
+    
+    [operationQueue addOperation:dependent];
+    [operationQueue addOperations:dependencies waitUntilFinished:NO];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+}
+
+- (void)testTraceRecordsStateTransitionsAndObservers {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Traced operation should finish"];
+    
+    [OPTrace reset];
+    [OPTrace start];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        completion();
+    }];
+    
+    [operation addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {}]];
+    [operation setCompletionBlock:^{
+        [expectation fulfill];
+    }];
+    
+    [operationQueue addOperation:operation];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    [OPTrace stop];
+    
+    NSDictionary *trace = [NSJSONSerialization JSONObjectWithData:[OPTrace chromeTraceData] options:0 error:nil];
+    NSString *operationID = [NSString stringWithFormat:@"0x%llx", (unsigned long long)[operation traceID]];
+    
+    // Identifiers aren't reused, even if addresses are.
+    XCTAssertGreaterThan([[[OPOperation alloc] init] traceID], [operation traceID]);
+    
+    NSMutableArray *states = [[NSMutableArray alloc] init];
+    BOOL sawObserver = NO;
+    for (NSDictionary *event in trace[@"traceEvents"]) {
+        if ([event[@"id"] isEqual:operationID] && ![event[@"ph"] isEqual:@"e"]) {
+            [states addObject:event[@"name"]];
+        }
+        if ([event[@"cat"] isEqual:@"observer.finish"] && [event[@"args"][@"operation"] isEqual:operationID]) {
+            sawObserver = YES;
+        }
+    }
+    
+    NSArray *expected = @[ @"Pending", @"EvaluatingConditions", @"Ready", @"Executing", @"Finishing", @"Finished" ];
+    XCTAssertEqualObjects(states, expected);
+    XCTAssertTrue(sawObserver);
+}
+
+- (void)testGroupAggregatesErrorsFromEveryChild {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Group should finish after every child"];
+    
+    NSUInteger childCount = 1000;
+    NSMutableArray *children = [[NSMutableArray alloc] initWithCapacity:childCount];
+    for (NSUInteger i = 0; i < childCount; i++) {
+        [children addObject:[[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+            completion();
+        }]];
+    }
+    
+    OPGroupOperation *group = [[OPGroupOperation alloc] initWithOperations:children];
+    
+    // Children added after creation, and errors aggregated directly, are
+    // included too.
+    [group addOperation:[NSBlockOperation blockOperationWithBlock:^{
+        [group aggregateError:[NSError errorWithDomain:@"Tests" code:1 userInfo:nil]];
+    }]];
+    
+    // The group mustn't finish while any child is still finishing.
+    __block NSArray *finishErrors;
+    __block NSUInteger unfinishedChildren = NSNotFound;
+    [group addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        finishErrors = errors;
+        unfinishedChildren = 0;
+        for (OPBlockOperation *child in children) {
+            unfinishedChildren += [child isFinished] ? 0 : 1;
+        }
+        [expectation fulfill];
+    }]];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    [operationQueue addOperation:group];
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    XCTAssertEqual([finishErrors count], 1);
+    XCTAssertEqual(unfinishedChildren, 0);
+    for (OPBlockOperation *child in children) {
+        XCTAssertTrue([child isFinished]);
+    }
+}
+
+- (void)testTimeoutObserverCancelsStalledOperation {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Stalled operation should time out"];
+    
+    OPTimerWheel *timerWheel = [OPTimerWheel sharedTimerWheel];
+    
+    // Never calls its completion block
+    OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+    }];
+    [operation addObserver:[[OPTimeoutObserver alloc] initWithTimeout:0.05]];
+    
+    __block NSArray *finishErrors;
+    [operation addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *op, NSArray *errors) {
+        finishErrors = errors;
+        [expectation fulfill];
+    }]];
+    
+    // A delay that is cancelled before expiring disarms its timer.
+    OPDelayOperation *delay = [[OPDelayOperation alloc] initWithTimeInterval:60];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    [operationQueue addOperations:@[operation, delay] waitUntilFinished:NO];
+    
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    XCTAssertEqual([finishErrors count], 1);
+    XCTAssertTrue([operation isCancelled]);
+    
+    [delay cancel];
+    [operationQueue waitUntilAllOperationsAreFinished];
+    XCTAssertTrue([delay isFinished]);
+    XCTAssertEqual([timerWheel armedCount], 0);
+}
+
+- (void)testDependencyCycleCancelsClosingOperation {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Operations on a cycle should still finish"];
+    
+    // Created out of order, so adding these dependencies reorders the graph.
+    OPOperation *c = [[OPOperation alloc] init];
+    OPOperation *b = [[OPOperation alloc] init];
+    OPOperation *a = [[OPOperation alloc] init];
+    a.name = @"a";
+    b.name = @"b";
+    c.name = @"c";
+    
+    [b addDependency:a];
+    [c addDependency:b];
+    XCTAssertFalse([a isCancelled]);
+    
+    __block NSArray *finishErrors;
+    [a addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        finishErrors = errors;
+    }]];
+    [c addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        [expectation fulfill];
+    }]];
+    
+    [a addDependency:c];
+    XCTAssertTrue([a isCancelled]);
+    XCTAssertEqual([[a dependencies] count], 0);
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    operationQueue.verifiesDependencyGraph = YES;
+    [operationQueue addOperations:@[a, b, c] waitUntilFinished:NO];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    NSError *error = [finishErrors firstObject];
+    XCTAssertEqual([error code], OPOperationErrorCodeDependencyCycle);
+    NSArray *expected = @[@"c", @"a", @"b"];
+    XCTAssertEqualObjects(error.userInfo[kOPOperationDependencyCycleKey], expected);
+}
+
+- (void)testConcurrentCancelWithErrorKeepsEveryError {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Cancelled operation should finish with every error"];
+    
+    OPOperation *operation = [[OPOperation alloc] init];
+    
+    __block NSArray *finishErrors;
+    [operation addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *op, NSArray *errors) {
+        finishErrors = errors;
+        [expectation fulfill];
+    }]];
+    
+    dispatch_apply(100, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^(size_t idx) {
+        [operation cancelWithError:[NSError errorWithDomain:@"Tests" code:(NSInteger)idx userInfo:nil]];
+    });
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    [operationQueue addOperation:operation];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    XCTAssertEqual([finishErrors count], 100);
+}
+
+- (void)testCancellingGroupCancelsNestedChildren {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Cancelled group should finish"];
+    
+    NSMutableArray *children = [[NSMutableArray alloc] init];
+    for (NSUInteger i = 0; i < 100; i++) {
+        [children addObject:[[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+            XCTFail(@"Children of a cancelled group should not execute");
+            completion();
+        }]];
+    }
+    OPGroupOperation *inner = [[OPGroupOperation alloc] initWithOperations:children];
+    
+    OPGroupOperation *outer = [[OPGroupOperation alloc] init];
+    OPBlockOperation *gate = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        [outer cancel];
+        completion();
+    }];
+    [inner addDependency:gate];
+    [outer addOperations:@[gate, inner]];
+    
+    [outer addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        [expectation fulfill];
+    }]];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    [operationQueue addOperation:outer];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    XCTAssertTrue([inner isCancelled]);
+    for (OPBlockOperation *child in children) {
+        XCTAssertTrue([child isCancelled]);
+    }
+}
+
+- (void)testCancellingGroupStopsExecutingDelay {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Cancelled group should finish without waiting for the delay"];
+    
+    // Executing when the group is cancelled, so it has to be told directly.
+    OPDelayOperation *delay = [[OPDelayOperation alloc] initWithTimeInterval:60];
+    OPGroupOperation *group = [[OPGroupOperation alloc] initWithOperations:@[delay]];
+    
+    [delay addObserver:[[OPBlockObserver alloc] initWithStartHandler:^(OPOperation *operation) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.1 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            [group cancel];
+        });
+    } produceHandler:nil finishHandler:nil]];
+    
+    [group addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        [expectation fulfill];
+    }]];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    [operationQueue addOperation:group];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    XCTAssertTrue([delay isCancelled]);
+    XCTAssertTrue([delay isFinished]);
+}
+
+- (void)testDependentsReceiveResultWithoutCopying {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Consumer should execute"];
+    
+    NSData *payload = [[NSMutableData alloc] initWithLength:1024 * 1024];
+    
+    __block __weak OPBlockOperation *weakProducer;
+    OPBlockOperation *producer = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        [weakProducer finishWithResult:payload];
+    }];
+    weakProducer = producer;
+    
+    __block __weak OPBlockOperation *weakConsumer;
+    __block NSData *received;
+    OPBlockOperation *consumer = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        received = [weakConsumer dependencyResultOfClass:[NSData class]];
+        XCTAssertNil([weakConsumer dependencyResultOfClass:[NSString class]]);
+        completion();
+        [expectation fulfill];
+    }];
+    weakConsumer = consumer;
+    [consumer addDependency:producer];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    [operationQueue addOperations:@[producer, consumer] waitUntilFinished:NO];
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    XCTAssertTrue(received == payload);
+    
+    XCTAssertTrue([producer takeResult] == payload);
+    XCTAssertNil([producer result]);
+    XCTAssertNil([producer takeResult]);
+}
+
+- (void)testObserversBeyondInlineStorageAreNotified {
+    NSUInteger observerCount = 6;
+    NSUInteger operationCount = 2;
+    XCTestExpectation *finished = [self expectationWithDescription:@"Every operation should finish"];
+    XCTestExpectation *produced = [self expectationWithDescription:@"Every produced operation should reach the queue"];
+    
+    __block NSUInteger finishedOperations = 0;
+    __block NSUInteger producedOperations = 0;
+    NSUInteger *starts = calloc(observerCount, sizeof(NSUInteger));
+    NSUInteger *produces = calloc(observerCount, sizeof(NSUInteger));
+    NSUInteger *finishes = calloc(observerCount, sizeof(NSUInteger));
+    
+    // Each observer is shared by every operation, and with the queue's own
+    // observer, each operation has more than fit inline.
+    NSMutableArray *observers = [[NSMutableArray alloc] init];
+    for (NSUInteger idx = 0; idx < observerCount; idx++) {
+        [observers addObject:[[OPBlockObserver alloc] initWithStartHandler:^(OPOperation *operation) {
+            @synchronized(self) {
+                starts[idx]++;
+            }
+        } produceHandler:^(OPOperation *operation, NSOperation *newOperation) {
+            @synchronized(self) {
+                produces[idx]++;
+            }
+        } finishHandler:^(OPOperation *operation, NSArray *errors) {
+            @synchronized(self) {
+                finishes[idx]++;
+                if (idx == observerCount - 1 && finishes[idx] == operationCount) {
+                    [finished fulfill];
+                }
+            }
+        }]];
+    }
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    for (NSUInteger idx = 0; idx < operationCount; idx++) {
+        __block __weak OPBlockOperation *weakOperation;
+        OPBlockOperation *operation = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+            [weakOperation produceOperation:[[OPBlockOperation alloc] initWithBlock:^(void (^producedCompletion)(void)) {
+                @synchronized(self) {
+                    if (++producedOperations == operationCount) {
+                        [produced fulfill];
+                    }
+                }
+                producedCompletion();
+            }]];
+            completion();
+        }];
+        weakOperation = operation;
+        for (OPBlockObserver *observer in observers) {
+            [operation addObserver:observer];
+        }
+        [operationQueue addOperation:operation];
+    }
+    
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    
+    for (NSUInteger idx = 0; idx < observerCount; idx++) {
+        XCTAssertEqual(starts[idx], operationCount);
+        XCTAssertEqual(produces[idx], operationCount);
+        XCTAssertEqual(finishes[idx], operationCount);
+    }
+    free(starts);
+    free(produces);
+    free(finishes);
+}
+
+@end
@@ -0,0 +1,227 @@
+// StreamingTests.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <XCTest/XCTest.h>
+
+#import <Operative/Operative.h>
+
+#import <arpa/inet.h>
+#import <netinet/in.h>
+#import <sys/socket.h>
+#import <unistd.h>
+
+
+/**
+ *  A minimal HTTP/1.1 stand-in listening on the loopback interface, which
+ *  answers every request with a fixed number of patterned bytes.
+ */
+@interface LoopbackHTTPServer : NSObject
+
+- (instancetype)initWithBodyLength:(NSUInteger)bodyLength;
+
+@property (assign, nonatomic, readonly) uint16_t port;
+
+- (void)stop;
+
+@end
+
+@implementation LoopbackHTTPServer {
+    int _listener;
+    NSUInteger _bodyLength;
+}
+
+- (instancetype)initWithBodyLength:(NSUInteger)bodyLength
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _bodyLength = bodyLength;
+    _listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in address = { 0 };
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+
+    socklen_t length = sizeof(address);
+    if (bind(_listener, (struct sockaddr *)&address, length) != 0 || listen(_listener, 4) != 0) {
+        close(_listener);
+        return nil;
+    }
+
+    getsockname(_listener, (struct sockaddr *)&address, &length);
+    _port = ntohs(address.sin_port);
+
+    int listener = _listener;
+    NSUInteger body = bodyLength;
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+        int connection;
+        while ((connection = accept(listener, NULL, NULL)) >= 0) {
+            [LoopbackHTTPServer serveConnection:connection bodyLength:body];
+        }
+    });
+
+    return self;
+}
+
++ (void)serveConnection:(int)connection bodyLength:(NSUInteger)bodyLength
+{
+    // Read up to the end of the request headers.
+    char buffer[4096];
+    NSMutableData *request = [[NSMutableData alloc] init];
+    ssize_t count;
+    while ((count = read(connection, buffer, sizeof(buffer))) > 0) {
+        [request appendBytes:buffer length:(NSUInteger)count];
+        NSData *terminator = [@"\r\n\r\n" dataUsingEncoding:NSASCIIStringEncoding];
+        if ([request rangeOfData:terminator options:0 range:NSMakeRange(0, [request length])].location != NSNotFound) {
+            break;
+        }
+    }
+
+    NSString *header = [NSString stringWithFormat:@"HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n", (unsigned long)bodyLength];
+    NSData *headerData = [header dataUsingEncoding:NSASCIIStringEncoding];
+    write(connection, [headerData bytes], [headerData length]);
+
+    for (NSUInteger idx = 0; idx < sizeof(buffer); idx++) {
+        buffer[idx] = (char)(idx & 0xFF);
+    }
+
+    NSUInteger sent = 0;
+    while (sent < bodyLength) {
+        size_t offset = sent % sizeof(buffer);
+        size_t chunk = MIN(bodyLength - sent, sizeof(buffer) - offset);
+        ssize_t written = write(connection, buffer + offset, chunk);
+        if (written <= 0) {
+            break;
+        }
+        sent += (NSUInteger)written;
+    }
+
+    close(connection);
+}
+
+- (void)stop
+{
+    shutdown(_listener, SHUT_RDWR);
+    close(_listener);
+}
+
+@end
+
+
+@interface StreamingTests : XCTestCase
+
+@end
+
+@implementation StreamingTests
+
+- (void)testStreamIsConsumedWhileDownloadingWithinCapacity {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Consumer should receive the whole body"];
+    
+    NSUInteger bodyLength = 16 * 1024 * 1024;
+    NSUInteger capacity = 256 * 1024;
+    
+    LoopbackHTTPServer *server = [[LoopbackHTTPServer alloc] initWithBodyLength:bodyLength];
+    XCTAssertNotNil(server);
+    
+    NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%u/export", [server port]]];
+    OPURLSessionStreamOperation *download = [[OPURLSessionStreamOperation alloc] initWithRequest:[NSURLRequest requestWithURL:url]
+                                                                                   configuration:[NSURLSessionConfiguration ephemeralSessionConfiguration]
+                                                                                 channelCapacity:capacity];
+    
+    __block NSUInteger received = 0;
+    __block BOOL patternMatches = YES;
+    OPStreamChannel *channel = [download channel];
+    OPBlockOperation *consumer = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        NSData *data;
+        while ((data = [channel receiveData])) {
+            const uint8_t *bytes = [data bytes];
+            for (NSUInteger idx = 0; idx < [data length]; idx++) {
+                if (bytes[idx] != (uint8_t)(((received + idx) % 4096) & 0xFF)) {
+                    patternMatches = NO;
+                }
+            }
+            received += [data length];
+            
+            // Consume more slowly than the loopback produces.
+            usleep(100);
+        }
+        completion();
+    }];
+    
+    [consumer addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        [expectation fulfill];
+    }]];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    [operationQueue addOperations:@[download, consumer] waitUntilFinished:NO];
+    
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    [server stop];
+    
+    XCTAssertNil([channel error]);
+    XCTAssertEqual(received, bodyLength);
+    XCTAssertTrue(patternMatches);
+    
+    // Beyond the capacity, only chunks already in flight are ever buffered.
+    XCTAssertLessThanOrEqual([channel highWaterMark], capacity + 1024 * 1024);
+}
+
+- (void)testConsumerStoppingEarlyCancelsDownload {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Download should finish once the consumer stops"];
+    
+    NSUInteger bodyLength = 16 * 1024 * 1024;
+    
+    LoopbackHTTPServer *server = [[LoopbackHTTPServer alloc] initWithBodyLength:bodyLength];
+    XCTAssertNotNil(server);
+    
+    NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%u/export", [server port]]];
+    OPURLSessionStreamOperation *download = [[OPURLSessionStreamOperation alloc] initWithRequest:[NSURLRequest requestWithURL:url]
+                                                                                   configuration:[NSURLSessionConfiguration ephemeralSessionConfiguration]
+                                                                                 channelCapacity:64 * 1024];
+    
+    OPStreamChannel *channel = [download channel];
+    OPBlockOperation *consumer = [[OPBlockOperation alloc] initWithBlock:^(void (^completion)(void)) {
+        // Leaves the download paused on a full channel.
+        [channel receiveData];
+        usleep(100 * 1000);
+        [channel stopReceiving];
+        completion();
+    }];
+    
+    [download addObserver:[[OPBlockObserver alloc] initWithFinishHandler:^(OPOperation *operation, NSArray *errors) {
+        [expectation fulfill];
+    }]];
+    
+    OPOperationQueue *operationQueue = [[OPOperationQueue alloc] init];
+    [operationQueue addOperations:@[download, consumer] waitUntilFinished:NO];
+    
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    [operationQueue waitUntilAllOperationsAreFinished];
+    [server stop];
+    
+    XCTAssertTrue([download isCancelled]);
+    XCTAssertNil([channel receiveData]);
+}
+
+@end
@@ -26,9 +26,17 @@ extern NSString *const kOPOperationErrorDomain;
 extern NSString *const kOPOperationConditionKey;
 extern NSString *const kOPOperationNegatedConditionKey;
 
+/**
+ *  The names of the operations on a dependency cycle, each of which must
+ *  finish before the next.
+ */
+extern NSString *const kOPOperationDependencyCycleKey;
+
 typedef NS_ENUM(NSUInteger, OPOperationErrorCode) {
     OPOperationErrorCodeConditionFailed = 1,
-    OPOperationErrorCodeExecutionFailed
+    OPOperationErrorCodeExecutionFailed,
+    OPOperationErrorCodeDependencyCycle,
+    OPOperationErrorCodeDuplicateOperation
 };
 
 
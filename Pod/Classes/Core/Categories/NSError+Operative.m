@@ -25,6 +25,7 @@
 NSString *const kOPOperationErrorDomain = @"OPOperationErrors";
 NSString *const kOPOperationConditionKey = @"OPOperationCondition";
 NSString *const kOPOperationNegatedConditionKey = @"OPOperationNegatedCondition";
+NSString *const kOPOperationDependencyCycleKey = @"OPOperationDependencyCycle";
 
 
 @implementation NSError (Operative)
@@ -0,0 +1,92 @@
+// OPConditionCache.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPOperationCondition.h"
+
+
+/**
+ *  Conditions whose result depends only on some external state (and not on the
+ *  operation being evaluated) may adopt this protocol to opt in to having
+ *  their results shared through the `OPConditionCache`.
+ */
+@protocol OPCacheableOperationCondition <OPOperationCondition>
+
+/**
+ *  Identifies the external state this condition checks, for example the host
+ *  of a reachability check. Combined with the condition's `name` to form the
+ *  cache key, so unrelated conditions may return the same value.
+ */
+- (NSString *)cacheKey;
+
+/**
+ *  How long a result may be reused for. A value of zero (or less) disables
+ *  caching, and the condition is evaluated as normal.
+ */
+- (NSTimeInterval)cacheTimeToLive;
+
+@end
+
+
+/**
+ *  `OPConditionCache` shares the results of `OPCacheableOperationCondition`
+ *  evaluations across operations for the condition's time to live.
+ *
+ *  Concurrent evaluations of the same key are coalesced: only the first
+ *  evaluates the underlying condition, and its result is delivered to every
+ *  evaluation waiting on it.
+ */
+@interface OPConditionCache : NSObject
+
++ (OPConditionCache *)sharedCache;
+
+/**
+ *  Number of evaluations answered from a cached result
+ */
+@property (assign, nonatomic, readonly) NSUInteger hitCount;
+
+/**
+ *  Number of evaluations which caused the underlying condition to be evaluated
+ */
+@property (assign, nonatomic, readonly) NSUInteger missCount;
+
+/**
+ *  Number of evaluations which attached to an evaluation already in flight
+ */
+@property (assign, nonatomic, readonly) NSUInteger coalescedCount;
+
+/**
+ *  Evaluates a condition through the cache.
+ *
+ *  @param condition  The condition to evaluate
+ *  @param operation  The `OPOperation` to which the condition has been added.
+ *                    Only used if the condition is actually evaluated.
+ *  @param completion Called with the (possibly shared) result
+ */
+- (void)evaluateCondition:(id <OPCacheableOperationCondition>)condition
+                operation:(OPOperation *)operation
+               completion:(void (^)(OPOperationConditionResultStatus result, NSError *error))completion;
+
+/**
+ *  Discards every cached result. Evaluations already in flight are unaffected.
+ */
+- (void)removeAllResults;
+
+@end
@@ -0,0 +1,217 @@
+// OPConditionCache.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPConditionCache.h"
+
+#import <pthread.h>
+#import <stdatomic.h>
+
+
+/**
+ *  Number of entries above which expired results are purged when a new
+ *  entry is created.
+ */
+static const NSUInteger kOPConditionCachePurgeThreshold = 1024;
+
+
+/**
+ *  A cached result, or an evaluation in flight along with everyone
+ *  waiting on it.
+ */
+@interface OPConditionCacheEntry : NSObject {
+    @package
+    OPOperationConditionResultStatus _status;
+    NSError *_error;
+    dispatch_time_t _expiry;
+    NSMutableArray *_waiters;
+}
+@end
+
+@implementation OPConditionCacheEntry
+@end
+
+
+@interface OPConditionCache () {
+    pthread_mutex_t _lock;
+    atomic_ulong _hitCount;
+    atomic_ulong _missCount;
+    atomic_ulong _coalescedCount;
+}
+
+@property (strong, nonatomic) NSMutableDictionary *entries;
+
+@end
+
+
+@implementation OPConditionCache
+
+
+#pragma mark - Statistics
+#pragma mark -
+
+- (NSUInteger)hitCount
+{
+    return atomic_load_explicit(&_hitCount, memory_order_relaxed);
+}
+
+- (NSUInteger)missCount
+{
+    return atomic_load_explicit(&_missCount, memory_order_relaxed);
+}
+
+- (NSUInteger)coalescedCount
+{
+    return atomic_load_explicit(&_coalescedCount, memory_order_relaxed);
+}
+
+
+#pragma mark - Evaluation
+#pragma mark -
+
+- (void)evaluateCondition:(id <OPCacheableOperationCondition>)condition
+                operation:(OPOperation *)operation
+               completion:(void (^)(OPOperationConditionResultStatus result, NSError *error))completion
+{
+    NSTimeInterval timeToLive = [condition cacheTimeToLive];
+    if (timeToLive <= 0) {
+        [condition evaluateConditionForOperation:operation completion:completion];
+        return;
+    }
+
+    NSString *key = [NSString stringWithFormat:@"%@|%@", [condition name], [condition cacheKey]];
+    dispatch_time_t now = dispatch_time(DISPATCH_TIME_NOW, 0);
+
+    pthread_mutex_lock(&_lock);
+
+    OPConditionCacheEntry *entry = self.entries[key];
+
+    if (entry && entry->_waiters) {
+        // Someone is already evaluating this key; wait for their result.
+        [entry->_waiters addObject:[completion copy]];
+        pthread_mutex_unlock(&_lock);
+
+        atomic_fetch_add_explicit(&_coalescedCount, 1, memory_order_relaxed);
+        return;
+    }
+
+    if (entry && now < entry->_expiry) {
+        OPOperationConditionResultStatus status = entry->_status;
+        NSError *error = entry->_error;
+        pthread_mutex_unlock(&_lock);
+
+        atomic_fetch_add_explicit(&_hitCount, 1, memory_order_relaxed);
+        completion(status, error);
+        return;
+    }
+
+    if (!entry && [self.entries count] >= kOPConditionCachePurgeThreshold) {
+        [self locked_purgeExpiredEntriesAtTime:now];
+    }
+
+    entry = [[OPConditionCacheEntry alloc] init];
+    entry->_waiters = [[NSMutableArray alloc] initWithObjects:[completion copy], nil];
+    self.entries[key] = entry;
+
+    pthread_mutex_unlock(&_lock);
+
+    atomic_fetch_add_explicit(&_missCount, 1, memory_order_relaxed);
+
+    [condition evaluateConditionForOperation:operation completion:^(OPOperationConditionResultStatus result, NSError *error) {
+        pthread_mutex_lock(&self->_lock);
+
+        NSArray *waiters = entry->_waiters;
+        entry->_waiters = nil;
+        entry->_status = result;
+        entry->_error = error;
+        entry->_expiry = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeToLive * NSEC_PER_SEC));
+
+        pthread_mutex_unlock(&self->_lock);
+
+        for (void (^waiter)(OPOperationConditionResultStatus, NSError *) in waiters) {
+            waiter(result, error);
+        }
+    }];
+}
+
+- (void)removeAllResults
+{
+    pthread_mutex_lock(&_lock);
+
+    NSMutableArray *cachedKeys = [[NSMutableArray alloc] init];
+    [self.entries enumerateKeysAndObjectsUsingBlock:^(NSString *key, OPConditionCacheEntry *entry, BOOL *stop) {
+        if (!entry->_waiters) {
+            [cachedKeys addObject:key];
+        }
+    }];
+    [self.entries removeObjectsForKeys:cachedKeys];
+
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)locked_purgeExpiredEntriesAtTime:(dispatch_time_t)now
+{
+    NSMutableArray *expiredKeys = [[NSMutableArray alloc] init];
+    [self.entries enumerateKeysAndObjectsUsingBlock:^(NSString *key, OPConditionCacheEntry *entry, BOOL *stop) {
+        if (!entry->_waiters && now >= entry->_expiry) {
+            [expiredKeys addObject:key];
+        }
+    }];
+    [self.entries removeObjectsForKeys:expiredKeys];
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
++ (OPConditionCache *)sharedCache
+{
+    static OPConditionCache *_sharedInstance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedInstance = [[OPConditionCache alloc] init];
+    });
+
+    return _sharedInstance;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    pthread_mutex_init(&_lock, NULL);
+    atomic_init(&_hitCount, 0);
+    atomic_init(&_missCount, 0);
+    atomic_init(&_coalescedCount, 0);
+
+    _entries = [[NSMutableDictionary alloc] init];
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+@end
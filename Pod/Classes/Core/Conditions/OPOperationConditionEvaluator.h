@@ -24,6 +24,14 @@
 
 @interface OPOperationConditionEvaluator : NSObject
 
+/**
+ *  Evaluates each of the given conditions for an operation, then calls
+ *  `completion` with the errors of any conditions that failed, in order.
+ *
+ *  When there are no conditions, or every condition completes synchronously,
+ *  `completion` is called inline before this method returns. Otherwise it is
+ *  called on the thread of whichever condition completes last.
+ */
 + (void)evaluateConditions:(NSArray *)conditions
                  operation:(OPOperation *)operation
                 completion:(void (^)(NSArray *failures))completion;
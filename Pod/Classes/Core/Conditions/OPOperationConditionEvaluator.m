@@ -21,7 +21,56 @@
 
 #import "OPOperationConditionEvaluator.h"
 #import "OPOperationCondition.h"
+#import "OPOperation+Private.h"
+#import "OPConditionCache.h"
 #import "NSError+Operative.h"
+#import "OPTrace+Private.h"
+
+#import <objc/runtime.h>
+#import <stdatomic.h>
+
+
+/**
+ *  Tracks a single evaluation of an operation's conditions. Each condition
+ *  writes its error (if any) into its own slot, and whichever completion
+ *  brings `_pending` to zero aggregates the results. When every condition
+ *  completes synchronously, that is the evaluating thread itself.
+ */
+@interface OPOperationConditionEvaluation : NSObject {
+    @package
+    atomic_long _pending;
+    NSUInteger _count;
+    __strong NSError **_errors;
+}
+@end
+
+@implementation OPOperationConditionEvaluation
+
+- (instancetype)initWithCount:(NSUInteger)count
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    // One extra reference is held by the evaluator until every condition
+    // has been asked, so the results can't be aggregated early.
+    atomic_init(&_pending, (long)count + 1);
+    _count = count;
+    _errors = (__strong NSError **)calloc(count, sizeof(NSError *));
+
+    return self;
+}
+
+- (void)dealloc
+{
+    for (NSUInteger idx = 0; idx < _count; idx++) {
+        _errors[idx] = nil;
+    }
+    free(_errors);
+}
+
+@end
 
 
 @implementation OPOperationConditionEvaluator
@@ -30,44 +79,74 @@
                  operation:(OPOperation *)operation
                 completion:(void (^)(NSArray *failures))completion;
 {
-    // Check conditions.
-    dispatch_group_t conditionGroup = dispatch_group_create();
-
-    NSMutableArray *results = [[NSMutableArray alloc] init];
-    [conditions enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
-        [results addObject:[NSNull null]];
-    }];
-
-    // Ask each condition to evaluate and store its result in the "results" array.
-    [conditions enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
-        id <OPOperationCondition>condition = obj;
-
-        dispatch_group_enter(conditionGroup);
-        [condition evaluateConditionForOperation:operation completion:^(OPOperationConditionResultStatus result, NSError *error) {
-            if (error) {
-                results[idx] = error;
-            }
-            dispatch_group_leave(conditionGroup);
-        }];
-    }];
-
-    // After all the conditions have evaluated, this block will execute
-    dispatch_group_notify(conditionGroup, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
-        // Aggregate the errors that occurred, in order.
-        NSMutableArray *failures = [[NSMutableArray alloc] init];
-        [results enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
-            if ([obj isKindOfClass:[NSError class]]) {
-                [failures addObject:obj];
+    NSUInteger count = [conditions count];
+
+    // Nothing to evaluate, so the operation can move straight on.
+    if (count == 0) {
+        completion([self failuresForEvaluation:nil operation:operation]);
+        return;
+    }
+
+    OPOperationConditionEvaluation *evaluation = [[OPOperationConditionEvaluation alloc] initWithCount:count];
+
+    // Ask each condition to evaluate and store its result in its own slot.
+    NSUInteger idx = 0;
+    for (id <OPOperationCondition>condition in conditions) {
+        NSUInteger slot = idx++;
+        OP_TRACE_SPAN_BEGIN(traceStart);
+        void (^conditionCompletion)(OPOperationConditionResultStatus, NSError *) = ^(OPOperationConditionResultStatus result, NSError *error) {
+            OP_TRACE_SPAN_END(traceStart, OPTraceEventTypeCondition, operation, object_getClassName(condition));
+            evaluation->_errors[slot] = error;
+            [self evaluation:evaluation didCompleteForOperation:operation completion:completion];
+        };
+
+        // Conditions which opted in share their results through the cache.
+        if ([condition conformsToProtocol:@protocol(OPCacheableOperationCondition)]) {
+            [[OPConditionCache sharedCache] evaluateCondition:(id <OPCacheableOperationCondition>)condition
+                                                    operation:operation
+                                                   completion:conditionCompletion];
+        } else {
+            [condition evaluateConditionForOperation:operation completion:conditionCompletion];
+        }
+    }
+
+    // Drop the evaluator's own reference. If every condition has already
+    // completed, this finishes the evaluation inline on this thread.
+    [self evaluation:evaluation didCompleteForOperation:operation completion:completion];
+}
+
++ (void)evaluation:(OPOperationConditionEvaluation *)evaluation
+    didCompleteForOperation:(OPOperation *)operation
+                 completion:(void (^)(NSArray *failures))completion
+{
+    if (atomic_fetch_sub_explicit(&evaluation->_pending, 1, memory_order_acq_rel) == 1) {
+        completion([self failuresForEvaluation:evaluation operation:operation]);
+    }
+}
+
++ (NSArray *)failuresForEvaluation:(OPOperationConditionEvaluation *)evaluation operation:(OPOperation *)operation
+{
+    // Aggregate the errors that occurred, in order.
+    NSMutableArray *failures = nil;
+    NSUInteger count = evaluation ? evaluation->_count : 0;
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        if (evaluation->_errors[idx]) {
+            if (!failures) {
+                failures = [[NSMutableArray alloc] init];
             }
-        }];
+            [failures addObject:evaluation->_errors[idx]];
+        }
+    }
 
-        // If any of the conditions caused this operation to be cancelled, check for that
-        if ([operation isCancelled]) {
-            [failures addObject:[NSError errorWithCode:OPOperationErrorCodeConditionFailed]];
+    // If any of the conditions caused this operation to be cancelled, check for that
+    if ([operation isCancelled]) {
+        if (!failures) {
+            failures = [[NSMutableArray alloc] init];
         }
+        [failures addObject:[NSError errorWithCode:OPOperationErrorCodeConditionFailed]];
+    }
 
-        completion(failures);
-    });
+    return failures ?: @[];
 }
 
 @end
@@ -19,7 +19,7 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
-#import "OPOperationCondition.h"
+#import "OPConditionCache.h"
 
 
 /**
@@ -27,11 +27,27 @@
  *  It does *not* perform a long-running reachability check, nor does it
  *  respond to changes in reachability. Reachability is evaluated once when
  *  the operation to which this is attached is asked about its readiness.
+ *
+ *  Requests go through `+[OPReachabilityController sharedController]`, which
+ *  usually answers from memory, and probes each host at most once at a time.
+ *
+ *  Results may be shared between operations checking the same host by
+ *  setting `cacheTimeToLive`.
  */
-@interface OPReachabilityCondition : NSObject <OPOperationCondition>
+@interface OPReachabilityCondition : NSObject <OPCacheableOperationCondition>
 
 - (instancetype)initWithHost:(NSURL *)host NS_DESIGNATED_INITIALIZER;
 
+/**
+ *  How long the result of checking this condition's host may be reused by
+ *  other reachability conditions for the same host.
+ *
+ *  Defaults to 0, which disables caching.
+ *
+ *  @see OPConditionCache
+ */
+@property (assign, nonatomic) NSTimeInterval cacheTimeToLive;
+
 /**
  *  Unused `-init` method.
  *  @see -initWithHost:
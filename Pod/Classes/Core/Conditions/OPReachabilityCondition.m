@@ -20,33 +20,14 @@
 // THE SOFTWARE.
 
 #import "OPReachabilityCondition.h"
+#import "OPReachabilityController.h"
 
 #import "NSError+Operative.h"
 
-#import <SystemConfiguration/SystemConfiguration.h>
-
 
 static NSString *const kOPOperationHostKey = @"OperationHost";
 
 
-@interface OPReachabilityController : NSObject
-
-+ (OPReachabilityController *)sharedInstance;
-
-#if OS_OBJECT_USE_OBJC
-@property (strong, nonatomic) dispatch_queue_t reachabilityQueue;
-#else
-@property (assign, nonatomic) dispatch_queue_t reachabilityQueue;
-#endif
-
-@property (strong, nonatomic) NSMutableDictionary *reachabilityRefs;
-
-- (void)requestReachabilityWithURL:(NSURL *)url
-                 completionHandler:(void (^)(BOOL reachable))completionHandler;
-
-@end
-
-
 @interface OPReachabilityCondition ()
 
 @property (copy, nonatomic) NSURL *host;
@@ -76,21 +57,26 @@ static NSString *const kOPOperationHostKey = @"OperationHost";
     return nil;
 }
 
+- (NSString *)cacheKey
+{
+    return [self.host host];
+}
+
 - (void)evaluateConditionForOperation:(OPOperation *)operation
                            completion:(void (^)(OPOperationConditionResultStatus, NSError *))completion
 {
-    [[OPReachabilityController sharedInstance] requestReachabilityWithURL:[self host]
-                                                        completionHandler:^(BOOL reachable) {
-                                                            if (reachable) {
-                                                                completion(OPOperationConditionResultStatusSatisfied, nil);
-                                                            } else {
-                                                                NSError *error = [NSError errorWithCode:OPOperationErrorCodeConditionFailed userInfo:@{
-                                                                    kOPOperationConditionKey : [self name],
-                                                                    kOPOperationHostKey : [self host]
-                                                                }];
-                                                                completion(OPOperationConditionResultStatusFailed, error);
-                                                            }
-                                                        }];
+    [[OPReachabilityController sharedController] requestReachabilityOfHost:[self.host host]
+                                                                 completion:^(BOOL reachable) {
+                                                                     if (reachable) {
+                                                                         completion(OPOperationConditionResultStatusSatisfied, nil);
+                                                                     } else {
+                                                                         NSError *error = [NSError errorWithCode:OPOperationErrorCodeConditionFailed userInfo:@{
+                                                                             kOPOperationConditionKey : [self name],
+                                                                             kOPOperationHostKey : [self host]
+                                                                         }];
+                                                                         completion(OPOperationConditionResultStatusFailed, error);
+                                                                     }
+                                                                 }];
 }
 
 
@@ -110,72 +96,3 @@ static NSString *const kOPOperationHostKey = @"OperationHost";
 }
 
 @end
-
-
-@implementation OPReachabilityController
-
-
-#pragma mark - Reachability
-#pragma mark -
-
-- (void)requestReachabilityWithURL:(NSURL *)url
-                 completionHandler:(void (^)(BOOL reachable))completionHandler
-{
-    NSString *host = [url host];
-    
-    if (!host) {
-        completionHandler(NO);
-        return;
-    }
-    
-    dispatch_async([self reachabilityQueue], ^{
-        SCNetworkReachabilityRef ref = (__bridge SCNetworkReachabilityRef)(self.reachabilityRefs[host]);
-        
-        if (!ref) {
-            ref = SCNetworkReachabilityCreateWithName(nil, [host UTF8String]);
-        }
-        
-        if (ref) {
-            self.reachabilityRefs[host] = (__bridge id)(ref);
-            
-            BOOL reachable = NO;
-            SCNetworkReachabilityFlags flags = 0;
-            if (SCNetworkReachabilityGetFlags(ref, &flags) != 0) {
-                reachable = ((flags & kSCNetworkReachabilityFlagsReachable) != 0);
-            }
-            completionHandler(reachable);
-        } else {
-            completionHandler(NO);
-        }
-    });
-}
-
-
-#pragma mark - Lifecycle
-#pragma mark -
-
-+ (OPReachabilityController *)sharedInstance
-{
-    static OPReachabilityController *_sharedInstance = nil;
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        _sharedInstance = [[OPReachabilityController alloc] init];
-    });
-    
-    return _sharedInstance;
-}
-
-- (instancetype)init
-{
-    self = [super init];
-    if (!self) {
-        return nil;
-    }
-    
-    _reachabilityQueue = dispatch_queue_create("Operative.Reachability", DISPATCH_QUEUE_SERIAL);
-    _reachabilityRefs = [[NSMutableDictionary alloc] init];
-    
-    return self;
-}
-
-@end
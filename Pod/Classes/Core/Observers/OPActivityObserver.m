@@ -0,0 +1,95 @@
+// OPActivityObserver.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPActivityObserver.h"
+#import "OPActivityGauge.h"
+
+#import <pthread.h>
+
+
+@implementation OPActivityObserver {
+    /**
+     *  Operations counted against the gauge. Operations which finish
+     *  without having started, such as when cancelled early or when their
+     *  conditions fail, were never counted. Guarded by `_lock`.
+     */
+    pthread_mutex_t _lock;
+    NSHashTable *_startedOperations;
+}
+
+#pragma mark - OPOperationObserver Protocol
+#pragma mark -
+
+- (void)operationDidStart:(OPOperation *)operation
+{
+    pthread_mutex_lock(&_lock);
+    [_startedOperations addObject:operation];
+    pthread_mutex_unlock(&_lock);
+
+    [self.gauge activityDidStart];
+}
+
+- (void)operation:(OPOperation *)operation didProduceOperation:(NSOperation *)newOperation {}
+
+- (void)operation:(OPOperation *)operation didFinishWithErrors:(NSArray *)errors
+{
+    pthread_mutex_lock(&_lock);
+    BOOL started = [_startedOperations containsObject:operation];
+    [_startedOperations removeObject:operation];
+    pthread_mutex_unlock(&_lock);
+
+    if (started) {
+        [self.gauge activityDidEnd];
+    }
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
+- (instancetype)initWithGauge:(OPActivityGauge *)gauge
+{
+    NSParameterAssert(gauge);
+
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _gauge = gauge;
+
+    pthread_mutex_init(&_lock, NULL);
+    _startedOperations = [[NSHashTable alloc] initWithOptions:(NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality) capacity:0];
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+- (instancetype)initWithGaugeNamed:(NSString *)name
+{
+    return [self initWithGauge:[OPActivityGauge gaugeNamed:name]];
+}
+
+@end
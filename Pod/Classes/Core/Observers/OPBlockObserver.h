@@ -25,6 +25,10 @@
 /**
  *  The `OPBlockObserver` is a way to attach arbitrary blocks to significant
  *  events in an `OPOperation`'s lifecycle.
+ *
+ *  Each handler is passed the operation concerned, so a single observer can
+ *  be attached to any number of operations. Sharing one observer avoids an
+ *  allocation per operation where many small operations are created.
  */
 @interface OPBlockObserver : NSObject <OPOperationObserver>
 
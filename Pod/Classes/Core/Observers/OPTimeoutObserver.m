@@ -21,21 +21,26 @@
 
 #import "OPTimeoutObserver.h"
 #import "OPOperation.h"
+#import "OPTimerWheel.h"
 #import "NSError+Operative.h"
 
 
 static NSString *const kOPTimeoutObserverErrorKey = @"OPTimeoutObserverError";
 
 
-@interface OPTimeoutObserver ()
+@interface OPTimeoutObserver () <OPTimerWheelTarget> {
+    /**
+     *  Armed on the shared timer wheel while the observed operation runs.
+     */
+    OPTimerWheelEntry _timeoutEntry;
+}
 
 @property (assign, nonatomic) NSTimeInterval timeout;
 
-#if OS_OBJECT_USE_OBJC
-@property (strong, nonatomic) dispatch_source_t timer;
-#else
-@property (assign, nonatomic) dispatch_source_t timer;
-#endif
+/**
+ *  The operation being timed, held until it finishes or times out.
+ */
+@property (strong, atomic) OPOperation *operation;
 
 @end
 
@@ -47,40 +52,9 @@ static NSString *const kOPTimeoutObserverErrorKey = @"OPTimeoutObserverError";
 
 - (void)operationDidStart:(OPOperation *)operation
 {
-    // set up timeout handler
-    void(^timeoutHandler)() = ^{
-        /**
-         *  Cancel the operation if it hasn't finished and hasn't already
-         *  been cancelled.
-         */
-        if (![operation isFinished] && ![operation isCancelled]) {
-            NSDictionary *userInfo = @{ kOPTimeoutObserverErrorKey : @(([self timeout])) };
-            NSError *error = [NSError errorWithCode:OPOperationErrorCodeExecutionFailed userInfo:userInfo];
-            [operation cancelWithError:error];
-        }
-    };
-    
-    // When the operation starts, queue up a block to cause it to time out.
-    self.timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0));
-    
-    // Cancel operation immediately if timer wasn't created
-    if(!self.timer) {
-        timeoutHandler();
-        return;
-    }
-    
-    // calculate time delta
-    int64_t delta = (int64_t)(self.timeout * NSEC_PER_SEC);
-    
-    // calculate the leeway for timer using the same way as dispatch_after
-    int64_t leeway = delta / 10;
-    if(leeway < NSEC_PER_MSEC) leeway = NSEC_PER_MSEC;
-    if(leeway > 60 * NSEC_PER_SEC) leeway = 60 * NSEC_PER_SEC;
-    
-    dispatch_time_t when = dispatch_walltime(NULL, delta);
-    dispatch_source_set_event_handler(self.timer, timeoutHandler);
-    dispatch_source_set_timer(self.timer, when, DISPATCH_TIME_FOREVER, leeway);
-    dispatch_resume(self.timer);
+    // When the operation starts, arm a timer to cause it to time out.
+    self.operation = operation;
+    [[OPTimerWheel sharedTimerWheel] armEntry:&_timeoutEntry timeout:self.timeout target:self];
 }
 
 - (void)operation:(OPOperation *)operation didProduceOperation:(NSOperation *)newOperation
@@ -90,18 +64,29 @@ static NSString *const kOPTimeoutObserverErrorKey = @"OPTimeoutObserverError";
 
 - (void)operation:(OPOperation *)operation didFinishWithErrors:(NSArray *)errors
 {
-    if(!self.timer) {
-        return;
+    // Disarming needs no allocation, however many operations are timed.
+    [[OPTimerWheel sharedTimerWheel] cancelEntry:&_timeoutEntry];
+    self.operation = nil;
+}
+
+
+#pragma mark - OPTimerWheelTarget
+#pragma mark -
+
+- (void)timerWheelEntryDidExpire:(OPTimerWheelEntry *)entry
+{
+    OPOperation *operation = self.operation;
+    self.operation = nil;
+
+    /**
+     *  Cancel the operation if it hasn't finished and hasn't already
+     *  been cancelled.
+     */
+    if (operation && ![operation isFinished] && ![operation isCancelled]) {
+        NSDictionary *userInfo = @{ kOPTimeoutObserverErrorKey : @(([self timeout])) };
+        NSError *error = [NSError errorWithCode:OPOperationErrorCodeExecutionFailed userInfo:userInfo];
+        [operation cancelWithError:error];
     }
-    
-    // Cancel and release the timer
-    dispatch_source_cancel(self.timer);
-    
-#if !OS_OBJECT_USE_OBJC
-    dispatch_release(self.timer);
-#endif
-    
-    self.timer = nil;
 }
 
 
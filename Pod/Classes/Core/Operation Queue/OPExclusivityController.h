@@ -28,6 +28,12 @@
  *  `OPOperation` instances that have declared themselves as requiring mutual exclusivity.
  *  We use a singleton because mutual exclusivity must be enforced across the entire
  *  app, regardless of the `OPOperationQueue` on which an `OPOperation` was executed.
+ *
+ *  Categories are spread across a fixed number of independently locked shards,
+ *  and each category keeps its operations in an intrusive FIFO list, so adding
+ *  and removing an operation is constant time and unrelated categories never
+ *  contend with each other. Categories are evicted once their last operation
+ *  has been removed.
  */
 @interface OPExclusivityController : NSObject
 
@@ -41,6 +47,18 @@
  */
 - (void)addOperation:(OPOperation *)operation categories:(NSArray *)categories;
 
+/**
+ *  Registers a batch of operations as being mutually exclusive. Every shard
+ *  touched by the batch is locked once, and operations are linked in the
+ *  order given.
+ *
+ *  @param operations Array of `OPOperation` objects which require exclusivity
+ *  @param categories Array of the same length as `operations`, where each
+ *                    element is the array of category names for the
+ *                    operation at the same index
+ */
+- (void)addOperations:(NSArray *)operations categories:(NSArray *)categories;
+
 /**
  *  Unregisters an operation from being mutually exclusive.
  *
@@ -49,4 +67,11 @@
  */
 - (void)removeOperation:(OPOperation *)operation categories:(NSArray *)categories;
 
+/**
+ *  Unregisters an operation from every category it was added to.
+ *
+ *  @param operation  OPOperation object which required exclusivity
+ */
+- (void)removeOperation:(OPOperation *)operation;
+
 @end
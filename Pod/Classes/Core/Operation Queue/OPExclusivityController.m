@@ -20,16 +20,93 @@
 // THE SOFTWARE.
 
 #import "OPExclusivityController.h"
+#import "OPOperation+Private.h"
 
-@interface OPExclusivityController()
+#import <pthread.h>
+
+
+/**
+ *  Number of independently locked shards categories are spread across.
+ *  Must be a power of two.
+ */
+static const NSUInteger kOPExclusivityShardCount = 16;
+
+
+@class OPExclusivityCategory;
+
+/**
+ *  A single entry in a category's FIFO list. Each node links one operation
+ *  into one category; an operation in several categories owns a chain of
+ *  nodes threaded through `_sibling`.
+ */
+@interface OPExclusivityNode : NSObject {
+    @package
+    OPOperation *_operation;
+    OPExclusivityCategory *_category;
+    OPExclusivityNode *_next;
+    __unsafe_unretained OPExclusivityNode *_previous;
+    OPExclusivityNode *_sibling;
+}
+@end
+
+@implementation OPExclusivityNode
+@end
+
+
+/**
+ *  The in-flight operations for a single category of exclusivity, kept as an
+ *  intrusive doubly linked list so both ends and arbitrary nodes can be
+ *  modified in constant time.
+ */
+@interface OPExclusivityCategory : NSObject {
+    @package
+    NSString *_name;
+    NSUInteger _shardIndex;
+    OPExclusivityNode *_head;
+    __unsafe_unretained OPExclusivityNode *_tail;
+}
+@end
+
+@implementation OPExclusivityCategory
+@end
+
+
+/**
+ *  A lock and the categories that hash to it.
+ */
+@interface OPExclusivityShard : NSObject {
+    @package
+    pthread_mutex_t _lock;
+    NSMutableDictionary *_categories;
+}
+@end
 
-@property (strong, nonatomic) NSMutableDictionary *operations;
+@implementation OPExclusivityShard
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    pthread_mutex_init(&_lock, NULL);
+    _categories = [[NSMutableDictionary alloc] init];
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+@end
+
+
+@interface OPExclusivityController()
 
-#if OS_OBJECT_USE_OBJC
-@property (strong, nonatomic) dispatch_queue_t serialQueue;
-#else
-@property (assign, nonatomic) dispatch_queue_t serialQueue;
-#endif
+@property (strong, nonatomic) NSArray *shards;
 
 @end
 
@@ -41,56 +118,158 @@
 
 - (void)addOperation:(OPOperation *)operation categories:(NSArray *)categories
 {
-    dispatch_sync([self serialQueue], ^{
-        for (NSString *category in categories) {
-            [self noqueue_addOperation:operation category:category];
+    [self addOperations:@[operation] categories:@[categories]];
+}
+
+- (void)addOperations:(NSArray *)operations categories:(NSArray *)categories
+{
+    NSAssert([operations count] == [categories count], @"Each operation must have its own array of categories.");
+
+    /**
+     *  All shards touched by the batch are held together, and always
+     *  acquired in ascending order. Otherwise two operations sharing more
+     *  than one category could be linked in opposite orders in different
+     *  categories and end up depending on each other.
+     */
+    BOOL locked[kOPExclusivityShardCount] = { NO };
+    for (NSArray *operationCategories in categories) {
+        for (NSString *category in operationCategories) {
+            locked[[self shardIndexForCategory:category]] = YES;
         }
-    });
+    }
+
+    for (NSUInteger idx = 0; idx < kOPExclusivityShardCount; idx++) {
+        if (locked[idx]) {
+            OPExclusivityShard *shard = self.shards[idx];
+            pthread_mutex_lock(&shard->_lock);
+        }
+    }
+
+    [operations enumerateObjectsUsingBlock:^(OPOperation *operation, NSUInteger idx, BOOL *stop) {
+        for (NSString *category in categories[idx]) {
+            [self locked_addOperation:operation category:category];
+        }
+    }];
+
+    for (NSUInteger idx = kOPExclusivityShardCount; idx > 0; idx--) {
+        if (locked[idx - 1]) {
+            OPExclusivityShard *shard = self.shards[idx - 1];
+            pthread_mutex_unlock(&shard->_lock);
+        }
+    }
 }
 
 
 - (void)removeOperation:(OPOperation *)operation categories:(NSArray *)categories
 {
-    dispatch_sync([self serialQueue], ^{
-        for (NSString *category in categories) {
-            [self noqueue_removeOperation:operation category:category];
+    OPExclusivityNode *node = [operation exclusivityNode];
+    OPExclusivityNode *remaining = nil;
+
+    while (node) {
+        OPExclusivityNode *sibling = node->_sibling;
+        node->_sibling = nil;
+
+        if ([categories containsObject:node->_category->_name]) {
+            OPExclusivityShard *shard = self.shards[node->_category->_shardIndex];
+            pthread_mutex_lock(&shard->_lock);
+            [self locked_removeNode:node];
+            pthread_mutex_unlock(&shard->_lock);
+        } else {
+            node->_sibling = remaining;
+            remaining = node;
         }
-    });
+
+        node = sibling;
+    }
+
+    [operation setExclusivityNode:remaining];
+}
+
+- (void)removeOperation:(OPOperation *)operation
+{
+    OPExclusivityNode *node = [operation exclusivityNode];
+    [operation setExclusivityNode:nil];
+
+    while (node) {
+        OPExclusivityNode *sibling = node->_sibling;
+        node->_sibling = nil;
+
+        OPExclusivityShard *shard = self.shards[node->_category->_shardIndex];
+        pthread_mutex_lock(&shard->_lock);
+        [self locked_removeNode:node];
+        pthread_mutex_unlock(&shard->_lock);
+
+        node = sibling;
+    }
 }
 
 
 #pragma mark - Operation Management
 #pragma mark -
 
-- (void)noqueue_addOperation:(OPOperation *)operation category:(NSString *)category
+- (NSUInteger)shardIndexForCategory:(NSString *)category
 {
-    NSArray *operationsWithThisCategory = self.operations[category] ?: @[];
+    return [category hash] & (kOPExclusivityShardCount - 1);
+}
 
-    if ([operationsWithThisCategory count]) {
-        OPOperation *op = [operationsWithThisCategory lastObject];
-        [operation addDependency:op];
+- (void)locked_addOperation:(OPOperation *)operation category:(NSString *)category
+{
+    OPExclusivityShard *shard = self.shards[[self shardIndexForCategory:category]];
+    OPExclusivityCategory *record = shard->_categories[category];
+
+    if (!record) {
+        record = [[OPExclusivityCategory alloc] init];
+        record->_name = [category copy];
+        record->_shardIndex = [self shardIndexForCategory:category];
+        shard->_categories[record->_name] = record;
+    }
+
+    if (record->_tail) {
+        [operation addDependency:record->_tail->_operation];
     }
 
-    operationsWithThisCategory = [operationsWithThisCategory arrayByAddingObject:operation];
+    OPExclusivityNode *node = [[OPExclusivityNode alloc] init];
+    node->_operation = operation;
+    node->_category = record;
+    node->_previous = record->_tail;
+
+    if (record->_tail) {
+        record->_tail->_next = node;
+    } else {
+        record->_head = node;
+    }
+    record->_tail = node;
 
-    self.operations[category] = operationsWithThisCategory;
+    node->_sibling = [operation exclusivityNode];
+    [operation setExclusivityNode:node];
 }
 
-- (void)noqueue_removeOperation:(OPOperation *)operation category:(NSString *)category
+- (void)locked_removeNode:(OPExclusivityNode *)node
 {
-    if (!self.operations[category]) {
-        return;
+    OPExclusivityCategory *record = node->_category;
+
+    if (node->_previous) {
+        node->_previous->_next = node->_next;
+    } else {
+        record->_head = node->_next;
     }
 
-    NSArray *operationsWithThisCategory = self.operations[category];
+    if (node->_next) {
+        node->_next->_previous = node->_previous;
+    } else {
+        record->_tail = node->_previous;
+    }
 
-    NSUInteger index = [operationsWithThisCategory indexOfObject:operation];
-    if (index != NSNotFound) {
-        NSMutableArray *mutableArray = [operationsWithThisCategory mutableCopy];
-        [mutableArray removeObjectAtIndex:index];
-        operationsWithThisCategory = [NSArray arrayWithArray:mutableArray];
-        self.operations[category] = operationsWithThisCategory;
+    // Evict categories which no longer have any operations in flight.
+    if (!record->_head) {
+        OPExclusivityShard *shard = self.shards[record->_shardIndex];
+        [shard->_categories removeObjectForKey:record->_name];
     }
+
+    node->_next = nil;
+    node->_previous = nil;
+    node->_operation = nil;
+    node->_category = nil;
 }
 
 
@@ -115,8 +294,11 @@
         return nil;
     }
 
-    _serialQueue = dispatch_queue_create("Operative.ExclusivityController", DISPATCH_QUEUE_SERIAL);
-    _operations = [[NSMutableDictionary alloc] init];
+    NSMutableArray *shards = [[NSMutableArray alloc] initWithCapacity:kOPExclusivityShardCount];
+    for (NSUInteger idx = 0; idx < kOPExclusivityShardCount; idx++) {
+        [shards addObject:[[OPExclusivityShard alloc] init]];
+    }
+    _shards = [shards copy];
 
     return self;
 }
@@ -0,0 +1,97 @@
+// OPOperationGraph.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+@class OPOperation;
+
+
+/**
+ *  `OPOperationGraph` describes a graph of operations and the dependencies
+ *  between them using integer indices, so that large graphs can be built and
+ *  submitted to an `OPOperationQueue` far more cheaply than with
+ *  `-addDependency:` and `-addOperation:`.
+ *
+ *  Edges are appended to flat arrays as they are added. `-validate:` checks
+ *  the graph and sorts it topologically once, building a compact successor
+ *  list for each node. Once submitted with
+ *  `-[OPOperationQueue addOperationGraph:error:]`, each operation waits for
+ *  a count of its unfinished predecessors, and as each enters the Finished
+ *  state the graph releases its successors from those lists; no dependency
+ *  objects, KVO or per-edge bookkeeping are created on the operations
+ *  themselves.
+ *
+ *  Because of that, edges in a graph don't appear in an operation's
+ *  `dependencies`, and aren't considered by `-dependencyResultOfClass:`,
+ *  conditions such as `OPNoCancelledDependenciesCondition`, or the cycle
+ *  checks made by `-addDependency:`. As with ordinary dependencies, an
+ *  operation runs once its predecessors finish, whether or not they failed
+ *  or were cancelled.
+ *
+ *  A graph is built on one thread, and submitted once.
+ */
+@interface OPOperationGraph : NSObject
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity NS_DESIGNATED_INITIALIZER;
+
+@property (assign, nonatomic, readonly) NSUInteger operationCount;
+@property (assign, nonatomic, readonly) NSUInteger dependencyCount;
+
+/**
+ *  Adds a node to the graph.
+ *
+ *  @param operation An operation which hasn't been added to a queue or to
+ *                   another graph
+ *
+ *  @return The index of the new node, which is the number of nodes added
+ *  before it
+ */
+- (NSUInteger)addOperation:(OPOperation *)operation;
+
+/**
+ *  Makes the operation at index `dependent` wait for the operation at index
+ *  `dependency` to finish.
+ */
+- (void)addDependencyFromIndex:(NSUInteger)dependent toIndex:(NSUInteger)dependency;
+
+- (OPOperation *)operationAtIndex:(NSUInteger)index;
+
+/**
+ *  Checks each operation was added once and the graph has no cycles, and
+ *  orders it topologically. Once validated, no more nodes or edges may be
+ *  added. Validating again returns the earlier outcome.
+ *
+ *  @param error Set to an error with the `OPOperationErrorCodeDuplicateOperation`
+ *               code if an operation was added more than once, or with the
+ *               `OPOperationErrorCodeDependencyCycle` code, naming the
+ *               operations on a cycle, if there is one
+ *
+ *  @return `YES` if the graph can be submitted
+ */
+- (BOOL)validate:(NSError **)error;
+
+/**
+ *  The graph's operations ordered so that each comes after all those it
+ *  depends on, or `nil` if the graph hasn't been validated or failed to.
+ */
+@property (strong, nonatomic, readonly) NSArray *operationsInTopologicalOrder;
+
+@end
@@ -0,0 +1,410 @@
+// OPOperationGraph.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPOperationGraph.h"
+#import "OPOperationGraph+Private.h"
+#import "OPOperation.h"
+#import "OPOperation+Private.h"
+#import "NSError+Operative.h"
+
+#import <stdatomic.h>
+#import <stdlib.h>
+#import <string.h>
+
+
+/**
+ *  An entry in the table mapping each operation back to its node index.
+ */
+typedef struct {
+    const void *operation;
+    uint32_t index;
+} OPOperationGraphSlot;
+
+static inline NSUInteger OPOperationGraphHash(const void *pointer)
+{
+    uint64_t value = (uint64_t)(uintptr_t)pointer;
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return (NSUInteger)value;
+}
+
+
+@interface OPOperationGraph () <OPOperationDependent>
+
+@property (strong, nonatomic, readwrite) NSArray *operationsInTopologicalOrder;
+
+@end
+
+@implementation OPOperationGraph {
+    NSMutableArray *_operations;
+
+    /**
+     *  Each edge as a pair of node indices, in the order added. Freed once
+     *  the successor lists have been built.
+     */
+    uint32_t *_edgeDependencies;
+    uint32_t *_edgeDependents;
+    NSUInteger _edgeCapacity;
+
+    /**
+     *  Built by `-validate:`. The successors of node `i` are the entries of
+     *  `_successors` from `_successorOffsets[i]` up to, but not including,
+     *  `_successorOffsets[i + 1]`. `_predecessorCounts[i]` is the number of
+     *  edges into node `i`.
+     */
+    uint32_t *_successorOffsets;
+    uint32_t *_successors;
+    uint32_t *_predecessorCounts;
+
+    /**
+     *  Open addressed table from operation to node index, with a power of
+     *  two number of slots. Read only once built.
+     */
+    OPOperationGraphSlot *_slots;
+    NSUInteger _slotMask;
+
+    BOOL _validated;
+    NSError *_validationError;
+    atomic_flag _submitted;
+}
+
+
+#pragma mark - Building
+#pragma mark -
+
+- (NSUInteger)operationCount
+{
+    return [_operations count];
+}
+
+- (NSUInteger)addOperation:(OPOperation *)operation
+{
+    NSParameterAssert(operation);
+    NSAssert(!_validated, @"Operations cannot be added to a graph once it has been validated.");
+    NSAssert([_operations count] < UINT32_MAX, @"Graphs are limited to %u operations.", UINT32_MAX);
+
+    [_operations addObject:operation];
+
+    return [_operations count] - 1;
+}
+
+- (void)addDependencyFromIndex:(NSUInteger)dependent toIndex:(NSUInteger)dependency
+{
+    NSAssert(!_validated, @"Dependencies cannot be added to a graph once it has been validated.");
+    NSParameterAssert(dependent < [_operations count]);
+    NSParameterAssert(dependency < [_operations count]);
+
+    if (_dependencyCount == _edgeCapacity) {
+        _edgeCapacity = MAX(_edgeCapacity * 2, (NSUInteger)64);
+        _edgeDependencies = realloc(_edgeDependencies, _edgeCapacity * sizeof(uint32_t));
+        _edgeDependents = realloc(_edgeDependents, _edgeCapacity * sizeof(uint32_t));
+    }
+
+    _edgeDependencies[_dependencyCount] = (uint32_t)dependency;
+    _edgeDependents[_dependencyCount] = (uint32_t)dependent;
+    _dependencyCount++;
+}
+
+- (OPOperation *)operationAtIndex:(NSUInteger)index
+{
+    return _operations[index];
+}
+
+
+#pragma mark - Validation
+#pragma mark -
+
+- (BOOL)validate:(NSError **)error
+{
+    if (!_validated) {
+        _validated = YES;
+        [self graph_buildSuccessors];
+
+        NSUInteger duplicate = [self graph_buildSlots];
+        if (duplicate != NSNotFound) {
+            _validationError = [self graph_duplicateErrorForNode:duplicate];
+        } else {
+            [self graph_sort];
+        }
+    }
+
+    if (_validationError && error) {
+        *error = _validationError;
+    }
+
+    return _validationError == nil;
+}
+
+/**
+ *  Counting sorts the edges by dependency into per-node successor lists.
+ */
+- (void)graph_buildSuccessors
+{
+    NSUInteger count = [_operations count];
+
+    _successorOffsets = calloc(count + 1, sizeof(uint32_t));
+    _successors = malloc(MAX(_dependencyCount, (NSUInteger)1) * sizeof(uint32_t));
+    _predecessorCounts = calloc(MAX(count, (NSUInteger)1), sizeof(uint32_t));
+
+    for (NSUInteger edge = 0; edge < _dependencyCount; edge++) {
+        _successorOffsets[_edgeDependencies[edge] + 1]++;
+        _predecessorCounts[_edgeDependents[edge]]++;
+    }
+    for (NSUInteger node = 0; node < count; node++) {
+        _successorOffsets[node + 1] += _successorOffsets[node];
+    }
+
+    uint32_t *cursors = malloc(MAX(count, (NSUInteger)1) * sizeof(uint32_t));
+    memcpy(cursors, _successorOffsets, count * sizeof(uint32_t));
+    for (NSUInteger edge = 0; edge < _dependencyCount; edge++) {
+        _successors[cursors[_edgeDependencies[edge]]++] = _edgeDependents[edge];
+    }
+    free(cursors);
+
+    free(_edgeDependencies);
+    free(_edgeDependents);
+    _edgeDependencies = NULL;
+    _edgeDependents = NULL;
+    _edgeCapacity = 0;
+}
+
+/**
+ *  Orders the graph with Kahn's algorithm, recording a cycle if not every
+ *  node can be ordered.
+ */
+- (void)graph_sort
+{
+    NSUInteger count = [_operations count];
+    uint32_t *remaining = malloc(MAX(count, (NSUInteger)1) * sizeof(uint32_t));
+    uint32_t *order = malloc(MAX(count, (NSUInteger)1) * sizeof(uint32_t));
+    memcpy(remaining, _predecessorCounts, count * sizeof(uint32_t));
+
+    NSUInteger head = 0;
+    NSUInteger tail = 0;
+    for (NSUInteger node = 0; node < count; node++) {
+        if (remaining[node] == 0) {
+            order[tail++] = (uint32_t)node;
+        }
+    }
+
+    while (head < tail) {
+        uint32_t node = order[head++];
+        for (uint32_t idx = _successorOffsets[node]; idx < _successorOffsets[node + 1]; idx++) {
+            uint32_t successor = _successors[idx];
+            if (--remaining[successor] == 0) {
+                order[tail++] = successor;
+            }
+        }
+    }
+
+    if (tail < count) {
+        _validationError = [OPOperation dependencyCycleErrorWithOperations:[self graph_cycleWithRemainingCounts:remaining]];
+    } else {
+        NSMutableArray *operations = [[NSMutableArray alloc] initWithCapacity:count];
+        for (NSUInteger idx = 0; idx < count; idx++) {
+            [operations addObject:_operations[order[idx]]];
+        }
+        self.operationsInTopologicalOrder = operations;
+    }
+
+    free(remaining);
+    free(order);
+}
+
+/**
+ *  Every node Kahn's algorithm couldn't order still has an unordered
+ *  predecessor, so following those predecessors back from any of them must
+ *  eventually revisit a node, closing a cycle.
+ *
+ *  @return The operations on the cycle, each of which must finish before
+ *  the next
+ */
+- (NSArray *)graph_cycleWithRemainingCounts:(const uint32_t *)remaining
+{
+    NSUInteger count = [_operations count];
+    uint32_t *predecessors = malloc(count * sizeof(uint32_t));
+    uint32_t *visits = malloc(count * sizeof(uint32_t));
+    uint32_t start = 0;
+
+    for (NSUInteger node = 0; node < count; node++) {
+        visits[node] = UINT32_MAX;
+        if (remaining[node] == 0) {
+            continue;
+        }
+        start = (uint32_t)node;
+        for (uint32_t idx = _successorOffsets[node]; idx < _successorOffsets[node + 1]; idx++) {
+            if (remaining[_successors[idx]] > 0) {
+                predecessors[_successors[idx]] = (uint32_t)node;
+            }
+        }
+    }
+
+    NSMutableArray *path = [[NSMutableArray alloc] init];
+    uint32_t node = start;
+    while (visits[node] == UINT32_MAX) {
+        visits[node] = (uint32_t)[path count];
+        [path addObject:_operations[node]];
+        node = predecessors[node];
+    }
+
+    NSArray *cycle = [path subarrayWithRange:NSMakeRange(visits[node], [path count] - visits[node])];
+
+    free(predecessors);
+    free(visits);
+
+    return [[cycle reverseObjectEnumerator] allObjects];
+}
+
+/**
+ *  Builds the table mapping each operation back to its node index.
+ *
+ *  @return The index of the first node whose operation was already added,
+ *  or `NSNotFound`
+ */
+- (NSUInteger)graph_buildSlots
+{
+    NSUInteger count = [_operations count];
+    NSUInteger slotCount = 1;
+    while (slotCount < count * 2) {
+        slotCount <<= 1;
+    }
+
+    _slots = calloc(slotCount, sizeof(OPOperationGraphSlot));
+    _slotMask = slotCount - 1;
+
+    for (NSUInteger node = 0; node < count; node++) {
+        const void *operation = (__bridge const void *)_operations[node];
+        NSUInteger slot = OPOperationGraphHash(operation) & _slotMask;
+        while (_slots[slot].operation) {
+            if (_slots[slot].operation == operation) {
+                return node;
+            }
+            slot = (slot + 1) & _slotMask;
+        }
+        _slots[slot].operation = operation;
+        _slots[slot].index = (uint32_t)node;
+    }
+
+    return NSNotFound;
+}
+
+- (NSError *)graph_duplicateErrorForNode:(NSUInteger)node
+{
+    OPOperation *operation = _operations[node];
+    NSString *name = [operation name] ?: [NSString stringWithFormat:@"<%@: %p>", NSStringFromClass([operation class]), operation];
+    NSString *description = [NSString stringWithFormat:@"%@ was added to the graph more than once, again as node %lu", name, (unsigned long)node];
+
+    return [NSError errorWithCode:OPOperationErrorCodeDuplicateOperation userInfo:@{
+        NSLocalizedDescriptionKey : description
+    }];
+}
+
+- (uint32_t)graph_indexOfOperation:(OPOperation *)operation
+{
+    const void *pointer = (__bridge const void *)operation;
+    NSUInteger slot = OPOperationGraphHash(pointer) & _slotMask;
+    while (_slots[slot].operation != pointer) {
+        slot = (slot + 1) & _slotMask;
+    }
+    return _slots[slot].index;
+}
+
+
+#pragma mark - Submission
+#pragma mark -
+
+- (NSArray *)beginSubmission
+{
+    NSAssert(_validated && !_validationError, @"Only a validated graph without cycles can be submitted.");
+    BOOL submitted = atomic_flag_test_and_set(&_submitted);
+    NSAssert(!submitted, @"A graph can only be submitted once.");
+    (void)submitted;
+
+    NSUInteger count = [_operations count];
+    for (NSUInteger node = 0; node < count; node++) {
+        OPOperation *operation = _operations[node];
+        if (_predecessorCounts[node] > 0) {
+            [operation addUntrackedDependencyCount:_predecessorCounts[node]];
+        }
+    }
+
+    // Successors are only released once their predecessors have entered
+    // the Finished state, as with ordinary dependencies.
+    for (NSUInteger node = 0; node < count; node++) {
+        if (_successorOffsets[node] == _successorOffsets[node + 1]) {
+            continue;
+        }
+
+        OPOperation *operation = _operations[node];
+        if (![operation addDependent:self]) {
+            [self dependencyDidFinish:operation];
+        }
+    }
+
+    return [self operationsInTopologicalOrder];
+}
+
+
+#pragma mark - OPOperationDependent
+#pragma mark -
+
+- (void)dependencyDidFinish:(OPOperation *)operation
+{
+    uint32_t node = [self graph_indexOfOperation:operation];
+    for (uint32_t idx = _successorOffsets[node]; idx < _successorOffsets[node + 1]; idx++) {
+        [_operations[_successors[idx]] dependencyDidFinish];
+    }
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
+- (instancetype)init
+{
+    return [self initWithCapacity:0];
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _operations = [[NSMutableArray alloc] initWithCapacity:capacity];
+    atomic_flag_clear(&_submitted);
+
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_edgeDependencies);
+    free(_edgeDependents);
+    free(_successorOffsets);
+    free(_successors);
+    free(_predecessorCounts);
+    free(_slots);
+}
+
+@end
@@ -23,6 +23,9 @@
 
 
 @class OPOperationQueue;
+@class OPWorkStealingExecutor;
+@class OPPriorityPolicy;
+@class OPOperationGraph;
 
 
 /**
@@ -42,6 +45,13 @@
 
 - (void)operationQueue:(OPOperationQueue *)operationQueue willAddOperation:(NSOperation *)operation;
 
+/**
+ *  Invoked once for each batch of operations about to be added to the queue,
+ *  including any dependencies generated by their conditions. If implemented,
+ *  this is called instead of `-operationQueue:willAddOperation:`.
+ */
+- (void)operationQueue:(OPOperationQueue *)operationQueue willAddOperations:(NSArray *)operations;
+
 - (void)operationQueue:(OPOperationQueue *)operationQueue operationDidFinish:(NSOperation *)operation withErrors:(NSArray *)errors;
 
 @end
@@ -54,13 +64,184 @@
  *  - Notifying a delegate of all operation completion
  *  - Extracting generated dependencies from operation conditions
  *  - Setting up dependencies to enforce mutual exclusivity
+ *  - Attaching operations to an in-flight operation with the same
+ *    `deduplicationKey`, rather than running them again
  */
 @interface OPOperationQueue : NSOperationQueue
 
 @property (weak, nonatomic) id <OPOperationQueueDelegate>delegate;
 
+/**
+ *  The executor used to run this queue's operations. When `nil` (the default
+ *  unless `+setDefaultExecutor:` has been used), operations are run by
+ *  `NSOperationQueue` itself.
+ *
+ *  When set, the queue tracks readiness of its operations itself and hands
+ *  each to the executor once it is ready. Conditions, observers, dependencies,
+ *  exclusivity, suspension, cancellation and `maxConcurrentOperationCount`
+ *  behave as they do otherwise.
+ *
+ *  Must be set before any operations are added to the queue.
+ *
+ *  @see OPWorkStealingExecutor
+ */
+@property (strong, nonatomic) OPWorkStealingExecutor *executor;
+
+/**
+ *  Sets the executor assigned to queues when they are created, allowing the
+ *  executor backend to be switched on for a whole process at once.
+ *
+ *  @param executor Executor for new queues, or `nil` to use `NSOperationQueue`
+ */
++ (void)setDefaultExecutor:(OPWorkStealingExecutor *)executor;
+
++ (OPWorkStealingExecutor *)defaultExecutor;
+
+/**
+ *  Enables priority scheduling for a queue with an `executor`. Ready
+ *  operations wait in one lane per `queuePriority`, and start highest
+ *  effective priority first, where waiting raises an operation's effective
+ *  priority as described by the policy.
+ *
+ *  Unless `maxConcurrentOperationCount` is set, the queue then runs at most
+ *  one operation per executor worker, so that ready operations wait in the
+ *  queue's lanes rather than in the executor.
+ *
+ *  When `nil` (the default), ready operations start in the order they
+ *  became ready. Must be set before any operations are added to the queue.
+ */
+@property (copy, nonatomic) OPPriorityPolicy *priorityPolicy;
+
+/**
+ *  Wait time statistics for each priority lane, lowest priority first, as
+ *  `OPPriorityLaneStatistics`. Only recorded while `priorityPolicy` is set.
+ */
+- (NSArray *)priorityLaneStatistics;
+
+- (void)resetPriorityLaneStatistics;
+
+
+///---------------
+/// @name Capacity
+///---------------
+
+/**
+ *  The maximum total cost of operations waiting in the queue. An operation
+ *  counts against the capacity from when it is added until it starts
+ *  executing, or finishes without executing. Plain `NSOperation`s count
+ *  until they finish.
+ *
+ *  While the queue is full, operations produced by operations in the queue
+ *  are deferred, and added in the order they were produced as capacity
+ *  frees up. A deferred operation is held by the queue, but isn't prepared
+ *  or scheduled until it is added. Operations added directly to the queue
+ *  are always accepted, and count against the capacity.
+ *
+ *  Producers using `-[OPOperation produceOperation:whenAccepted:]` can wait
+ *  to be told their operation was accepted before producing the next, which
+ *  keeps the deferred list short. Plain `-produceOperation:` has no such
+ *  signal, so by default every operation it produces is deferred, however
+ *  many are already waiting; set `maximumDeferredOperationCount` to throttle
+ *  it.
+ *
+ *  A single operation costing more than the whole capacity is accepted once
+ *  the queue is otherwise empty.
+ *
+ *  Defaults to 0, which imposes no limit and disables the accounting.
+ *
+ *  @see -[OPOperation produceOperation:whenAccepted:]
+ */
+@property (assign, nonatomic) NSUInteger capacity;
+
+/**
+ *  Returns the cost of an operation, such as an estimate of the memory it
+ *  will use. Called once as each operation is added. When `nil`, each
+ *  operation costs 1, so `capacity` is a number of operations.
+ */
+@property (copy, nonatomic) NSUInteger (^costBlock)(NSOperation *operation);
+
+/**
+ *  Total cost of the operations currently counted against `capacity`.
+ */
+@property (assign, nonatomic, readonly) NSUInteger occupancy;
+
+/**
+ *  The highest `occupancy` reached since the capacity was set, or since
+ *  `-resetHighWaterMarks`.
+ */
+@property (assign, nonatomic, readonly) NSUInteger occupancyHighWaterMark;
+
+/**
+ *  The most produced operations deferred at once before plain
+ *  `-produceOperation:` blocks the producing thread until one is accepted.
+ *  Operations produced with a `whenAccepted` block are deferred regardless,
+ *  as their producers are expected to wait for it.
+ *
+ *  A blocked producer keeps its thread, and any concurrency slot, until
+ *  queued operations start and free capacity. The queue must be able to
+ *  start other operations meanwhile, so keep `maxConcurrentOperationCount`,
+ *  and the executor's worker count, above the number of operations which
+ *  may be producing at once, or the queue can deadlock.
+ *
+ *  Defaults to 0, which imposes no limit, so produced operations are
+ *  deferred without bound.
+ */
+@property (assign, nonatomic) NSUInteger maximumDeferredOperationCount;
+
+/**
+ *  Number of produced operations waiting for capacity.
+ */
+@property (assign, nonatomic, readonly) NSUInteger deferredOperationCount;
+
+/**
+ *  The highest `deferredOperationCount` reached since the capacity was set,
+ *  or since `-resetHighWaterMarks`.
+ */
+@property (assign, nonatomic, readonly) NSUInteger deferredHighWaterMark;
+
+- (void)resetHighWaterMarks;
+
+
+///----------------
+/// @name Debugging
+///----------------
+
+/**
+ *  When `YES`, each batch of operations added to the queue is checked for
+ *  dependency cycles once its condition and exclusivity dependencies are
+ *  in place, searching every dependency reachable from the batch. The
+ *  `OPOperation`s on a cycle found are cancelled with an
+ *  `OPOperationErrorCodeDependencyCycle` error, so that the cycle is
+ *  reported rather than leaving the queue waiting forever.
+ *
+ *  Cycles between `OPOperation`s are always caught as each dependency is
+ *  added. This additionally catches cycles through plain `NSOperation`s,
+ *  at a cost proportional to the size of the graph, and is intended for
+ *  debug builds. Defaults to `NO`.
+ */
+@property (assign, nonatomic) BOOL verifiesDependencyGraph;
+
+
 - (void)addOperation:(NSOperation *)operation;
 
+/**
+ *  Adds a batch of operations to the queue. Condition dependencies and
+ *  mutual exclusivity are resolved for the whole batch in a single pass,
+ *  the delegate is notified once, and the prepared batch is handed to the
+ *  underlying queue in one step.
+ */
 - (void)addOperations:(NSArray *)operations waitUntilFinished:(BOOL)wait;
 
+/**
+ *  Validates `graph`, if it hasn't been already, and adds all of its
+ *  operations to the queue as a single batch, in topological order. Each
+ *  operation becomes ready as its predecessors in the graph finish.
+ *
+ *  @param graph A graph which hasn't been submitted before
+ *  @param error Set to the validation error if the graph has a cycle
+ *
+ *  @return `NO`, adding nothing, if the graph has a cycle
+ */
+- (BOOL)addOperationGraph:(OPOperationGraph *)graph error:(NSError **)error;
+
 @end
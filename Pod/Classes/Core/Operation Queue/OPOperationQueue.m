@@ -21,9 +21,232 @@
 
 #import "OPOperationQueue.h"
 #import "OPOperation.h"
-#import "OPBlockObserver.h"
+#import "OPOperation+Private.h"
 #import "OPExclusivityController.h"
+#import "OPOperationGraph.h"
+#import "OPOperationGraph+Private.h"
 #import "OPOperationCondition.h"
+#import "OPWorkStealingExecutor.h"
+#import "OPPriorityPolicy.h"
+
+#import <math.h>
+#import <pthread.h>
+#import <stdatomic.h>
+
+
+static void * OPOperationQueueReadyKVOContext = &OPOperationQueueReadyKVOContext;
+
+static OPWorkStealingExecutor *OPOperationQueueDefaultExecutor = nil;
+
+
+/**
+ *  Wait times are bucketed by powers of two microseconds; bucket `i` counts
+ *  waits shorter than 2^i microseconds.
+ */
+#define kOPPriorityWaitHistogramBucketCount 32
+
+typedef struct {
+    NSUInteger started;
+    NSTimeInterval totalWait;
+    NSTimeInterval maxWait;
+    NSUInteger histogram[kOPPriorityWaitHistogramBucketCount];
+} OPPriorityLaneCounters;
+
+static inline NSUInteger OPPriorityWaitHistogramBucket(NSTimeInterval wait)
+{
+    double microseconds = wait * USEC_PER_SEC;
+    if (microseconds < 1) {
+        return 0;
+    }
+
+    return MIN((NSUInteger)floor(log2(microseconds)) + 1, (NSUInteger)kOPPriorityWaitHistogramBucketCount - 1);
+}
+
+static NSTimeInterval OPPriorityWaitPercentile(const OPPriorityLaneCounters *counters, double percentile)
+{
+    if (counters->started == 0) {
+        return 0;
+    }
+
+    NSUInteger rank = (NSUInteger)ceil(percentile * counters->started);
+    NSUInteger seen = 0;
+    for (NSUInteger idx = 0; idx < kOPPriorityWaitHistogramBucketCount; idx++) {
+        seen += counters->histogram[idx];
+        if (seen >= MAX(rank, (NSUInteger)1)) {
+            return MIN(ldexp(1.0, (int)idx) / USEC_PER_SEC, counters->maxWait);
+        }
+    }
+
+    return counters->maxWait;
+}
+
+
+/**
+ *  Number of independently locked shards in-flight deduplication keys are
+ *  spread across. Must be a power of two.
+ */
+static const NSUInteger kOPDeduplicationShardCount = 16;
+
+/**
+ *  A lock and the in-flight operations, by `deduplicationKey`, whose keys
+ *  hash to it.
+ */
+@interface OPOperationQueueDeduplicationShard : NSObject {
+    @package
+    pthread_mutex_t _lock;
+    NSMutableDictionary *_operations;
+}
+@end
+
+@implementation OPOperationQueueDeduplicationShard
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    pthread_mutex_init(&_lock, NULL);
+    _operations = [[NSMutableDictionary alloc] init];
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+@end
+
+
+/**
+ *  The queue's hooks into the lifecycle of every `OPOperation` added to it.
+ *  A single instance is created per queue and shared by all of its
+ *  operations, so wiring an operation to its queue allocates nothing.
+ */
+@interface OPOperationQueueObserver : NSObject <OPOperationProductionObserver>
+
+@property (weak, nonatomic) OPOperationQueue *queue;
+
+@end
+
+
+@interface OPOperationQueue () <OPOperationScheduler> {
+    /**
+     *  Guards the bookkeeping used when operations are run by `executor`.
+     */
+    pthread_mutex_t _executorLock;
+    pthread_cond_t _executorIdleCondition;
+    BOOL _executorSuspended;
+
+    /**
+     *  Number of operations held across every lane of `executorHeldLanes`,
+     *  and per-lane wait statistics, guarded by `_executorLock`.
+     */
+    NSUInteger _executorHeldCount;
+    OPPriorityLaneCounters _laneCounters[kOPPriorityLaneCount];
+
+    /**
+     *  Guards the capacity accounting. Set once a capacity has been set, as
+     *  until then operations aren't counted. `_deferredSpaceCondition` is
+     *  signalled as deferred operations are accepted, for producers
+     *  waiting on `maximumDeferredOperationCount`.
+     */
+    pthread_mutex_t _capacityLock;
+    pthread_cond_t _deferredSpaceCondition;
+    atomic_bool _tracksCapacity;
+    NSUInteger _occupancy;
+    NSUInteger _occupancyHighWaterMark;
+    NSUInteger _deferredHighWaterMark;
+    NSUInteger _maximumDeferredOperationCount;
+}
+
+@property (strong, nonatomic) OPOperationQueueObserver *queueObserver;
+
+/**
+ *  Every operation handed to the queue in executor mode which hasn't yet finished.
+ */
+@property (strong, nonatomic) NSMutableSet *executorOperations;
+
+/**
+ *  Operations in executor mode which are still waiting to become ready.
+ */
+@property (strong, nonatomic) NSMutableSet *executorWaitingOperations;
+
+/**
+ *  Waiting operations whose `isReady` observation has been registered.
+ *  Whoever takes an operation out of this set removes the observation, so
+ *  one is never removed before it was added, nor twice.
+ */
+@property (strong, nonatomic) NSMutableSet *executorObservedOperations;
+
+/**
+ *  Operations which are ready but held back because the queue is suspended
+ *  or already running as many operations as it may. One
+ *  `NSMutableOrderedSet` per priority lane, lowest first, each in the order
+ *  operations became ready. Without a `priorityPolicy` only the first lane
+ *  is used.
+ */
+@property (strong, nonatomic) NSArray *executorHeldLanes;
+
+/**
+ *  When each held operation became ready, as `-[NSProcessInfo systemUptime]`.
+ *  Only kept with a `priorityPolicy`.
+ */
+@property (strong, nonatomic) NSMapTable *executorHeldTimes;
+
+/**
+ *  Operations which have been handed to the executor and not yet finished.
+ */
+@property (strong, nonatomic) NSMutableSet *executorRunningOperations;
+
+/**
+ *  While any operation is in flight in executor mode, the queue keeps itself
+ *  alive, as `NSOperationQueue` does.
+ */
+@property (strong, nonatomic) OPOperationQueue *executorRetainedSelf;
+
+/**
+ *  The cost of each operation currently counted against `capacity`, keyed by
+ *  the operation's identity. Removing the entry releases the cost exactly once.
+ */
+@property (strong, nonatomic) NSMapTable *capacityCosts;
+
+/**
+ *  Produced operations waiting for capacity, oldest first.
+ */
+@property (strong, nonatomic) NSMutableArray *deferredOperations;
+
+/**
+ *  `kOPDeduplicationShardCount` shards of the in-flight operations which
+ *  have a `deduplicationKey`.
+ */
+@property (strong, nonatomic) NSArray *deduplicationShards;
+
+- (void)addProducedOperation:(NSOperation *)operation whenAccepted:(void (^)(void))accepted;
+
+- (void)releaseCapacityForOperation:(NSOperation *)operation;
+
+- (void)releaseDeduplicationKeyForOperation:(OPOperation *)operation;
+
+@end
+
+
+/**
+ *  A produced operation waiting for capacity, and the producer's callback.
+ */
+@interface OPOperationQueueDeferredOperation : NSObject
+
+@property (strong, nonatomic) NSOperation *operation;
+@property (assign, nonatomic) NSUInteger cost;
+@property (copy, nonatomic) void (^accepted)(void);
+
+@end
+
+@implementation OPOperationQueueDeferredOperation
+@end
 
 
 @implementation OPOperationQueue
@@ -57,67 +280,856 @@
 }
 
 - (void)addOperation:(NSOperation *)operation
+{
+    [self addOperations:@[operation] waitUntilFinished:NO];
+}
+
+- (void)addOperations:(NSArray *)operations waitUntilFinished:(BOOL)wait
+{
+    NSMutableArray *batch = [[NSMutableArray alloc] initWithCapacity:[operations count]];
+    NSMutableArray *exclusiveOperations = [[NSMutableArray alloc] init];
+    NSMutableArray *exclusiveCategories = [[NSMutableArray alloc] init];
+
+    for (NSOperation *operation in operations) {
+        [self prepareOperation:operation
+                         batch:batch
+           exclusiveOperations:exclusiveOperations
+           exclusiveCategories:exclusiveCategories];
+    }
+
+    if (atomic_load_explicit(&_tracksCapacity, memory_order_acquire)) {
+        [self capacity_reserveOperations:batch];
+    }
+
+    // With condition dependencies added, set up the mutual exclusivity
+    // dependencies for the whole batch at once.
+    if ([exclusiveOperations count] > 0) {
+        [[OPExclusivityController sharedExclusivityController] addOperations:exclusiveOperations
+                                                                  categories:exclusiveCategories];
+    }
+
+    if ([self verifiesDependencyGraph]) {
+        [self verifyDependencyGraphForOperations:batch];
+    }
+
+    /**
+     *  Indicate to the operations that we've finished our extra work on them
+     *  and they're now in a state where they can proceed with evaluating
+     *  conditions, if appropriate.
+     */
+    for (NSOperation *operation in batch) {
+        if ([operation isKindOfClass:[OPOperation class]]) {
+            [(OPOperation *)operation willEnqueue];
+        }
+    }
+
+    if ([self.delegate respondsToSelector:@selector(operationQueue:willAddOperations:)]) {
+        [self.delegate operationQueue:self willAddOperations:batch];
+    } else if ([self.delegate respondsToSelector:@selector(operationQueue:willAddOperation:)]) {
+        for (NSOperation *operation in batch) {
+            [self.delegate operationQueue:self willAddOperation:operation];
+        }
+    }
+
+    /**
+     *  The base implementation of this method does not call `-addOperation:`,
+     *  so the whole prepared batch can be handed over in one step.
+     */
+    if ([self executor]) {
+        [self executor_addOperations:batch];
+    } else if ([batch count] == 1) {
+        [super addOperation:[batch firstObject]];
+    } else {
+        [super addOperations:batch waitUntilFinished:NO];
+    }
+
+    if (wait) {
+        for (NSOperation *operation in operations) {
+            [operation waitUntilFinished];
+        }
+    }
+}
+
+
+#pragma mark - Dependency Graph
+#pragma mark -
+
+- (BOOL)addOperationGraph:(OPOperationGraph *)graph error:(NSError **)error
+{
+    NSParameterAssert(graph);
+
+    if (![graph validate:error]) {
+        return NO;
+    }
+
+    [self addOperations:[graph beginSubmission] waitUntilFinished:NO];
+
+    return YES;
+}
+
+- (void)verifyDependencyGraphForOperations:(NSArray *)operations
+{
+    NSArray *cycle = [OPOperation dependencyCycleReachableFromOperations:operations];
+    if (!cycle) {
+        return;
+    }
+
+    NSError *error = [OPOperation dependencyCycleErrorWithOperations:cycle];
+
+    // Cancelled operations no longer wait for their dependencies, which
+    // breaks the cycle.
+    for (NSOperation *operation in cycle) {
+        if ([operation isKindOfClass:[OPOperation class]]) {
+            [(OPOperation *)operation cancelWithError:error];
+        }
+    }
+}
+
+
+#pragma mark - Capacity
+#pragma mark -
+
+@synthesize capacity = _capacity;
+
+- (NSUInteger)capacity
+{
+    pthread_mutex_lock(&_capacityLock);
+    NSUInteger capacity = _capacity;
+    pthread_mutex_unlock(&_capacityLock);
+
+    return capacity;
+}
+
+- (void)setCapacity:(NSUInteger)capacity
+{
+    pthread_mutex_lock(&_capacityLock);
+    _capacity = capacity;
+    if (capacity > 0) {
+        atomic_store_explicit(&_tracksCapacity, true, memory_order_release);
+    }
+    NSArray *accepted = [self capacity_dequeueDeferredOperations];
+    pthread_mutex_unlock(&_capacityLock);
+
+    [self capacity_addDeferredOperations:accepted];
+}
+
+- (NSUInteger)occupancy
+{
+    pthread_mutex_lock(&_capacityLock);
+    NSUInteger occupancy = _occupancy;
+    pthread_mutex_unlock(&_capacityLock);
+
+    return occupancy;
+}
+
+- (NSUInteger)occupancyHighWaterMark
+{
+    pthread_mutex_lock(&_capacityLock);
+    NSUInteger highWaterMark = _occupancyHighWaterMark;
+    pthread_mutex_unlock(&_capacityLock);
+
+    return highWaterMark;
+}
+
+@synthesize maximumDeferredOperationCount = _maximumDeferredOperationCount;
+
+- (NSUInteger)maximumDeferredOperationCount
+{
+    pthread_mutex_lock(&_capacityLock);
+    NSUInteger maximum = _maximumDeferredOperationCount;
+    pthread_mutex_unlock(&_capacityLock);
+
+    return maximum;
+}
+
+- (void)setMaximumDeferredOperationCount:(NSUInteger)maximumDeferredOperationCount
+{
+    pthread_mutex_lock(&_capacityLock);
+    _maximumDeferredOperationCount = maximumDeferredOperationCount;
+    pthread_cond_broadcast(&_deferredSpaceCondition);
+    pthread_mutex_unlock(&_capacityLock);
+}
+
+- (NSUInteger)deferredOperationCount
+{
+    pthread_mutex_lock(&_capacityLock);
+    NSUInteger count = [self.deferredOperations count];
+    pthread_mutex_unlock(&_capacityLock);
+
+    return count;
+}
+
+- (NSUInteger)deferredHighWaterMark
+{
+    pthread_mutex_lock(&_capacityLock);
+    NSUInteger highWaterMark = _deferredHighWaterMark;
+    pthread_mutex_unlock(&_capacityLock);
+
+    return highWaterMark;
+}
+
+- (void)resetHighWaterMarks
+{
+    pthread_mutex_lock(&_capacityLock);
+    _occupancyHighWaterMark = _occupancy;
+    _deferredHighWaterMark = [self.deferredOperations count];
+    pthread_mutex_unlock(&_capacityLock);
+}
+
+- (NSUInteger)capacity_costOfOperation:(NSOperation *)operation
+{
+    NSUInteger (^costBlock)(NSOperation *) = [self costBlock];
+
+    return costBlock ? costBlock(operation) : 1;
+}
+
+/**
+ *  Counts a prepared batch against the capacity. Operations whose cost was
+ *  reserved while they were deferred are already counted.
+ */
+- (void)capacity_reserveOperations:(NSArray *)operations
+{
+    NSMutableArray *costs = [[NSMutableArray alloc] initWithCapacity:[operations count]];
+    for (NSOperation *operation in operations) {
+        [costs addObject:@([self capacity_costOfOperation:operation])];
+    }
+
+    pthread_mutex_lock(&_capacityLock);
+    for (NSUInteger idx = 0; idx < [operations count]; idx++) {
+        NSOperation *operation = operations[idx];
+        if (![self.capacityCosts objectForKey:operation]) {
+            [self.capacityCosts setObject:costs[idx] forKey:operation];
+            _occupancy += [costs[idx] unsignedIntegerValue];
+        }
+    }
+    _occupancyHighWaterMark = MAX(_occupancyHighWaterMark, _occupancy);
+    pthread_mutex_unlock(&_capacityLock);
+}
+
+- (void)releaseCapacityForOperation:(NSOperation *)operation
+{
+    if (!atomic_load_explicit(&_tracksCapacity, memory_order_acquire)) {
+        return;
+    }
+
+    pthread_mutex_lock(&_capacityLock);
+    NSNumber *cost = [self.capacityCosts objectForKey:operation];
+    NSArray *accepted = nil;
+    if (cost) {
+        [self.capacityCosts removeObjectForKey:operation];
+        _occupancy -= [cost unsignedIntegerValue];
+        accepted = [self capacity_dequeueDeferredOperations];
+    }
+    pthread_mutex_unlock(&_capacityLock);
+
+    [self capacity_addDeferredOperations:accepted];
+}
+
+- (void)addProducedOperation:(NSOperation *)operation whenAccepted:(void (^)(void))accepted
+{
+    if (atomic_load_explicit(&_tracksCapacity, memory_order_acquire)) {
+        NSUInteger cost = [self capacity_costOfOperation:operation];
+
+        pthread_mutex_lock(&_capacityLock);
+        // Producers which can't be told when their operation is accepted
+        // are throttled here instead, once the deferred list is full.
+        while (!accepted && [self capacity_deferredOperationsAreFull]) {
+            pthread_cond_wait(&_deferredSpaceCondition, &_capacityLock);
+        }
+
+        // Operations already waiting go first, so production stays in order.
+        BOOL fits = [self.deferredOperations count] == 0 && [self capacity_fitsCost:cost];
+        if (fits) {
+            [self.capacityCosts setObject:@(cost) forKey:operation];
+            _occupancy += cost;
+            _occupancyHighWaterMark = MAX(_occupancyHighWaterMark, _occupancy);
+        } else {
+            OPOperationQueueDeferredOperation *deferred = [[OPOperationQueueDeferredOperation alloc] init];
+            deferred.operation = operation;
+            deferred.cost = cost;
+            deferred.accepted = accepted;
+            [self.deferredOperations addObject:deferred];
+            _deferredHighWaterMark = MAX(_deferredHighWaterMark, [self.deferredOperations count]);
+        }
+        pthread_mutex_unlock(&_capacityLock);
+
+        if (!fits) {
+            return;
+        }
+    }
+
+    [self addOperation:operation];
+
+    if (accepted) {
+        accepted();
+    }
+}
+
+/**
+ *  Must be called with `_capacityLock` held.
+ */
+- (BOOL)capacity_fitsCost:(NSUInteger)cost
+{
+    return _capacity == 0 || _occupancy == 0 || _occupancy + cost <= _capacity;
+}
+
+/**
+ *  Must be called with `_capacityLock` held.
+ */
+- (BOOL)capacity_deferredOperationsAreFull
+{
+    return _maximumDeferredOperationCount > 0 && [self.deferredOperations count] >= _maximumDeferredOperationCount;
+}
+
+/**
+ *  Removes as many deferred operations as now fit, oldest first, and
+ *  reserves their cost. Must be called with `_capacityLock` held.
+ *
+ *  @return The deferred operations to add once the lock is released
+ */
+- (NSArray *)capacity_dequeueDeferredOperations
+{
+    NSUInteger count = 0;
+    for (OPOperationQueueDeferredOperation *deferred in self.deferredOperations) {
+        if (![self capacity_fitsCost:deferred.cost]) {
+            break;
+        }
+        [self.capacityCosts setObject:@(deferred.cost) forKey:deferred.operation];
+        _occupancy += deferred.cost;
+        count++;
+    }
+
+    if (count == 0) {
+        return nil;
+    }
+
+    _occupancyHighWaterMark = MAX(_occupancyHighWaterMark, _occupancy);
+
+    NSRange range = NSMakeRange(0, count);
+    NSArray *accepted = [self.deferredOperations subarrayWithRange:range];
+    [self.deferredOperations removeObjectsInRange:range];
+    pthread_cond_broadcast(&_deferredSpaceCondition);
+
+    return accepted;
+}
+
+- (void)capacity_addDeferredOperations:(NSArray *)deferredOperations
+{
+    if ([deferredOperations count] == 0) {
+        return;
+    }
+
+    NSMutableArray *operations = [[NSMutableArray alloc] initWithCapacity:[deferredOperations count]];
+    for (OPOperationQueueDeferredOperation *deferred in deferredOperations) {
+        [operations addObject:deferred.operation];
+    }
+
+    [self addOperations:operations waitUntilFinished:NO];
+
+    for (OPOperationQueueDeferredOperation *deferred in deferredOperations) {
+        if (deferred.accepted) {
+            deferred.accepted();
+        }
+    }
+}
+
+
+#pragma mark - Deduplication
+#pragma mark -
+
+- (OPOperationQueueDeduplicationShard *)deduplication_shardForKey:(NSString *)key
+{
+    return [self deduplicationShards][[key hash] & (kOPDeduplicationShardCount - 1)];
+}
+
+/**
+ *  Attaches `operation` to the in-flight operation with the same key, or
+ *  registers it as the in-flight operation for its key if there is none.
+ *
+ *  @return `YES` if the operation was attached to an earlier one
+ */
+- (BOOL)deduplication_attachOperation:(OPOperation *)operation
+{
+    NSString *key = [operation deduplicationKey];
+    OPOperationQueueDeduplicationShard *shard = [self deduplication_shardForKey:key];
+
+    pthread_mutex_lock(&shard->_lock);
+    OPOperation *inFlightOperation = shard->_operations[key];
+    if (!inFlightOperation) {
+        shard->_operations[key] = operation;
+    }
+    pthread_mutex_unlock(&shard->_lock);
+
+    if (!inFlightOperation) {
+        return NO;
+    }
+
+    // Should the in-flight operation finish in the meantime, the dependency
+    // is satisfied immediately and its errors are already in place.
+    [operation setDeduplicatedOperation:inFlightOperation];
+    [operation addDependency:inFlightOperation];
+
+    return YES;
+}
+
+- (void)releaseDeduplicationKeyForOperation:(OPOperation *)operation
+{
+    NSString *key = [operation deduplicationKey];
+    OPOperationQueueDeduplicationShard *shard = [self deduplication_shardForKey:key];
+
+    pthread_mutex_lock(&shard->_lock);
+    if (shard->_operations[key] == operation) {
+        [shard->_operations removeObjectForKey:key];
+    }
+    pthread_mutex_unlock(&shard->_lock);
+}
+
+
+#pragma mark - Executor
+#pragma mark -
+
++ (void)setDefaultExecutor:(OPWorkStealingExecutor *)executor
+{
+    @synchronized(self) {
+        OPOperationQueueDefaultExecutor = executor;
+    }
+}
+
++ (OPWorkStealingExecutor *)defaultExecutor
+{
+    @synchronized(self) {
+        return OPOperationQueueDefaultExecutor;
+    }
+}
+
+- (void)setSuspended:(BOOL)suspended
+{
+    [super setSuspended:suspended];
+
+    pthread_mutex_lock(&_executorLock);
+    _executorSuspended = suspended;
+    NSArray *readyOperations = [self executor_dequeueHeldOperations];
+    pthread_mutex_unlock(&_executorLock);
+
+    for (NSOperation *operation in readyOperations) {
+        [self.executor scheduleOperation:operation];
+    }
+}
+
+- (void)setMaxConcurrentOperationCount:(NSInteger)maxConcurrentOperationCount
+{
+    [super setMaxConcurrentOperationCount:maxConcurrentOperationCount];
+
+    // Raising the limit may release held operations.
+    pthread_mutex_lock(&_executorLock);
+    NSArray *readyOperations = [self executor_dequeueHeldOperations];
+    pthread_mutex_unlock(&_executorLock);
+
+    for (NSOperation *operation in readyOperations) {
+        [self.executor scheduleOperation:operation];
+    }
+}
+
+- (NSArray *)operations
+{
+    if (![self executor]) {
+        return [super operations];
+    }
+
+    pthread_mutex_lock(&_executorLock);
+    NSArray *operations = [self.executorOperations allObjects];
+    pthread_mutex_unlock(&_executorLock);
+
+    return operations;
+}
+
+- (NSUInteger)operationCount
+{
+    if (![self executor]) {
+        return [super operationCount];
+    }
+
+    pthread_mutex_lock(&_executorLock);
+    NSUInteger count = [self.executorOperations count];
+    pthread_mutex_unlock(&_executorLock);
+
+    return count;
+}
+
+- (void)cancelAllOperations
+{
+    if (![self executor]) {
+        [super cancelAllOperations];
+        return;
+    }
+
+    NSArray *operations = [self operations];
+
+    for (NSOperation *operation in operations) {
+        [operation cancel];
+    }
+
+    // Cancelled operations become ready regardless of their dependencies.
+    for (NSOperation *operation in operations) {
+        [self executor_operationReadinessMayHaveChanged:operation];
+    }
+}
+
+- (void)waitUntilAllOperationsAreFinished
+{
+    if (![self executor]) {
+        [super waitUntilAllOperationsAreFinished];
+        return;
+    }
+
+    pthread_mutex_lock(&_executorLock);
+    while ([self.executorOperations count] > 0) {
+        pthread_cond_wait(&_executorIdleCondition, &_executorLock);
+    }
+    pthread_mutex_unlock(&_executorLock);
+}
+
+- (NSArray *)priorityLaneStatistics
+{
+    NSArray *priorities = @[ @(NSOperationQueuePriorityVeryLow), @(NSOperationQueuePriorityLow), @(NSOperationQueuePriorityNormal), @(NSOperationQueuePriorityHigh), @(NSOperationQueuePriorityVeryHigh) ];
+    NSMutableArray *statistics = [[NSMutableArray alloc] initWithCapacity:kOPPriorityLaneCount];
+
+    pthread_mutex_lock(&_executorLock);
+    for (NSUInteger lane = 0; lane < kOPPriorityLaneCount; lane++) {
+        const OPPriorityLaneCounters *counters = &_laneCounters[lane];
+        [statistics addObject:[[OPPriorityLaneStatistics alloc] initWithPriority:[priorities[lane] integerValue]
+                                                                    waitingCount:[self.executorHeldLanes[lane] count]
+                                                                    startedCount:counters->started
+                                                                    meanWaitTime:counters->started ? counters->totalWait / counters->started : 0
+                                                                     maxWaitTime:counters->maxWait
+                                                                  medianWaitTime:OPPriorityWaitPercentile(counters, 0.5)
+                                                                     p99WaitTime:OPPriorityWaitPercentile(counters, 0.99)]];
+    }
+    pthread_mutex_unlock(&_executorLock);
+
+    return statistics;
+}
+
+- (void)resetPriorityLaneStatistics
+{
+    pthread_mutex_lock(&_executorLock);
+    memset(_laneCounters, 0, sizeof(_laneCounters));
+    pthread_mutex_unlock(&_executorLock);
+}
+
+- (void)executor_addOperations:(NSArray *)operations
+{
+    pthread_mutex_lock(&_executorLock);
+    if ([self.executorOperations count] == 0) {
+        [self setExecutorRetainedSelf:self];
+    }
+    [self.executorOperations addObjectsFromArray:operations];
+    [self.executorWaitingOperations addObjectsFromArray:operations];
+    pthread_mutex_unlock(&_executorLock);
+
+    for (NSOperation *operation in operations) {
+        if ([operation isKindOfClass:[OPOperation class]]) {
+            [(OPOperation *)operation setScheduler:self];
+        }
+
+        [operation addObserver:self
+                    forKeyPath:@"isReady"
+                       options:0
+                       context:OPOperationQueueReadyKVOContext];
+
+        // The operation may have been claimed or finished while the
+        // observation was being added, in which case nobody else will
+        // remove it.
+        pthread_mutex_lock(&_executorLock);
+        BOOL stillWaiting = [self.executorWaitingOperations containsObject:operation];
+        if (stillWaiting) {
+            [self.executorObservedOperations addObject:operation];
+        }
+        pthread_mutex_unlock(&_executorLock);
+
+        if (!stillWaiting) {
+            [operation removeObserver:self forKeyPath:@"isReady" context:OPOperationQueueReadyKVOContext];
+        }
+    }
+
+    for (NSOperation *operation in operations) {
+        [self executor_operationReadinessMayHaveChanged:operation];
+    }
+}
+
+/**
+ *  Hands an operation to the executor if it has become ready. Readiness may
+ *  be reported from several threads at once, so exactly one caller claims
+ *  the operation by removing it from the waiting set.
+ */
+- (void)executor_operationReadinessMayHaveChanged:(NSOperation *)operation
+{
+    if (![operation isReady]) {
+        return;
+    }
+
+    pthread_mutex_lock(&_executorLock);
+    BOOL claimed = [self.executorWaitingOperations containsObject:operation];
+    BOOL observed = NO;
+    if (claimed) {
+        [self.executorWaitingOperations removeObject:operation];
+        observed = [self.executorObservedOperations containsObject:operation];
+        [self.executorObservedOperations removeObject:operation];
+    }
+    pthread_mutex_unlock(&_executorLock);
+
+    if (!claimed) {
+        return;
+    }
+
+    // Stop observing before the operation can be started, and so finished.
+    if (observed) {
+        [operation removeObserver:self forKeyPath:@"isReady" context:OPOperationQueueReadyKVOContext];
+    }
+
+    pthread_mutex_lock(&_executorLock);
+    // It may have finished without starting in the meantime.
+    if ([self.executorOperations containsObject:operation]) {
+        [self executor_holdOperation:operation];
+    }
+    NSArray *readyOperations = [self executor_dequeueHeldOperations];
+    pthread_mutex_unlock(&_executorLock);
+
+    for (NSOperation *readyOperation in readyOperations) {
+        [self.executor scheduleOperation:readyOperation];
+    }
+}
+
+/**
+ *  Adds a ready operation to its lane. Must be called with `_executorLock`
+ *  held.
+ */
+- (void)executor_holdOperation:(NSOperation *)operation
+{
+    NSUInteger lane = 0;
+    if (self.priorityPolicy) {
+        lane = OPPriorityLaneForQueuePriority([operation queuePriority]);
+        [self.executorHeldTimes setObject:@([[NSProcessInfo processInfo] systemUptime]) forKey:operation];
+    }
+
+    [self.executorHeldLanes[lane] addObject:operation];
+    _executorHeldCount++;
+}
+
+/**
+ *  Removes an operation which finished while held. Must be called with
+ *  `_executorLock` held.
+ */
+- (void)executor_removeHeldOperation:(NSOperation *)operation
+{
+    if (_executorHeldCount == 0) {
+        return;
+    }
+
+    for (NSMutableOrderedSet *lane in self.executorHeldLanes) {
+        if ([lane containsObject:operation]) {
+            [lane removeObject:operation];
+            [self.executorHeldTimes removeObjectForKey:operation];
+            _executorHeldCount--;
+            return;
+        }
+    }
+}
+
+/**
+ *  Removes the held operation which should start next. Without a priority
+ *  policy, that is simply the oldest. Otherwise each lane's oldest operation
+ *  is scored by its lane plus one for every aging interval it has waited,
+ *  and the highest score wins, with ties going to the higher lane. Must be
+ *  called with `_executorLock` held.
+ */
+- (NSOperation *)executor_popHeldOperation
+{
+    OPPriorityPolicy *policy = self.priorityPolicy;
+    if (!policy) {
+        NSMutableOrderedSet *lane = [self.executorHeldLanes firstObject];
+        NSOperation *operation = [lane firstObject];
+        [lane removeObjectAtIndex:0];
+        _executorHeldCount--;
+        return operation;
+    }
+
+    NSTimeInterval now = [[NSProcessInfo processInfo] systemUptime];
+    NSTimeInterval agingInterval = [policy agingInterval];
+
+    NSInteger bestLane = -1;
+    double bestScore = -INFINITY;
+    NSTimeInterval bestWait = 0;
+
+    for (NSInteger lane = kOPPriorityLaneCount - 1; lane >= 0; lane--) {
+        NSOperation *operation = [self.executorHeldLanes[lane] firstObject];
+        if (!operation) {
+            continue;
+        }
+
+        NSTimeInterval wait = MAX(now - [[self.executorHeldTimes objectForKey:operation] doubleValue], 0);
+        double score = lane + (agingInterval > 0 ? floor(wait / agingInterval) : 0);
+        if (score > bestScore) {
+            bestLane = lane;
+            bestScore = score;
+            bestWait = wait;
+        }
+    }
+
+    NSMutableOrderedSet *lane = self.executorHeldLanes[bestLane];
+    NSOperation *operation = [lane firstObject];
+    [lane removeObjectAtIndex:0];
+    [self.executorHeldTimes removeObjectForKey:operation];
+    _executorHeldCount--;
+
+    OPPriorityLaneCounters *counters = &_laneCounters[bestLane];
+    counters->started++;
+    counters->totalWait += bestWait;
+    counters->maxWait = MAX(counters->maxWait, bestWait);
+    counters->histogram[OPPriorityWaitHistogramBucket(bestWait)]++;
+
+    return operation;
+}
+
+/**
+ *  Removes as many held operations as the queue may now run and marks them
+ *  as running. Must be called with `_executorLock` held.
+ *
+ *  With a priority policy and no `maxConcurrentOperationCount`, the queue
+ *  runs at most one operation per executor worker, so that ready operations
+ *  wait in the priority lanes rather than in the executor.
+ *
+ *  @return Operations to hand to the executor once the lock is released
+ */
+- (NSArray *)executor_dequeueHeldOperations
+{
+    if (_executorSuspended || _executorHeldCount == 0) {
+        return nil;
+    }
+
+    NSUInteger available = _executorHeldCount;
+    NSInteger maxConcurrentOperationCount = [self maxConcurrentOperationCount];
+    if (maxConcurrentOperationCount == NSOperationQueueDefaultMaxConcurrentOperationCount && self.priorityPolicy) {
+        maxConcurrentOperationCount = (NSInteger)[self.executor workerCount];
+    }
+    if (maxConcurrentOperationCount != NSOperationQueueDefaultMaxConcurrentOperationCount) {
+        NSUInteger running = [self.executorRunningOperations count];
+        available = (NSUInteger)maxConcurrentOperationCount > running ? MIN((NSUInteger)maxConcurrentOperationCount - running, _executorHeldCount) : 0;
+    }
+
+    if (available == 0) {
+        return nil;
+    }
+
+    NSMutableArray *operations = [[NSMutableArray alloc] initWithCapacity:available];
+    for (NSUInteger idx = 0; idx < available; idx++) {
+        [operations addObject:[self executor_popHeldOperation]];
+    }
+    [self.executorRunningOperations addObjectsFromArray:operations];
+
+    return operations;
+}
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary *)change context:(void *)context
+{
+    if (context == OPOperationQueueReadyKVOContext) {
+        [self executor_operationReadinessMayHaveChanged:object];
+    } else {
+        [super observeValueForKeyPath:keyPath ofObject:object change:change context:context];
+    }
+}
+
+
+#pragma mark - OPOperationScheduler
+#pragma mark -
+
+- (void)operationDidFinish:(OPOperation *)operation
+{
+    // Released outside of the lock, as it may be the last reference to us.
+    OPOperationQueue *retainedSelf = nil;
+
+    pthread_mutex_lock(&_executorLock);
+    [self.executorOperations removeObject:operation];
+    // Some operations (e.g. `OPDelayOperation`) may finish before they start.
+    [self.executorWaitingOperations removeObject:operation];
+    BOOL wasObserved = [self.executorObservedOperations containsObject:operation];
+    if (wasObserved) {
+        [self.executorObservedOperations removeObject:operation];
+    }
+    [self executor_removeHeldOperation:operation];
+    [self.executorRunningOperations removeObject:operation];
+
+    // A slot may have opened up under `maxConcurrentOperationCount`.
+    NSArray *readyOperations = [self executor_dequeueHeldOperations];
+
+    if ([self.executorOperations count] == 0) {
+        retainedSelf = [self executorRetainedSelf];
+        [self setExecutorRetainedSelf:nil];
+        pthread_cond_broadcast(&_executorIdleCondition);
+    }
+    pthread_mutex_unlock(&_executorLock);
+
+    if (wasObserved) {
+        [operation removeObserver:self forKeyPath:@"isReady" context:OPOperationQueueReadyKVOContext];
+    }
+
+    for (NSOperation *readyOperation in readyOperations) {
+        [self.executor scheduleOperation:readyOperation];
+    }
+
+    retainedSelf = nil;
+}
+
+
+#pragma mark - Private
+#pragma mark -
+
+/**
+ *  Performs the per-operation work of adding an operation to the queue,
+ *  appending it (and any dependencies generated by its conditions) to
+ *  `batch`, and collecting any exclusivity categories it requires.
+ */
+- (void)prepareOperation:(NSOperation *)operation
+                   batch:(NSMutableArray *)batch
+     exclusiveOperations:(NSMutableArray *)exclusiveOperations
+     exclusiveCategories:(NSMutableArray *)exclusiveCategories
 {
     if ([operation isKindOfClass:[OPOperation class]]) {
         OPOperation *opOperation = (OPOperation *)operation;
 
-        // Set up a `OPBlockObserver` to invoke the `OPOperationQueueDelegate` method.
-        __weak __typeof__(self) weakSelf = self;
-        id <OPOperationObserver>observer = [[OPBlockObserver alloc] initWithStartHandler:nil
-                                                                          produceHandler:^(__unused OPOperation *anOperation, NSOperation *newOperation) {
-                                                                              [weakSelf addOperation:newOperation];
-                                                                          }
-                                                                           finishHandler:^(OPOperation *anOperation, NSArray *errors) {
-                                                                               __typeof__(self) strongSelf = weakSelf;
-                                                                               if ([strongSelf delegate] && [strongSelf.delegate respondsToSelector:@selector(operationQueue:operationDidFinish:withErrors:)]) {
-                                                                                   [strongSelf.delegate operationQueue:strongSelf operationDidFinish:anOperation withErrors:errors];
-                                                                               }
-                                                                           }];
-
-        [opOperation addObserver:observer];
-
-        // Extract any dependencies needed by this operation
-        NSMutableArray *dependencies = [[NSMutableArray alloc] init];
+        [opOperation addObserver:[self queueObserver]];
+
+        // An attached duplicate won't execute, so needs neither the
+        // dependencies nor the exclusivity its conditions would add.
+        if ([opOperation deduplicationKey] && [self deduplication_attachOperation:opOperation]) {
+            [batch addObject:operation];
+            return;
+        }
+
+        // Extract any dependencies and exclusivity categories in one pass.
+        NSMutableArray *concurrencyCategories = nil;
         for (id <OPOperationCondition>condition in [opOperation conditions]) {
             NSOperation *dependency = [condition dependencyForOperation:opOperation];
             if (dependency) {
-                [dependencies addObject:dependency];
+                [opOperation addDependency:dependency];
+                [self prepareOperation:dependency
+                                 batch:batch
+                   exclusiveOperations:exclusiveOperations
+                   exclusiveCategories:exclusiveCategories];
             }
-        }
-
-        for (NSOperation *dependency in dependencies) {
-            [opOperation addDependency:dependency];
-            [self addOperation:dependency];
-        }
 
-        // With condition dependencies added, we can now see if this needs
-        // dependencies to enforce mutual exclusivity.
-        NSMutableArray *concurrencyCategories = [[NSMutableArray alloc] init];
-        for (id <OPOperationCondition>condition in [opOperation conditions]) {
             if (condition.isMutuallyExclusive) {
+                if (!concurrencyCategories) {
+                    concurrencyCategories = [[NSMutableArray alloc] init];
+                }
                 [concurrencyCategories addObject:condition.name];
             }
         }
 
-        if ([concurrencyCategories count] > 0) {
-            // Set up the mutual exclusivity dependencies.
-            OPExclusivityController *exclusivityController = [OPExclusivityController sharedExclusivityController];
-            [exclusivityController addOperation:opOperation categories:concurrencyCategories];
-
-            OPBlockObserver *blockObserver = [[OPBlockObserver alloc] initWithStartHandler:nil
-                                                                            produceHandler:nil
-                                                                             finishHandler:^(OPOperation *anOperation, __unused NSArray *errors) {
-                                                                                 [exclusivityController removeOperation:anOperation categories:concurrencyCategories];
-                                                                             }];
-            [opOperation addObserver:blockObserver];
+        if (concurrencyCategories) {
+            [exclusiveOperations addObject:opOperation];
+            [exclusiveCategories addObject:concurrencyCategories];
         }
-
-        /**
-         *  Indicate to the operation that we've finished our extra work on it
-         *  and it's now it a state where it can proceed with evaluating conditions,
-         *  if appropriate.
-         */
-        [opOperation willEnqueue];
     }
     else {
         /**
@@ -132,33 +1144,110 @@
         [operation setCompletionBlock:^(void) {
             __typeof__(self) strongSelf = weakSelf;
             NSOperation *strongOperation = weakOperation;
+            [strongSelf releaseCapacityForOperation:strongOperation];
+            if ([strongSelf executor]) {
+                [strongSelf operationDidFinish:(OPOperation *)strongOperation];
+            }
             if ([strongSelf delegate] && [strongSelf.delegate respondsToSelector:@selector(operationQueue:operationDidFinish:withErrors:)]) {
                 [strongSelf.delegate operationQueue:strongSelf operationDidFinish:strongOperation withErrors:@[]];
             }
         }];
     }
 
-    if ([self delegate] && [self.delegate respondsToSelector:@selector(operationQueue:willAddOperation:)]) {
-        [self.delegate operationQueue:self willAddOperation:operation];
+    [batch addObject:operation];
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _queueObserver = [[OPOperationQueueObserver alloc] init];
+    _queueObserver.queue = self;
+
+    pthread_mutex_init(&_executorLock, NULL);
+    pthread_cond_init(&_executorIdleCondition, NULL);
+    _executorOperations = [[NSMutableSet alloc] init];
+    _executorWaitingOperations = [[NSMutableSet alloc] init];
+    _executorObservedOperations = [[NSMutableSet alloc] init];
+    NSMutableArray *lanes = [[NSMutableArray alloc] initWithCapacity:kOPPriorityLaneCount];
+    for (NSUInteger idx = 0; idx < kOPPriorityLaneCount; idx++) {
+        [lanes addObject:[[NSMutableOrderedSet alloc] init]];
+    }
+    _executorHeldLanes = lanes;
+    _executorHeldTimes = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality
+                                               valueOptions:NSPointerFunctionsStrongMemory];
+    _executorRunningOperations = [[NSMutableSet alloc] init];
+    _executor = [OPOperationQueue defaultExecutor];
+
+    pthread_mutex_init(&_capacityLock, NULL);
+    pthread_cond_init(&_deferredSpaceCondition, NULL);
+    atomic_init(&_tracksCapacity, false);
+    _capacityCosts = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality
+                                           valueOptions:NSPointerFunctionsStrongMemory];
+    _deferredOperations = [[NSMutableArray alloc] init];
+
+    NSMutableArray *deduplicationShards = [[NSMutableArray alloc] initWithCapacity:kOPDeduplicationShardCount];
+    for (NSUInteger idx = 0; idx < kOPDeduplicationShardCount; idx++) {
+        [deduplicationShards addObject:[[OPOperationQueueDeduplicationShard alloc] init]];
     }
+    _deduplicationShards = deduplicationShards;
 
-    [super addOperation:operation];
+    return self;
 }
 
-- (void)addOperations:(NSArray *)operations waitUntilFinished:(BOOL)wait
+- (void)dealloc
 {
-    /**
-     *  The base implementation of this method does not call `-addOperation:`,
-     *  so we'll call it ourselves.
-     */
-    for (NSOperation *operation in operations) {
-        [self addOperation:operation];
+    pthread_mutex_destroy(&_executorLock);
+    pthread_cond_destroy(&_executorIdleCondition);
+    pthread_mutex_destroy(&_capacityLock);
+    pthread_cond_destroy(&_deferredSpaceCondition);
+}
+
+@end
+
+
+@implementation OPOperationQueueObserver
+
+- (void)operationDidStart:(OPOperation *)operation
+{
+    // Executing operations no longer count against the queue's capacity.
+    [self.queue releaseCapacityForOperation:operation];
+}
+
+- (void)operation:(OPOperation *)operation didProduceOperation:(NSOperation *)newOperation
+{
+    [self.queue addProducedOperation:newOperation whenAccepted:nil];
+}
+
+- (void)operation:(OPOperation *)operation didProduceOperation:(NSOperation *)newOperation whenAccepted:(void (^)(void))accepted
+{
+    [self.queue addProducedOperation:newOperation whenAccepted:accepted];
+}
+
+- (void)operation:(OPOperation *)operation didFinishWithErrors:(NSArray *)errors
+{
+    [self.queue releaseCapacityForOperation:operation];
+
+    // Release any mutual exclusivity held by the operation.
+    if ([operation exclusivityNode]) {
+        [[OPExclusivityController sharedExclusivityController] removeOperation:operation];
     }
 
-    if (wait) {
-        for (NSOperation *operation in operations) {
-            [operation waitUntilFinished];
-        }
+    // Later submissions with the same key run afresh from here on.
+    if ([operation deduplicationKey] && ![operation deduplicatedOperation]) {
+        [self.queue releaseDeduplicationKeyForOperation:operation];
+    }
+
+    OPOperationQueue *queue = [self queue];
+    if ([queue delegate] && [queue.delegate respondsToSelector:@selector(operationQueue:operationDidFinish:withErrors:)]) {
+        [queue.delegate operationQueue:queue operationDidFinish:operation withErrors:errors];
     }
 }
 
@@ -0,0 +1,113 @@
+// OPPriorityPolicy.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *  Number of priority lanes, one for each `NSOperationQueuePriority`.
+ */
+#define kOPPriorityLaneCount 5
+
+/**
+ *  @return The lane for a queue priority, from 0 for
+ *  `NSOperationQueuePriorityVeryLow` to 4 for `NSOperationQueuePriorityVeryHigh`
+ */
+NSUInteger OPPriorityLaneForQueuePriority(NSOperationQueuePriority priority);
+
+
+/**
+ *  Configures priority scheduling for an `OPOperationQueue` with an executor.
+ *
+ *  Ready operations wait in one lane per `queuePriority` and are started
+ *  highest lane first. To stop lower lanes from starving under sustained
+ *  load, an operation's effective priority rises by one lane for every
+ *  `agingInterval` it has waited, so it eventually overtakes fresher
+ *  higher-priority operations. Operations of equal effective priority start
+ *  in the order they became ready.
+ *
+ *  @see -[OPOperationQueue priorityPolicy]
+ */
+@interface OPPriorityPolicy : NSObject <NSCopying>
+
+/**
+ *  A policy with an aging interval of one second.
+ */
++ (instancetype)defaultPolicy;
+
+/**
+ *  Time an operation must wait to rise by one lane. 0 disables aging, making
+ *  priorities strict.
+ */
+@property (assign, nonatomic) NSTimeInterval agingInterval;
+
+@end
+
+
+/**
+ *  A snapshot of the time operations in one lane spent waiting between
+ *  becoming ready and being started.
+ *
+ *  @see -[OPOperationQueue priorityLaneStatistics]
+ */
+@interface OPPriorityLaneStatistics : NSObject
+
+@property (assign, nonatomic, readonly) NSOperationQueuePriority priority;
+
+/**
+ *  Number of ready operations currently waiting in the lane
+ */
+@property (assign, nonatomic, readonly) NSUInteger waitingCount;
+
+/**
+ *  Number of operations started from the lane
+ */
+@property (assign, nonatomic, readonly) NSUInteger startedCount;
+
+@property (assign, nonatomic, readonly) NSTimeInterval meanWaitTime;
+
+@property (assign, nonatomic, readonly) NSTimeInterval maxWaitTime;
+
+/**
+ *  Approximate median wait time, accurate to within a factor of two
+ */
+@property (assign, nonatomic, readonly) NSTimeInterval medianWaitTime;
+
+/**
+ *  Approximate 99th percentile wait time, accurate to within a factor of two
+ */
+@property (assign, nonatomic, readonly) NSTimeInterval p99WaitTime;
+
+- (instancetype)initWithPriority:(NSOperationQueuePriority)priority
+                    waitingCount:(NSUInteger)waitingCount
+                    startedCount:(NSUInteger)startedCount
+                    meanWaitTime:(NSTimeInterval)meanWaitTime
+                     maxWaitTime:(NSTimeInterval)maxWaitTime
+                  medianWaitTime:(NSTimeInterval)medianWaitTime
+                     p99WaitTime:(NSTimeInterval)p99WaitTime NS_DESIGNATED_INITIALIZER;
+
+/**
+ *  Unused `-init` method.
+ *  @see -initWithPriority:waitingCount:startedCount:meanWaitTime:maxWaitTime:medianWaitTime:p99WaitTime:
+ */
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
@@ -0,0 +1,105 @@
+// OPPriorityPolicy.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPPriorityPolicy.h"
+
+
+NSUInteger OPPriorityLaneForQueuePriority(NSOperationQueuePriority priority)
+{
+    if (priority <= NSOperationQueuePriorityVeryLow) {
+        return 0;
+    } else if (priority <= NSOperationQueuePriorityLow) {
+        return 1;
+    } else if (priority <= NSOperationQueuePriorityNormal) {
+        return 2;
+    } else if (priority <= NSOperationQueuePriorityHigh) {
+        return 3;
+    }
+
+    return 4;
+}
+
+
+@implementation OPPriorityPolicy
+
++ (instancetype)defaultPolicy
+{
+    return [[self alloc] init];
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _agingInterval = 1.0;
+
+    return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    OPPriorityPolicy *policy = [[[self class] allocWithZone:zone] init];
+    policy.agingInterval = self.agingInterval;
+
+    return policy;
+}
+
+@end
+
+
+@implementation OPPriorityLaneStatistics
+
+- (instancetype)initWithPriority:(NSOperationQueuePriority)priority
+                    waitingCount:(NSUInteger)waitingCount
+                    startedCount:(NSUInteger)startedCount
+                    meanWaitTime:(NSTimeInterval)meanWaitTime
+                     maxWaitTime:(NSTimeInterval)maxWaitTime
+                  medianWaitTime:(NSTimeInterval)medianWaitTime
+                     p99WaitTime:(NSTimeInterval)p99WaitTime
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _priority = priority;
+    _waitingCount = waitingCount;
+    _startedCount = startedCount;
+    _meanWaitTime = meanWaitTime;
+    _maxWaitTime = maxWaitTime;
+    _medianWaitTime = medianWaitTime;
+    _p99WaitTime = p99WaitTime;
+
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p priority = %ld, waiting = %lu, started = %lu, mean = %.6f, p50 = %.6f, p99 = %.6f, max = %.6f>",
+            NSStringFromClass([self class]), self, (long)self.priority,
+            (unsigned long)self.waitingCount, (unsigned long)self.startedCount,
+            self.meanWaitTime, self.medianWaitTime, self.p99WaitTime, self.maxWaitTime];
+}
+
+@end
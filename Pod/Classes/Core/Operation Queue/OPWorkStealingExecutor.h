@@ -0,0 +1,74 @@
+// OPWorkStealingExecutor.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *  `OPWorkStealingExecutor` runs operations on a fixed pool of worker threads,
+ *  each with its own double-ended queue of ready operations.
+ *
+ *  A worker takes the most recently scheduled operation from the bottom of its
+ *  own deque, and when that runs dry steals the oldest operation from the top
+ *  of another worker's deque. Operations scheduled from a worker thread (for
+ *  example those produced by a running operation) are pushed onto that
+ *  worker's own deque, keeping related work on the same core.
+ *
+ *  An executor only runs operations that are already ready. Readiness,
+ *  conditions, observers, dependencies and exclusivity are all handled by the
+ *  `OPOperationQueue` using the executor.
+ *
+ *  Worker threads are never torn down, so executors are expected to live for
+ *  the lifetime of the process.
+ *
+ *  @see -[OPOperationQueue executor]
+ */
+@interface OPWorkStealingExecutor : NSObject
+
+/**
+ *  A process wide executor with one worker per active processor.
+ */
++ (OPWorkStealingExecutor *)sharedExecutor;
+
+- (instancetype)initWithWorkerCount:(NSUInteger)workerCount NS_DESIGNATED_INITIALIZER;
+
+/**
+ *  Number of worker threads owned by the executor
+ */
+@property (assign, nonatomic, readonly) NSUInteger workerCount;
+
+/**
+ *  Schedules an operation which is ready to start. When called from one of
+ *  this executor's worker threads, the operation is pushed onto that worker's
+ *  own deque; otherwise operations are spread across the workers.
+ *
+ *  @param operation Operation whose `-isReady` is `YES`
+ */
+- (void)scheduleOperation:(NSOperation *)operation;
+
+/**
+ *  Unused `-init` method.
+ *  @see -initWithWorkerCount:
+ *  @see +sharedExecutor
+ */
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
@@ -0,0 +1,258 @@
+// OPWorkStealingExecutor.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPWorkStealingExecutor.h"
+
+#import <pthread.h>
+#import <stdatomic.h>
+#import <stdlib.h>
+
+
+/**
+ *  Initial capacity of each worker's deque. Must be a power of two.
+ */
+static const NSUInteger kOPWorkStealingDequeInitialCapacity = 256;
+
+
+/**
+ *  A worker thread and its deque of retained, ready operations. The owning
+ *  worker pushes and pops at the tail, thieves take from the head.
+ */
+typedef struct OPWorkStealingWorker {
+    pthread_mutex_t lock;
+    void **items;
+    NSUInteger capacity;
+    NSUInteger head;
+    NSUInteger tail;
+    unsigned int seed;
+    __unsafe_unretained OPWorkStealingExecutor *executor;
+} OPWorkStealingWorker;
+
+
+/**
+ *  The worker running on the current thread, if any.
+ */
+static __thread OPWorkStealingWorker *OPCurrentWorker = NULL;
+
+
+#pragma mark - Deque
+#pragma mark -
+
+static void OPWorkStealingDequePush(OPWorkStealingWorker *worker, void *item)
+{
+    pthread_mutex_lock(&worker->lock);
+
+    if (worker->tail - worker->head == worker->capacity) {
+        NSUInteger capacity = worker->capacity * 2;
+        void **items = malloc(capacity * sizeof(void *));
+        for (NSUInteger idx = worker->head; idx < worker->tail; idx++) {
+            items[idx & (capacity - 1)] = worker->items[idx & (worker->capacity - 1)];
+        }
+        free(worker->items);
+        worker->items = items;
+        worker->capacity = capacity;
+    }
+
+    worker->items[worker->tail & (worker->capacity - 1)] = item;
+    worker->tail++;
+
+    pthread_mutex_unlock(&worker->lock);
+}
+
+static void *OPWorkStealingDequePop(OPWorkStealingWorker *worker)
+{
+    void *item = NULL;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail != worker->head) {
+        worker->tail--;
+        item = worker->items[worker->tail & (worker->capacity - 1)];
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return item;
+}
+
+static void *OPWorkStealingDequeSteal(OPWorkStealingWorker *worker)
+{
+    void *item = NULL;
+
+    // Don't queue up behind the owner; there are other workers to try.
+    if (pthread_mutex_trylock(&worker->lock) != 0) {
+        return NULL;
+    }
+    if (worker->tail != worker->head) {
+        item = worker->items[worker->head & (worker->capacity - 1)];
+        worker->head++;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return item;
+}
+
+
+@interface OPWorkStealingExecutor () {
+    OPWorkStealingWorker *_workers;
+    atomic_ulong _nextWorker;
+    atomic_long _pendingCount;
+    atomic_long _idleCount;
+    pthread_mutex_t _idleLock;
+    pthread_cond_t _idleCondition;
+}
+
+- (void *)nextItemForWorker:(OPWorkStealingWorker *)worker;
+
+@end
+
+
+static void *OPWorkStealingWorkerMain(void *context)
+{
+    OPWorkStealingWorker *worker = context;
+    OPCurrentWorker = worker;
+
+    OPWorkStealingExecutor *executor = worker->executor;
+
+    for (;;) {
+        @autoreleasepool {
+            NSOperation *operation = (__bridge_transfer NSOperation *)[executor nextItemForWorker:worker];
+            [operation start];
+        }
+    }
+
+    return NULL;
+}
+
+
+@implementation OPWorkStealingExecutor
+
+
+#pragma mark - Scheduling
+#pragma mark -
+
+- (void)scheduleOperation:(NSOperation *)operation
+{
+    OPWorkStealingWorker *worker = OPCurrentWorker;
+
+    if (!worker || worker->executor != self) {
+        NSUInteger idx = atomic_fetch_add_explicit(&_nextWorker, 1, memory_order_relaxed) % _workerCount;
+        worker = &_workers[idx];
+    }
+
+    atomic_fetch_add(&_pendingCount, 1);
+
+    OPWorkStealingDequePush(worker, (__bridge_retained void *)operation);
+
+    if (atomic_load(&_idleCount) > 0) {
+        pthread_mutex_lock(&_idleLock);
+        pthread_cond_signal(&_idleCondition);
+        pthread_mutex_unlock(&_idleLock);
+    }
+}
+
+- (void *)nextItemForWorker:(OPWorkStealingWorker *)worker
+{
+    for (;;) {
+        void *item = OPWorkStealingDequePop(worker);
+
+        if (!item) {
+            NSUInteger start = (NSUInteger)rand_r(&worker->seed);
+            for (NSUInteger offset = 0; offset < _workerCount && !item; offset++) {
+                OPWorkStealingWorker *victim = &_workers[(start + offset) % _workerCount];
+                if (victim != worker) {
+                    item = OPWorkStealingDequeSteal(victim);
+                }
+            }
+        }
+
+        if (item) {
+            atomic_fetch_sub(&_pendingCount, 1);
+            return item;
+        }
+
+        // Nothing to run or steal; sleep until something is scheduled.
+        pthread_mutex_lock(&_idleLock);
+        atomic_fetch_add(&_idleCount, 1);
+        while (atomic_load(&_pendingCount) == 0) {
+            pthread_cond_wait(&_idleCondition, &_idleLock);
+        }
+        atomic_fetch_sub(&_idleCount, 1);
+        pthread_mutex_unlock(&_idleLock);
+    }
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
++ (OPWorkStealingExecutor *)sharedExecutor
+{
+    static OPWorkStealingExecutor *_sharedInstance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedInstance = [[OPWorkStealingExecutor alloc] initWithWorkerCount:[[NSProcessInfo processInfo] activeProcessorCount]];
+    });
+
+    return _sharedInstance;
+}
+
+- (instancetype)initWithWorkerCount:(NSUInteger)workerCount
+{
+    NSParameterAssert(workerCount > 0);
+
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _workerCount = workerCount;
+    _workers = calloc(workerCount, sizeof(OPWorkStealingWorker));
+
+    atomic_init(&_nextWorker, 0);
+    atomic_init(&_pendingCount, 0);
+    atomic_init(&_idleCount, 0);
+    pthread_mutex_init(&_idleLock, NULL);
+    pthread_cond_init(&_idleCondition, NULL);
+
+    for (NSUInteger idx = 0; idx < workerCount; idx++) {
+        OPWorkStealingWorker *worker = &_workers[idx];
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->capacity = kOPWorkStealingDequeInitialCapacity;
+        worker->items = malloc(worker->capacity * sizeof(void *));
+        worker->seed = (unsigned int)idx;
+        worker->executor = self;
+    }
+
+    // Worker threads run for the life of the process, so they keep us alive.
+    for (NSUInteger idx = 0; idx < workerCount; idx++) {
+        CFBridgingRetain(self);
+
+        pthread_t thread;
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        pthread_create(&thread, &attributes, OPWorkStealingWorkerMain, &_workers[idx]);
+        pthread_attr_destroy(&attributes);
+    }
+
+    return self;
+}
+
+@end
@@ -20,9 +20,15 @@
 // THE SOFTWARE.
 
 #import "OPDelayOperation.h"
+#import "OPTimerWheel.h"
 
 
-@interface OPDelayOperation ()
+@interface OPDelayOperation () <OPTimerWheelTarget> {
+    /**
+     *  Armed on the shared timer wheel while the delay is running.
+     */
+    OPTimerWheelEntry _delayEntry;
+}
 
 @property (assign, nonatomic) NSTimeInterval delay;
 
@@ -42,24 +48,31 @@
         return;
     }
 
-    dispatch_time_t when = dispatch_time(DISPATCH_TIME_NOW, (int64_t)([self delay] * NSEC_PER_SEC));
-
-    dispatch_after(when, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
-        // If we were cancelled, then -finish has already been called.
-        if (![self isCancelled]) {
-            [self finish];
-        }
-    });
+    [[OPTimerWheel sharedTimerWheel] armEntry:&_delayEntry timeout:[self delay] target:self];
 }
 
 - (void)cancel
 {
     [super cancel];
     // Cancelling the operation means we don't want to wait anymore.
+    [[OPTimerWheel sharedTimerWheel] cancelEntry:&_delayEntry];
     [self finish];
 }
 
 
+#pragma mark - OPTimerWheelTarget
+#pragma mark -
+
+- (void)timerWheelEntryDidExpire:(OPTimerWheelEntry *)entry
+{
+    // A cancelled token doesn't call -cancel, so the delay may still be
+    // running even though the operation reports that it was cancelled.
+    if (![self isFinished]) {
+        [self finish];
+    }
+}
+
+
 #pragma mark - Lifecycle
 #pragma mark -
 
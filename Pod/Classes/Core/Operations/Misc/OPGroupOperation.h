@@ -21,6 +21,8 @@
 
 #import "OPOperation.h"
 
+@class OPWorkStealingExecutor;
+
 
 /**
  *  A subclass of `OPOperation` that executes zero or more operations as part
@@ -35,6 +37,12 @@
  *  (still within the outer `OPGroupOperation`) that will all be executed before
  *  the rest of the operations in the initial chain of operations.
  *
+ *  Cancelling a group cancels its `cancellationToken`, which every
+ *  `OPOperation` within it, including those in nested groups, shares or
+ *  descends from. Children yet to start notice as they next check, rather
+ *  than having cancellation delivered to each up front; children already
+ *  executing are sent `-cancel`.
+ *
  *  - returns: An instance of `OPGroupOperation
  */
 @interface OPGroupOperation : OPOperation
@@ -50,6 +58,30 @@
  */
 - (instancetype)initWithOperations:(NSArray *)operations NS_DESIGNATED_INITIALIZER;
 
+/**
+ *  When enabled, groups created afterwards run their operations on an
+ *  `OPWorkStealingExecutor` rather than on threads of their own. A group
+ *  added to an `OPOperationQueue` which uses an executor shares that queue's
+ *  executor, so nested groups all share their outermost queue's threads.
+ *  Otherwise, the group uses `+[OPOperationQueue defaultExecutor]`, or failing
+ *  that, `+[OPWorkStealingExecutor sharedExecutor]`.
+ *
+ *  Suspension until the group executes, cancellation and error aggregation
+ *  are unaffected. Disabled by default.
+ *
+ *  @param sharesExecutor Whether new groups should share an executor
+ */
++ (void)setSharesExecutor:(BOOL)sharesExecutor;
+
++ (BOOL)sharesExecutor;
+
+/**
+ *  The maximum number of the group's operations that may execute at once.
+ *  Defaults to `NSOperationQueueDefaultMaxConcurrentOperationCount`, which
+ *  imposes no limit.
+ */
+@property (assign, nonatomic) NSInteger maxConcurrentOperationCount;
+
 /**
  *  Adds an operation to the group after instantiation
  *
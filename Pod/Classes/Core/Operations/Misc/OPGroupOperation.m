@@ -20,7 +20,18 @@
 // THE SOFTWARE.
 
 #import "OPGroupOperation.h"
+#import "OPOperation+Private.h"
 #import "OPOperationQueue.h"
+#import "OPWorkStealingExecutor.h"
+#import "OPErrorAccumulator.h"
+#import "OPCancellationToken.h"
+#import "OPOperationObserver.h"
+
+#import <pthread.h>
+#import <stdatomic.h>
+
+
+static BOOL OPGroupOperationSharesExecutor = NO;
 
 
 @interface OPGroupOperation() <OPOperationQueueDelegate>
@@ -32,15 +43,125 @@
  */
 - (void)commonInit;
 
+/**
+ *  Called once for each child that finishes, and once when the group begins
+ *  executing. Finishes the group when nothing is left outstanding.
+ */
+- (void)releaseOutstanding;
+
 @property (strong, nonatomic) OPOperationQueue *internalQueue;
-@property (strong, nonatomic) NSBlockOperation *finishingOperation;
 
-@property (strong, nonatomic) NSMutableArray *aggregatedErrors;
+@property (strong, nonatomic) OPErrorAccumulator *aggregatedErrors;
 
 @end
 
 
-@implementation OPGroupOperation
+/**
+ *  Registered as a dependent of each `OPOperation` child, so that a child
+ *  only stops counting against the group once it has entered the Finished
+ *  state, rather than as its observers are told it is finishing.
+ *
+ *  Also observes each child, to know which are executing. Those have
+ *  already checked the group's token, so cancelling the group has to tell
+ *  them directly.
+ */
+@interface OPGroupOperationChildTracker : NSObject <OPOperationDependent, OPOperationObserver>
+
+@property (weak, nonatomic) OPGroupOperation *group;
+
+/**
+ *  Sends `-cancel` to every child which is currently executing.
+ */
+- (void)cancelExecutingChildren;
+
+@end
+
+@implementation OPGroupOperationChildTracker {
+    pthread_mutex_t _lock;
+    NSHashTable *_executingChildren;
+}
+
+- (void)cancelExecutingChildren
+{
+    pthread_mutex_lock(&_lock);
+    NSArray *children = [_executingChildren allObjects];
+    pthread_mutex_unlock(&_lock);
+
+    for (OPOperation *child in children) {
+        [child cancel];
+    }
+}
+
+- (void)dependencyDidFinish:(OPOperation *)dependency
+{
+    pthread_mutex_lock(&_lock);
+    [_executingChildren removeObject:dependency];
+    pthread_mutex_unlock(&_lock);
+
+    [self.group releaseOutstanding];
+}
+
+- (void)operationDidStart:(OPOperation *)operation
+{
+    pthread_mutex_lock(&_lock);
+    [_executingChildren addObject:operation];
+    pthread_mutex_unlock(&_lock);
+
+    // The group's token may have been cancelled after the child checked it
+    // but before the child was recorded above, in which case
+    // `-cancelExecutingChildren` didn't see it.
+    if ([operation isCancelled]) {
+        [operation cancel];
+    }
+}
+
+- (void)operation:(OPOperation *)operation didProduceOperation:(NSOperation *)newOperation
+{
+    // No-op
+}
+
+- (void)operation:(OPOperation *)operation didFinishWithErrors:(NSArray *)errors
+{
+    // No-op
+    // Children are forgotten once they reach the Finished state.
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    pthread_mutex_init(&_lock, NULL);
+    _executingChildren = [[NSHashTable alloc] initWithOptions:(NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality) capacity:0];
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+@end
+
+
+@implementation OPGroupOperation {
+    /**
+     *  Number of children which have not yet finished, plus one held until
+     *  the group begins executing so the group can't finish before then.
+     */
+    atomic_long _outstanding;
+
+    /**
+     *  Set once a child which can't observe the group's cancellation token
+     *  has been added, so cancelling has to visit the children after all.
+     */
+    atomic_bool _hasUntokenedChildren;
+
+    OPGroupOperationChildTracker *_childTracker;
+}
 
 #pragma mark - Debugging
 #pragma mark -
@@ -76,9 +197,19 @@
     [self.internalQueue addOperations:operations waitUntilFinished:NO];
 }
 
+- (NSInteger)maxConcurrentOperationCount
+{
+    return [self.internalQueue maxConcurrentOperationCount];
+}
+
+- (void)setMaxConcurrentOperationCount:(NSInteger)maxConcurrentOperationCount
+{
+    [self.internalQueue setMaxConcurrentOperationCount:maxConcurrentOperationCount];
+}
+
 - (void)aggregateError:(NSError *)error
 {
-    [self.aggregatedErrors addObject:error];
+    [self.aggregatedErrors addError:error];
 }
 
 - (void)operationDidFinish:(NSOperation *)operation withErrors:(NSArray *)errors
@@ -93,38 +224,86 @@
 
 - (void)cancel
 {
-    [self.internalQueue cancelAllOperations];
+    /**
+     *  Every `OPOperation` within the group sees the group's token, however
+     *  deeply nested, so cancelling it reaches those yet to start without
+     *  visiting any. Executing children, such as a delay or a URL session
+     *  task, are told directly so they can stop early, and nested groups
+     *  pass it on to their own. Plain `NSOperation`s still have to be told
+     *  one by one.
+     */
+    [self.cancellationToken cancel];
+    [_childTracker cancelExecutingChildren];
+
+    if (atomic_load_explicit(&_hasUntokenedChildren, memory_order_acquire)) {
+        [self.internalQueue cancelAllOperations];
+    }
+
     [super cancel];
 }
 
 - (void)execute
 {
+    // Nothing has been handed to the executor while suspended, so children
+    // can still move to the executor of the queue running the group.
+    id scheduler = [self scheduler];
+    if ([self.internalQueue executor] && [scheduler isKindOfClass:[OPOperationQueue class]]) {
+        OPWorkStealingExecutor *executor = [(OPOperationQueue *)scheduler executor];
+        if (executor) {
+            [self.internalQueue setExecutor:executor];
+        }
+    }
+
     [self.internalQueue setSuspended:NO];
-    [self.internalQueue addOperation:self.finishingOperation];
+    [self releaseOutstanding];
+}
+
+
+#pragma mark - Shared Executor
+#pragma mark -
+
++ (void)setSharesExecutor:(BOOL)sharesExecutor
+{
+    @synchronized(self) {
+        OPGroupOperationSharesExecutor = sharesExecutor;
+    }
+}
+
++ (BOOL)sharesExecutor
+{
+    @synchronized(self) {
+        return OPGroupOperationSharesExecutor;
+    }
 }
 
 
 #pragma mark - OPOperationQueueDelegate
 #pragma mark -
 
-- (void)operationQueue:(OPOperationQueue *)operationQueue willAddOperation:(NSOperation *)operation
+- (void)operationQueue:(OPOperationQueue *)operationQueue willAddOperations:(NSArray *)operations
 {
-    NSAssert(![self.finishingOperation isFinished] && ![self.finishingOperation isExecuting], @"Cannot add new operations to a group after the group has completed");
+    // Counted before any child can be released.
+    long outstanding = atomic_load_explicit(&_outstanding, memory_order_relaxed);
+    do {
+        NSAssert(outstanding > 0, @"Cannot add new operations to a group after the group has completed");
+    } while (!atomic_compare_exchange_weak_explicit(&_outstanding, &outstanding, outstanding + (long)[operations count], memory_order_relaxed, memory_order_relaxed));
 
-    if ([self finishingOperation] != operation) {
-        [self.finishingOperation addDependency:operation];
+    OPCancellationToken *token = [self cancellationToken];
+    for (NSOperation *operation in operations) {
+        [self adoptOperation:operation token:token];
     }
 }
 
 - (void)operationQueue:(OPOperationQueue *)operationQueue operationDidFinish:(NSOperation *)operation withErrors:(NSArray *)errors
 {
-    [self.aggregatedErrors addObjectsFromArray:errors];
-
-    if ([self finishingOperation] == operation) {
-        [self.internalQueue setSuspended:YES];
-        [self finishWithErrors:[self aggregatedErrors]];
-    } else {
-        [self operationDidFinish:operation withErrors:errors];
+    [self.aggregatedErrors addErrors:errors];
+    [self operationDidFinish:operation withErrors:errors];
+
+    // `OPOperation`s are still finishing here, and are released through
+    // the child tracker once finished. Plain `NSOperation`s report from
+    // their completion block, once already finished.
+    if (![operation isKindOfClass:[OPOperation class]]) {
+        [self releaseOutstanding];
     }
 }
 
@@ -153,9 +332,7 @@
     
     [self commonInit];
     
-    for (NSOperation *operation in operations) {
-        [_internalQueue addOperation:operation];
-    }
+    [_internalQueue addOperations:operations waitUntilFinished:NO];
     
     return self;
 }
@@ -169,12 +346,66 @@
     OPOperationQueue *queue = [[OPOperationQueue alloc] init];
     [queue setSuspended:YES];
     [queue setDelegate:self];
+
+    if ([OPGroupOperation sharesExecutor] && ![queue executor]) {
+        [queue setExecutor:[OPWorkStealingExecutor sharedExecutor]];
+    }
     
     _internalQueue = queue;
     
-    _finishingOperation = [NSBlockOperation blockOperationWithBlock:^{}];
-    
-    _aggregatedErrors = [[NSMutableArray alloc] init];
+    _aggregatedErrors = [[OPErrorAccumulator alloc] init];
+
+    // The group's children are cancelled through this token.
+    [self setCancellationToken:[[OPCancellationToken alloc] init]];
+
+    atomic_init(&_outstanding, 1);
+    atomic_init(&_hasUntokenedChildren, false);
+
+    _childTracker = [[OPGroupOperationChildTracker alloc] init];
+    _childTracker.group = self;
+}
+
+/**
+ *  Children without a token share the group's. A child with a token of its
+ *  own which has no parent, such as a nested group's, is attached beneath
+ *  the group's token so the group's cancellation reaches its subtree too.
+ *
+ *  `OPOperation` children are also registered with, and observed by, the
+ *  child tracker.
+ */
+- (void)adoptOperation:(NSOperation *)operation token:(OPCancellationToken *)token
+{
+    if (![operation isKindOfClass:[OPOperation class]]) {
+        atomic_store_explicit(&_hasUntokenedChildren, true, memory_order_release);
+        return;
+    }
+
+    OPOperation *child = (OPOperation *)operation;
+    OPCancellationToken *childToken = [child cancellationToken];
+
+    if (!childToken) {
+        [child setCancellationToken:token];
+    } else if (childToken != token && ![childToken parent]) {
+        [childToken attachToParent:token];
+    }
+
+    if (![child addDependent:_childTracker]) {
+        // Already finished.
+        [self releaseOutstanding];
+        return;
+    }
+
+    [child addObserver:_childTracker];
+}
+
+- (void)releaseOutstanding
+{
+    // Children produced by a child are added before it finishes, so the
+    // count can't reach zero while work is still being added.
+    if (atomic_fetch_sub_explicit(&_outstanding, 1, memory_order_acq_rel) == 1) {
+        [self.internalQueue setSuspended:YES];
+        [self finishWithErrors:[self.aggregatedErrors errors]];
+    }
 }
 
 @end
@@ -0,0 +1,78 @@
+// OPURLSessionStreamOperation.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPOperation.h"
+
+@class OPStreamChannel;
+
+
+/**
+ *  `OPURLSessionStreamOperation` is an `OPOperation` that downloads the body
+ *  of a request into an `OPStreamChannel`, so that other operations can
+ *  consume it while it is still arriving.
+ *
+ *  Unlike `OPURLSessionTaskOperation`, the operation runs its own
+ *  `NSURLSession` and follows the task through the session's delegate
+ *  callbacks. Whenever the channel fills up, the task is suspended until the
+ *  consumer has made room, so memory use is bounded by the channel's
+ *  capacity however large the body is.
+ *
+ *  The channel is closed when the task completes, with the task's error if
+ *  it failed. The operation finishes at the same time, though the consumer
+ *  may still be receiving buffered chunks. Consumers must not depend on
+ *  this operation, or they won't start until the body has been buffered in
+ *  full, which a bounded channel never allows. A consumer which stops early
+ *  calls `-[OPStreamChannel stopReceiving]`, which cancels the download.
+ *
+ *  - returns: An instance of an `OPURLSessionStreamOperation`
+ */
+@interface OPURLSessionStreamOperation : OPOperation
+
+/**
+ *  @param request       The request to perform
+ *  @param configuration Configuration for the operation's session, or `nil`
+ *                       for `+[NSURLSessionConfiguration defaultSessionConfiguration]`
+ *  @param capacity      Number of bytes the channel may buffer before the
+ *                       download is paused
+ */
+- (instancetype)initWithRequest:(NSURLRequest *)request
+                  configuration:(NSURLSessionConfiguration *)configuration
+                channelCapacity:(NSUInteger)capacity NS_DESIGNATED_INITIALIZER;
+
+/**
+ *  Unused `-init` method.
+ *  @see -initWithRequest:configuration:channelCapacity:
+ */
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (strong, nonatomic, readonly) NSURLRequest *request;
+
+/**
+ *  The channel the body is delivered into.
+ */
+@property (strong, nonatomic, readonly) OPStreamChannel *channel;
+
+/**
+ *  The response, once it has been received.
+ */
+@property (strong, atomic, readonly) NSURLResponse *response;
+
+@end
@@ -0,0 +1,157 @@
+// OPURLSessionStreamOperation.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPURLSessionStreamOperation.h"
+#import "OPStreamChannel.h"
+
+
+@interface OPURLSessionStreamOperation () <NSURLSessionDataDelegate>
+
+@property (strong, nonatomic) NSURLSessionConfiguration *configuration;
+
+@property (strong, atomic) NSURLSession *session;
+
+@property (strong, atomic) NSURLSessionDataTask *task;
+
+@property (strong, atomic, readwrite) NSURLResponse *response;
+
+@end
+
+
+@implementation OPURLSessionStreamOperation
+
+
+#pragma mark - Overrides
+#pragma mark -
+
+- (void)execute
+{
+    /**
+     *  Delegate callbacks are delivered one at a time on a private queue,
+     *  so chunks reach the channel in order.
+     */
+    NSOperationQueue *delegateQueue = [[NSOperationQueue alloc] init];
+    [delegateQueue setMaxConcurrentOperationCount:1];
+
+    NSURLSession *session = [NSURLSession sessionWithConfiguration:[self configuration]
+                                                          delegate:self
+                                                     delegateQueue:delegateQueue];
+    NSURLSessionDataTask *task = [session dataTaskWithRequest:[self request]];
+
+    self.session = session;
+    self.task = task;
+
+    // Resume the download once the consumer has made room again.
+    __weak NSURLSessionDataTask *weakTask = task;
+    [self.channel setSpaceAvailableHandler:^{
+        [weakTask resume];
+    }];
+
+    // Nobody is left to read the rest of the body.
+    __weak __typeof(self) weakSelf = self;
+    [self.channel setStoppedReceivingHandler:^{
+        [weakSelf cancel];
+    }];
+
+    if ([self.channel isClosed]) {
+        // The consumer stopped before the download began.
+        [session invalidateAndCancel];
+        self.session = nil;
+        [self cancel];
+        return;
+    }
+
+    [task resume];
+}
+
+- (void)cancel
+{
+    [self.task cancel];
+    [super cancel];
+}
+
+- (void)finishedWithErrors:(NSArray *)errors
+{
+    /**
+     *  The task usually closes the channel as it completes, but an operation
+     *  cancelled before or during the download finishes first, and the
+     *  consumer still has to be told the stream ended early.
+     */
+    NSError *error = [errors firstObject];
+    if (!error && [self isCancelled]) {
+        error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+    }
+
+    [self.channel closeWithError:error];
+}
+
+
+#pragma mark - NSURLSessionDataDelegate
+#pragma mark -
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition))completionHandler
+{
+    self.response = response;
+    completionHandler(NSURLSessionResponseAllow);
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data
+{
+    // Stop reading until the consumer has caught up. Suspended under the
+    // channel's lock, so the consumer can't resume the task first.
+    [self.channel sendData:data pauseHandler:^{
+        [dataTask suspend];
+    }];
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error
+{
+    [self.channel setSpaceAvailableHandler:nil];
+    [self.channel closeWithError:error];
+
+    // The session retains its delegate until it is invalidated.
+    [session finishTasksAndInvalidate];
+    self.session = nil;
+
+    [self finishWithError:error];
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
+- (instancetype)initWithRequest:(NSURLRequest *)request
+                  configuration:(NSURLSessionConfiguration *)configuration
+                channelCapacity:(NSUInteger)capacity
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _request = [request copy];
+    _configuration = configuration ?: [NSURLSessionConfiguration defaultSessionConfiguration];
+    _channel = [[OPStreamChannel alloc] initWithCapacity:capacity];
+
+    return self;
+}
+
+@end
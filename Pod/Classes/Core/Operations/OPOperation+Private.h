@@ -0,0 +1,152 @@
+// OPOperation+Private.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPOperation.h"
+
+
+/**
+ *  Implemented by schedulers which run operations themselves, rather than
+ *  handing them to `NSOperationQueue`, and so need to be told when an
+ *  operation they scheduled is done.
+ */
+@protocol OPOperationScheduler <NSObject>
+
+/**
+ *  Invoked once the operation has transitioned to its Finished state.
+ */
+- (void)operationDidFinish:(OPOperation *)operation;
+
+@end
+
+
+/**
+ *  Implemented by observers which can defer the operations produced by an
+ *  operation, and so need to say when each has been accepted.
+ */
+@protocol OPOperationProductionObserver <OPOperationObserver>
+
+/**
+ *  Invoked instead of `-operation:didProduceOperation:`. The observer must
+ *  call `accepted`, if it isn't `nil`, once `newOperation` has been added.
+ */
+- (void)operation:(OPOperation *)operation didProduceOperation:(NSOperation *)newOperation whenAccepted:(void (^)(void))accepted;
+
+@end
+
+
+/**
+ *  Implemented by objects registered with `-addDependent:`, to be told once
+ *  an operation has entered `OPOperationStateFinished`. `OPOperation`s are
+ *  registered this way with each `OPOperation` they depend on.
+ */
+@protocol OPOperationDependent <NSObject>
+
+- (void)dependencyDidFinish:(OPOperation *)dependency;
+
+@end
+
+
+/**
+ *  Internal interface shared between `OPOperation` and the other classes of
+ *  `Operative` that need to cooperate with it. Not intended for use by
+ *  clients of the library.
+ */
+@interface OPOperation () <OPOperationDependent>
+
+/**
+ *  The first node linking this operation into the per-category lists kept
+ *  by `OPExclusivityController`. Additional categories are chained from
+ *  this node, so no extra storage is needed on the operation itself.
+ *
+ *  @see OPExclusivityController
+ */
+@property (strong, nonatomic) id exclusivityNode;
+
+/**
+ *  The scheduler running this operation, if it isn't being run by
+ *  `NSOperationQueue`. Schedulers must keep themselves alive until every
+ *  operation they are running has finished.
+ */
+@property (unsafe_unretained, nonatomic) id <OPOperationScheduler> scheduler;
+
+/**
+ *  The in-flight operation with the same `deduplicationKey` that this one
+ *  was attached to by its queue. The receiver depends on it, skips its own
+ *  conditions and `-execute`, and finishes with its errors.
+ */
+@property (strong, nonatomic) OPOperation *deduplicatedOperation;
+
+/**
+ *  The errors the operation finished with, set before its observers are
+ *  told it finished.
+ */
+@property (strong, nonatomic, readonly) NSArray *finishedErrors;
+
+/**
+ *  Identifies the operation in traces. Unlike its address, never reused by
+ *  a later operation.
+ */
+@property (assign, nonatomic, readonly) uint64_t traceID;
+
+/**
+ *  Registers `dependent` to be told when the receiver has finished.
+ *
+ *  @return `NO` if the receiver has already finished, in which case the
+ *  dependent will never be told.
+ */
+- (BOOL)addDependent:(id <OPOperationDependent>)dependent;
+
+/**
+ *  @return `YES` if `dependent` was still waiting for the receiver to finish
+ */
+- (BOOL)removeDependent:(id <OPOperationDependent>)dependent;
+
+/**
+ *  Called once for each dependency as it finishes. When the last unfinished
+ *  dependency finishes, condition evaluation begins.
+ */
+- (void)dependencyDidFinish;
+
+/**
+ *  Holds the operation back until `-dependencyDidFinish` has been called
+ *  `count` more times, without recording what it is waiting for. Lets
+ *  `OPOperationGraph` drive readiness from its own edge lists. Must be
+ *  called before the operation is added to a queue.
+ */
+- (void)addUntrackedDependencyCount:(NSUInteger)count;
+
+/**
+ *  Searches every dependency reachable from `operations`, including those
+ *  on plain `NSOperation`s, for a cycle. Unlike the check made as each
+ *  dependency is added, this visits the whole reachable graph.
+ *
+ *  @return The operations on the first cycle found, each of which must
+ *  finish before the next, or `nil` if there is none
+ */
++ (NSArray *)dependencyCycleReachableFromOperations:(NSArray *)operations;
+
+/**
+ *  An error with the `OPOperationErrorCodeDependencyCycle` code, naming
+ *  the operations on `cycle`.
+ */
++ (NSError *)dependencyCycleErrorWithOperations:(NSArray *)cycle;
+
+@end
@@ -23,6 +23,7 @@
 
 @protocol OPOperationObserver;
 @protocol OPOperationCondition;
+@class OPCancellationToken;
 
 
 /**
@@ -47,12 +48,48 @@
  *  protocol. Before execution of the operation, conditions will be
  *  checked and if met the operation will execute as normal.
  *
- *  Array should not be manipulated directly.
+ *  Array should not be manipulated directly. `nil` until the first
+ *  condition is added.
  *
  *  @see -addCondition:
  */
 @property (strong, nonatomic, readonly) NSMutableArray *conditions;
 
+/**
+ *  When set, the operation is also considered cancelled once the token, or
+ *  any of its ancestors, is cancelled. Cancellation through the token isn't
+ *  announced: the operation notices when it next checks `isCancelled`, and
+ *  skips evaluating its conditions if it hasn't yet begun.
+ *
+ *  An `OPGroupOperation` sets this on operations added to it which don't
+ *  already have a token.
+ */
+@property (strong, atomic) OPCancellationToken *cancellationToken;
+
+/**
+ *  Identifies the logical work the operation performs, e.g. refreshing a
+ *  particular user's profile. While an operation with the same key is in
+ *  flight on an `OPOperationQueue`, adding this one to that queue attaches
+ *  it to the earlier operation: it won't execute, and instead finishes with
+ *  the earlier operation's result and errors once that operation finishes.
+ *
+ *  Must not be changed once the operation has been added to a queue.
+ */
+@property (copy, nonatomic) NSString *deduplicationKey;
+
+/**
+ *  The object the operation finished with, if any. Set once, before the
+ *  operation's observers are told it finished, and never changed until
+ *  taken with `-takeResult`. Reading it takes no lock, so dependents can
+ *  read it once they begin executing.
+ *
+ *  The result is held by reference, so large objects such as `NSData` are
+ *  handed on without being copied.
+ *
+ *  @see -finishWithResult:errors:
+ */
+@property (strong, atomic, readonly) id result;
+
 
 ///---------------------------------------------
 /// @name Conditions, Observers and Dependencies
@@ -90,6 +127,22 @@
 
 - (void)produceOperation:(NSOperation *)operation;
 
+/**
+ *  Produces an operation, and calls `accepted` once it has actually been
+ *  added to the queue running this operation.
+ *
+ *  A queue with a `capacity` defers produced operations while it is full.
+ *  Producers which create many operations can wait for `accepted` before
+ *  producing the next, so that production is suspended, rather than a
+ *  thread blocked, until the queue has room.
+ *
+ *  @param operation The operation to produce
+ *  @param accepted  Called once the operation has been added to a queue,
+ *                   possibly on another thread. Called immediately if the
+ *                   operation isn't being run by an `OPOperationQueue`.
+ */
+- (void)produceOperation:(NSOperation *)operation whenAccepted:(void (^)(void))accepted;
+
 /*
  *  This is a convenience method to simplify calling the actual
  *  -finishWithErrors: method, when an error isn't present
@@ -119,6 +172,40 @@
  */
 - (void)finishWithErrors:(NSArray *)errors;
 
+/**
+ *  Finishes the operation as `-finishWithErrors:` does, first setting its
+ *  `result`. Should the operation already be finishing, e.g. because it
+ *  was cancelled, the result is discarded.
+ *
+ *  Once finished, and once any thread still producing operations or
+ *  starting the operation is done with them, the operation releases its
+ *  observers and conditions, so subclasses which release their own state
+ *  in `-finishedWithErrors:` hold on to little more than their result.
+ */
+- (void)finishWithResult:(id)result errors:(NSArray *)errors;
+
+/**
+ *  Convenience for `-finishWithResult:errors:` without errors.
+ */
+- (void)finishWithResult:(id)result;
+
+/**
+ *  Transfers ownership of the operation's `result` to the caller, leaving
+ *  `nil` in its place. Only the first caller receives the result, so a
+ *  single consumer can take it without anyone else holding a reference.
+ *
+ *  `result` hands out the object without retaining it first, so the result
+ *  may only be taken once every other reader is done with the operation,
+ *  e.g. by its only dependent. Concurrent calls to `-takeResult` are safe.
+ */
+- (id)takeResult;
+
+/**
+ *  The `result` of the first of the receiver's dependencies whose result
+ *  is a kind of `resultClass`, or `nil` if there is none.
+ */
+- (id)dependencyResultOfClass:(Class)resultClass;
+
 /*
  *  Subclasses may override -finishedWithErrors: if they wish to react to the operation
  *  finishing with errors.
@@ -20,9 +20,71 @@
 // THE SOFTWARE.
 
 #import "OPOperation.h"
+#import "OPOperation+Private.h"
 #import "OPOperationCondition.h"
 #import "OPOperationConditionEvaluator.h"
 #import "OPOperationObserver.h"
+#import "OPTrace+Private.h"
+#import "OPErrorAccumulator.h"
+#import "OPCancellationToken.h"
+#import "NSError+Operative.h"
+
+#import <objc/runtime.h>
+#import <pthread.h>
+#import <sched.h>
+#import <stdatomic.h>
+
+
+static void * OPOperationDependencyKVOContext = &OPOperationDependencyKVOContext;
+
+/**
+ *  Serializes searches and reorders of the dependency graph between
+ *  `OPOperation`s, and guards each operation's visit marks and the
+ *  buffers below. Edges which already respect the topological order are
+ *  added without it.
+ */
+static pthread_mutex_t OPOperationGraphLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t OPOperationGraphEpoch = 0;
+static atomic_uint_fast64_t OPOperationNextTopologicalIndex = 0;
+
+/**
+ *  Odd while the graph is being searched or reordered. An edge added
+ *  without `OPOperationGraphLock` is checked again under the lock if this
+ *  changed while it was being added, as the search may not have seen it.
+ */
+static atomic_uint_fast64_t OPOperationGraphSequence = 0;
+
+/**
+ *  A growable array of operations, reused between searches so that a
+ *  search allocates nothing once the buffers are large enough.
+ */
+typedef struct {
+    __unsafe_unretained OPOperation **operations;
+    NSUInteger count;
+    NSUInteger capacity;
+} OPOperationGraphBuffer;
+
+static OPOperationGraphBuffer OPOperationGraphStack;
+static OPOperationGraphBuffer OPOperationGraphForward;
+static OPOperationGraphBuffer OPOperationGraphBackward;
+static uint64_t *OPOperationGraphIndexPool = NULL;
+static NSUInteger OPOperationGraphIndexPoolCapacity = 0;
+
+static inline void OPOperationGraphBufferPush(OPOperationGraphBuffer *buffer, OPOperation *operation)
+{
+    if (buffer->count == buffer->capacity) {
+        buffer->capacity = MAX(buffer->capacity * 2, (NSUInteger)64);
+        buffer->operations = (__unsafe_unretained OPOperation **)realloc(buffer->operations, buffer->capacity * sizeof(OPOperation *));
+    }
+    buffer->operations[buffer->count++] = operation;
+}
+
+static int OPOperationGraphCompareIndices(const void *a, const void *b)
+{
+    uint64_t left = *(const uint64_t *)a;
+    uint64_t right = *(const uint64_t *)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
 
 
 typedef NS_ENUM(NSUInteger, OPOperationState) {
@@ -59,41 +121,262 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
 };
 
 
+/**
+ *  Number of observers stored inline in each `OPOperation` before further
+ *  observers spill over into a heap allocated array. Operations added to an
+ *  `OPOperationQueue` always have at least the queue's own observer.
+ */
+#define kOPOperationInlineObserverCapacity 4
+
+/**
+ *  Set in an operation's count of notifiers once it has finished, after
+ *  which its observers and conditions are released as the last notifier
+ *  still reading them is done.
+ */
+static const NSUInteger kOPOperationNotifiersDraining = (NSUInteger)1 << (sizeof(NSUInteger) * 8 - 1);
+
+
+/**
+ *  Returns whether an `OPOperation` may move from one state to another.
+ *
+ *  States only ever move forward one step at a time, with the exception of
+ *  `OPOperationStateFinishing`, which may be entered from any earlier state
+ *  so that cancelled operations can finish without executing.
+ */
+static inline BOOL OPOperationStateTransitionIsValid(OPOperationState fromState, OPOperationState toState)
+{
+    switch (toState) {
+        case OPOperationStateInitialized:
+            return NO;
+
+        case OPOperationStateFinishing:
+            return fromState < OPOperationStateFinishing;
+
+        default:
+            return toState == fromState + 1;
+    }
+}
+
+static const char *OPOperationStateName(OPOperationState state)
+{
+    switch (state) {
+        case OPOperationStateInitialized:
+            return "Initialized";
+        case OPOperationStatePending:
+            return "Pending";
+        case OPOperationStateEvaluatingConditions:
+            return "EvaluatingConditions";
+        case OPOperationStateReady:
+            return "Ready";
+        case OPOperationStateExecuting:
+            return "Executing";
+        case OPOperationStateFinishing:
+            return "Finishing";
+        case OPOperationStateFinished:
+            return "Finished";
+    }
+
+    return "Unknown";
+}
+
+
 @interface OPOperation()
 
 
 @property (strong, nonatomic, readwrite) NSMutableArray *conditions;
 
+
 /**
- *  A private property to ensure we only notify the observers one time upon
- *  operation has finished.
+ *  A private property used to indicate the state of the operation.
+ *  Property is KVO observable, and is backed by an atomic so that it may be
+ *  read from any thread without taking a lock.
+ *
+ *  @see -transitionToState:
  */
-@property (assign, nonatomic) BOOL hasFinishedAlready;
+@property (assign, nonatomic, readonly) OPOperationState state;
 
 /**
- *  A private property used to indicate the state of the operation.
- *  Property is KVO observable.
+ *  Stores `NSError` objects in the event that the operation encounters an
+ *  error, whichever thread reports them. Created by the first error, so
+ *  that operations which never fail don't allocate one.
+ */
+@property (strong, nonatomic, readonly) OPErrorAccumulator *internalErrors;
+
+/**
+ *  `YES` once any error has been added to `internalErrors`.
  */
-@property (assign, nonatomic) OPOperationState state;
+@property (assign, nonatomic, readonly) BOOL hasInternalErrors;
+
+@end
+
 
 /**
- *  A private property used to store `NSError` objects in the event that
- *  the operation encounters an error.
+ *  Tracks a dependency on an `NSOperation` which isn't an `OPOperation`, and so
+ *  can't tell its dependents directly when it finishes. The edge observes
+ *  the dependency's `isFinished` instead, and is resolved exactly once.
  */
-@property (strong, nonatomic) NSMutableArray *internalErrors;
+@interface OPOperationDependencyEdge : NSObject {
+    @package
+    atomic_flag _resolved;
+}
+
+@property (strong, nonatomic, readonly) NSOperation *dependency;
+@property (weak, nonatomic, readonly) OPOperation *dependent;
+
+- (instancetype)initWithDependency:(NSOperation *)dependency dependent:(OPOperation *)dependent;
 
 /**
- *  A private property used to store objects conforming to the
- *  `OPOperationObserver` protocol. Observers will be informed of
- *  the `OPOperation`'s state as the operation transitions between them.
+ *  Stops observing the dependency.
+ *
+ *  @return `YES` for the first caller only
  */
-@property (strong, nonatomic) NSMutableArray *observers;
+- (BOOL)resolve;
 
 @end
 
 
-@implementation OPOperation
-@synthesize state = _state;
+static inline void OPOperationSpinLock(atomic_flag *lock)
+{
+    while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) {
+        sched_yield();
+    }
+}
+
+static inline void OPOperationSpinUnlock(atomic_flag *lock)
+{
+    atomic_flag_clear_explicit(lock, memory_order_release);
+}
+
+
+@implementation OPOperation {
+    _Atomic(NSUInteger) _state;
+
+    /**
+     *  The number of dependencies which have not yet finished. Conditions
+     *  are evaluated once this reaches zero.
+     */
+    atomic_long _unfinishedDependencyCount;
+
+    /**
+     *  Guards `_dependencies`, `_dependencyEdges`, `_dependents` and
+     *  `_dependentsNotified`. Only ever held for a few instructions.
+     */
+    atomic_flag _dependencyLock;
+    NSMutableArray *_dependencies;
+    NSMutableArray *_dependencyEdges;
+    NSMutableArray *_dependents;
+    BOOL _dependentsNotified;
+
+    /**
+     *  The operation's position in a topological order of the dependency
+     *  graph: every dependency has a lower index than its dependents. Kept
+     *  up to date as edges are added, along with the marks used while
+     *  searching the graph. Only changed with `OPOperationGraphLock` held,
+     *  but read without it when adding an edge.
+     */
+    _Atomic(uint64_t) _topologicalIndex;
+    uint64_t _graphVisitEpoch;
+    __unsafe_unretained OPOperation *_graphVisitParent;
+
+    /**
+     *  Objects conforming to the `OPOperationObserver` protocol. Observers
+     *  will be informed of the `OPOperation`'s state as the operation
+     *  transitions between them. The first few are stored inline, so the
+     *  common case needs no allocation.
+     */
+    __strong id <OPOperationObserver> _inlineObservers[kOPOperationInlineObserverCapacity];
+    NSMutableArray *_overflowObservers;
+    NSUInteger _observerCount;
+
+    /**
+     *  Callers other than the finishing thread reading the observers or
+     *  conditions, plus `kOPOperationNotifiersDraining` once finished.
+     *  Whoever leaves it at exactly `kOPOperationNotifiersDraining`
+     *  releases both, once.
+     */
+    _Atomic(NSUInteger) _notifiers;
+    atomic_bool _notifierStorageReleased;
+
+    NSMutableArray *_conditions;
+
+    /**
+     *  The `OPErrorAccumulator` behind `internalErrors`, retained while set.
+     */
+    _Atomic(const void *) _internalErrors;
+
+    /**
+     *  The object behind `result`, retained while set.
+     */
+    _Atomic(const void *) _result;
+}
+
+@synthesize conditions = _conditions;
+
+static inline id <OPOperationObserver> OPOperationObserverAtIndex(OPOperation *operation, NSUInteger idx)
+{
+    if (idx < kOPOperationInlineObserverCapacity) {
+        return operation->_inlineObservers[idx];
+    }
+    return operation->_overflowObservers[idx - kOPOperationInlineObserverCapacity];
+}
+
+static void OPOperationReleaseNotifierStorage(OPOperation *operation)
+{
+    if (atomic_exchange(&operation->_notifierStorageReleased, true)) {
+        return;
+    }
+
+    for (NSUInteger idx = 0; idx < MIN(operation->_observerCount, (NSUInteger)kOPOperationInlineObserverCapacity); idx++) {
+        operation->_inlineObservers[idx] = nil;
+    }
+    operation->_overflowObservers = nil;
+    operation->_observerCount = 0;
+    operation->_conditions = nil;
+}
+
+static inline void OPOperationEndNotifying(OPOperation *operation)
+{
+    NSUInteger previous = atomic_fetch_sub_explicit(&operation->_notifiers, 1, memory_order_acq_rel);
+    if (previous == (kOPOperationNotifiersDraining | 1)) {
+        OPOperationReleaseNotifierStorage(operation);
+    }
+}
+
+/**
+ *  Must be paired with `OPOperationEndNotifying` when it returns `YES`.
+ *
+ *  @return `NO` if the operation has finished, and its observers and
+ *  conditions may already have been released
+ */
+static inline BOOL OPOperationBeginNotifying(OPOperation *operation)
+{
+    NSUInteger previous = atomic_fetch_add_explicit(&operation->_notifiers, 1, memory_order_acquire);
+    if (previous & kOPOperationNotifiersDraining) {
+        OPOperationEndNotifying(operation);
+        return NO;
+    }
+    return YES;
+}
+
+/**
+ *  Called by the finishing thread once the operation is Finished. Releases
+ *  the observers and conditions now if nobody else is reading them, or
+ *  leaves it to the last who is.
+ */
+static void OPOperationDrainNotifiers(OPOperation *operation)
+{
+    NSUInteger previous = atomic_fetch_or_explicit(&operation->_notifiers, kOPOperationNotifiersDraining, memory_order_acq_rel);
+    if (previous == 0) {
+        OPOperationReleaseNotifierStorage(operation);
+    }
+}
+
+static int OPOperationGraphCompareOperations(const void *a, const void *b)
+{
+    uint64_t left = atomic_load_explicit(&(*(__unsafe_unretained OPOperation * const *)a)->_topologicalIndex, memory_order_relaxed);
+    uint64_t right = atomic_load_explicit(&(*(__unsafe_unretained OPOperation * const *)b)->_topologicalIndex, memory_order_relaxed);
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
 
 #pragma mark - Debugging
 #pragma mark -
@@ -101,40 +384,8 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
 - (NSString *)debugDescription
 {
     NSString *description = [super debugDescription];
-    NSString *state;
-    
-    switch (self.state)
-    {
-        case OPOperationStateReady:
-            state = @"Ready";
-            break;
-            
-        case OPOperationStatePending:
-            state = @"Pending";
-            break;
-            
-        case OPOperationStateFinished:
-            state = @"Finished";
-            break;
-            
-        case OPOperationStateExecuting:
-            state = @"Executing";
-            break;
-            
-        case OPOperationStateFinishing:
-            state = @"Finishing";
-            break;
-            
-        case OPOperationStateInitialized:
-            state = @"Initialized";
-            break;
-            
-        case OPOperationStateEvaluatingConditions:
-            state = @"EvaluatingConditions";
-            break;
-    }
-    
-    return [NSString stringWithFormat:@"%@ (%@)", description, state];
+
+    return [NSString stringWithFormat:@"%@ (%s)", description, OPOperationStateName(self.state)];
 }
 
 #pragma mark - KVO
@@ -158,7 +409,8 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
 
 - (void)willEnqueue
 {
-    [self setState:OPOperationStatePending];
+    [self transitionToState:OPOperationStatePending];
+    [self evaluateConditionsIfReady];
 }
 
 
@@ -167,9 +419,7 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
 
 - (OPOperationState)state
 {
-    @synchronized(self) {
-        return _state;
-    }
+    return atomic_load_explicit(&_state, memory_order_acquire);
 }
 
 + (BOOL)automaticallyNotifiesObserversOfState
@@ -177,28 +427,76 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
     return NO;
 }
 
-- (void)setState:(OPOperationState)newState
+/**
+ *  Attempts to move the operation into `newState` using a compare-and-swap,
+ *  so that concurrent callers racing on the same transition have exactly one
+ *  winner. Only the winner sends the KVO notifications, without holding any
+ *  lock, once the new state is in place; observers asking for prior or old
+ *  values therefore already see `newState`.
+ *
+ *  @param newState The state to transition to
+ *
+ *  @return `YES` if this call performed the transition, `NO` if the
+ *  transition was invalid from the current state or lost to another thread.
+ */
+- (BOOL)transitionToState:(OPOperationState)newState
 {
-    @synchronized(self) {
-        // Guard against calling if state is currently finished
-        if (_state != OPOperationStateFinished) {
-            NSAssert(_state != newState, @"Performing invalid cyclic state transition.");
-            [self willChangeValueForKey:@"state"];
-            _state = newState;
-            [self didChangeValueForKey:@"state"];
+    OPOperationState currentState = atomic_load_explicit(&_state, memory_order_acquire);
+
+    BOOL didTransition = NO;
+    while (OPOperationStateTransitionIsValid(currentState, newState)) {
+        if (atomic_compare_exchange_weak_explicit(&_state, &currentState, newState, memory_order_seq_cst, memory_order_acquire)) {
+            didTransition = YES;
+            break;
         }
     }
+
+    if (!didTransition) {
+        return NO;
+    }
+
+    [self willChangeValueForKey:@"state"];
+    [self didChangeValueForKey:@"state"];
+
+    OP_TRACE_INSTANT(OPTraceEventTypeStateTransition, self, OPOperationStateName(newState), object_getClassName(self));
+
+    return YES;
+}
+
+/**
+ *  Begins evaluating conditions if the operation has been enqueued and every
+ *  dependency has finished. Both `-willEnqueue` and the final dependency to
+ *  finish call this; sequentially consistent ordering guarantees at least
+ *  one of them observes both facts, and the state transition guarantees
+ *  only one evaluates.
+ */
+- (void)evaluateConditionsIfReady
+{
+    if (atomic_load(&_unfinishedDependencyCount) == 0 && atomic_load(&_state) == OPOperationStatePending) {
+        [self evaluateConditions];
+    }
 }
 
 - (void)evaluateConditions
 {
-    NSAssert([self state] == OPOperationStatePending, @"evaluateConditions was called out-of-order");
+    // Only the caller that wins the Pending -> EvaluatingConditions transition
+    // evaluates; concurrent readiness polls simply observe the new state.
+    if (![self transitionToState:OPOperationStateEvaluatingConditions]) {
+        return;
+    }
 
-    [self setState:OPOperationStateEvaluatingConditions];
+    // A cancelled operation won't execute, so its conditions don't matter.
+    // Nor will one attached to an in-flight duplicate.
+    if ([self isCancelled] || [self deduplicatedOperation]) {
+        [self transitionToState:OPOperationStateReady];
+        return;
+    }
 
     [OPOperationConditionEvaluator evaluateConditions:[self conditions] operation:self completion:^(NSArray *failures) {
-        [self.internalErrors addObjectsFromArray:failures];
-        [self setState:OPOperationStateReady];
+        if ([failures count] > 0) {
+            [self.internalErrors addErrors:failures];
+        }
+        [self transitionToState:OPOperationStateReady];
     }];
 }
 
@@ -213,22 +511,21 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
             return [self isCancelled];
 
         case OPOperationStatePending:
-            if ([self isCancelled]) {
-                return YES;
-            }
-            if ([super isReady]) {
-                [self evaluateConditions];
-            }
-            return NO;
+            return [self isCancelled];
 
         case OPOperationStateReady:
-            return [super isReady] || [self isCancelled];
+            return atomic_load(&_unfinishedDependencyCount) == 0 || [self isCancelled];
 
         default:
             return NO;
     }
 }
 
+- (BOOL)isCancelled
+{
+    return [super isCancelled] || [self.cancellationToken isCancelled];
+}
+
 - (BOOL)isExecuting
 {
     return [self state] == OPOperationStateExecuting;
@@ -263,7 +560,30 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
 {
     NSAssert([self state] < OPOperationStateEvaluatingConditions, @"Cannot modify conditions after execution has begun.");
 
-    [self.conditions addObject:condition];
+    if (!OPOperationBeginNotifying(self)) {
+        return;
+    }
+
+    // Most operations have no conditions, so the array is only created
+    // for the first one.
+    if (!_conditions) {
+        _conditions = [[NSMutableArray alloc] init];
+    }
+    [_conditions addObject:condition];
+
+    OPOperationEndNotifying(self);
+}
+
+- (NSMutableArray *)conditions
+{
+    if (!OPOperationBeginNotifying(self)) {
+        return nil;
+    }
+
+    NSMutableArray *conditions = _conditions;
+    OPOperationEndNotifying(self);
+
+    return conditions;
 }
 
 
@@ -274,15 +594,470 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
 {
     NSAssert([self state] < OPOperationStateExecuting, @"Cannot modify observers after execution has begun.");
 
-    [self.observers addObject:observer];
+    if (!OPOperationBeginNotifying(self)) {
+        return;
+    }
+
+    if (_observerCount < kOPOperationInlineObserverCapacity) {
+        _inlineObservers[_observerCount] = observer;
+    } else {
+        if (!_overflowObservers) {
+            _overflowObservers = [[NSMutableArray alloc] init];
+        }
+        [_overflowObservers addObject:observer];
+    }
+
+    _observerCount++;
+
+    OPOperationEndNotifying(self);
 }
 
 
+#pragma mark - Dependencies
+#pragma mark -
+
+/**
+ *  `OPOperation` tracks its own dependencies rather than relying on
+ *  `NSOperation`, which observes every dependency's `isFinished` and rescans
+ *  them all on each change. Instead each operation counts its unfinished
+ *  dependencies, and finishing `OPOperation`s decrement their dependents'
+ *  counts directly.
+ */
 - (void)addDependency:(NSOperation *)operation
 {
     NSAssert([self state] < OPOperationStateExecuting, @"Dependencies cannot be modified after execution has begun.");
 
-    [super addDependency:operation];
+    if ([operation isKindOfClass:[OPOperation class]]) {
+        [self addOperationDependency:(OPOperation *)operation];
+    } else {
+        atomic_fetch_add(&_unfinishedDependencyCount, 1);
+
+        OPOperationSpinLock(&_dependencyLock);
+        if (!_dependencies) {
+            _dependencies = [[NSMutableArray alloc] init];
+        }
+        [_dependencies addObject:operation];
+        OPOperationSpinUnlock(&_dependencyLock);
+
+        OPOperationDependencyEdge *edge = [[OPOperationDependencyEdge alloc] initWithDependency:operation dependent:self];
+
+        OPOperationSpinLock(&_dependencyLock);
+        if (!_dependencyEdges) {
+            _dependencyEdges = [[NSMutableArray alloc] init];
+        }
+        [_dependencyEdges addObject:edge];
+        OPOperationSpinUnlock(&_dependencyLock);
+
+        [operation addObserver:edge forKeyPath:@"isFinished" options:0 context:OPOperationDependencyKVOContext];
+
+        if ([operation isFinished] && [edge resolve]) {
+            [self dependencyDidFinish];
+        }
+    }
+}
+
+/**
+ *  Adds an edge between two `OPOperation`s, unless it would close a cycle
+ *  that could never be scheduled. In that case the receiver is cancelled
+ *  with an error describing the cycle instead.
+ */
+- (void)addOperationDependency:(OPOperation *)operation
+{
+    NSArray *cycle = nil;
+    BOOL added = NO;
+
+    // Most dependencies are on operations already ordered before the
+    // receiver, and are added without taking the graph lock.
+    uint64_t sequence = atomic_load(&OPOperationGraphSequence);
+    if (operation != self && (sequence & 1) == 0 && atomic_load(&operation->_topologicalIndex) < atomic_load(&_topologicalIndex)) {
+        added = [self graph_insertDependency:operation];
+
+        if (atomic_load(&OPOperationGraphSequence) != sequence) {
+            // A search overlapped the insertion and may have reordered the
+            // graph without seeing the new edge, so check it again.
+            pthread_mutex_lock(&OPOperationGraphLock);
+            cycle = [self graph_cycleFromAddingDependency:operation];
+            pthread_mutex_unlock(&OPOperationGraphLock);
+
+            if (cycle) {
+                [self removeDependency:operation];
+            }
+        }
+    } else {
+        pthread_mutex_lock(&OPOperationGraphLock);
+        cycle = [self graph_cycleFromAddingDependency:operation];
+        if (!cycle) {
+            added = [self graph_insertDependency:operation];
+        }
+        pthread_mutex_unlock(&OPOperationGraphLock);
+    }
+
+    if (cycle) {
+        [self cancelWithError:[OPOperation dependencyCycleErrorWithOperations:cycle]];
+    } else if (!added) {
+        // Already finished.
+        [self dependencyDidFinish];
+    }
+}
+
+/**
+ *  Records the edge on both operations.
+ *
+ *  @return `NO` if the dependency had already finished
+ */
+- (BOOL)graph_insertDependency:(OPOperation *)operation
+{
+    atomic_fetch_add(&_unfinishedDependencyCount, 1);
+
+    OPOperationSpinLock(&_dependencyLock);
+    if (!_dependencies) {
+        _dependencies = [[NSMutableArray alloc] init];
+    }
+    [_dependencies addObject:operation];
+    OPOperationSpinUnlock(&_dependencyLock);
+
+    return [operation addDependent:self];
+}
+
+- (void)removeDependency:(NSOperation *)operation
+{
+    NSAssert([self state] < OPOperationStateExecuting, @"Dependencies cannot be modified after execution has begun.");
+
+    OPOperationDependencyEdge *edge = nil;
+
+    OPOperationSpinLock(&_dependencyLock);
+    NSUInteger idx = [_dependencies indexOfObjectIdenticalTo:operation];
+    if (idx != NSNotFound) {
+        [_dependencies removeObjectAtIndex:idx];
+    }
+    for (OPOperationDependencyEdge *candidate in _dependencyEdges) {
+        if ([candidate dependency] == operation) {
+            edge = candidate;
+            break;
+        }
+    }
+    if (edge) {
+        [_dependencyEdges removeObjectIdenticalTo:edge];
+    }
+    OPOperationSpinUnlock(&_dependencyLock);
+
+    if (idx == NSNotFound) {
+        return;
+    }
+
+    // Only an edge which hadn't yet been resolved is still being counted.
+    BOOL wasUnfinished = NO;
+    if ([operation isKindOfClass:[OPOperation class]]) {
+        wasUnfinished = [(OPOperation *)operation removeDependent:self];
+    } else {
+        wasUnfinished = [edge resolve];
+    }
+
+    if (wasUnfinished) {
+        [self dependencyDidFinish];
+    }
+}
+
+- (NSArray *)dependencies
+{
+    OPOperationSpinLock(&_dependencyLock);
+    NSArray *dependencies = _dependencies ? [_dependencies copy] : @[];
+    OPOperationSpinUnlock(&_dependencyLock);
+
+    return dependencies;
+}
+
+- (BOOL)addDependent:(id <OPOperationDependent>)operation
+{
+    OPOperationSpinLock(&_dependencyLock);
+    BOOL added = !_dependentsNotified;
+    if (added) {
+        if (!_dependents) {
+            _dependents = [[NSMutableArray alloc] init];
+        }
+        [_dependents addObject:operation];
+    }
+    OPOperationSpinUnlock(&_dependencyLock);
+
+    return added;
+}
+
+- (BOOL)removeDependent:(id <OPOperationDependent>)operation
+{
+    OPOperationSpinLock(&_dependencyLock);
+    NSUInteger idx = [_dependents indexOfObjectIdenticalTo:operation];
+    if (idx != NSNotFound) {
+        [_dependents removeObjectAtIndex:idx];
+    }
+    OPOperationSpinUnlock(&_dependencyLock);
+
+    return idx != NSNotFound;
+}
+
+- (void)notifyDependents
+{
+    OPOperationSpinLock(&_dependencyLock);
+    NSArray *dependents = _dependents;
+    _dependents = nil;
+    _dependentsNotified = YES;
+    OPOperationSpinUnlock(&_dependencyLock);
+
+    for (id <OPOperationDependent> dependent in dependents) {
+        [dependent dependencyDidFinish:self];
+    }
+}
+
+- (void)addUntrackedDependencyCount:(NSUInteger)count
+{
+    NSAssert([self state] == OPOperationStateInitialized, @"Operations must be added to a graph before being added to a queue.");
+
+    atomic_fetch_add(&_unfinishedDependencyCount, (long)count);
+}
+
+- (void)dependencyDidFinish:(OPOperation *)dependency
+{
+    [self dependencyDidFinish];
+}
+
+- (void)dependencyDidFinish
+{
+    if (atomic_fetch_sub(&_unfinishedDependencyCount, 1) != 1) {
+        return;
+    }
+
+    if ([self state] >= OPOperationStateReady) {
+        // A dependency added after conditions were evaluated was holding us back.
+        [self willChangeValueForKey:@"isReady"];
+        [self didChangeValueForKey:@"isReady"];
+    } else {
+        [self evaluateConditionsIfReady];
+    }
+}
+
+
+#pragma mark - Cycle Detection
+#pragma mark -
+
+/**
+ *  Dependency cycles are caught as each edge is added, by keeping every
+ *  `OPOperation` in a topological order (Pearce & Kelly, "A Dynamic
+ *  Topological Sort Algorithm for Directed Acyclic Graphs").
+ *
+ *  Operations are numbered as they are created, and most dependencies are
+ *  on operations created earlier, so adding an edge usually costs a single
+ *  comparison. Otherwise only the operations whose indices lie between
+ *  the two ends of the new edge are searched, and reordered if no cycle
+ *  is found.
+ *
+ *  Must be called with `OPOperationGraphLock` held.
+ *
+ *  @return The operations on the cycle the edge would close, each of which
+ *  must finish before the next, or `nil` if the edge may be added.
+ */
+- (NSArray *)graph_cycleFromAddingDependency:(OPOperation *)dependency
+{
+    if (dependency == self) {
+        return @[self];
+    }
+
+    uint64_t lower = atomic_load_explicit(&_topologicalIndex, memory_order_relaxed);
+    uint64_t upper = atomic_load_explicit(&dependency->_topologicalIndex, memory_order_relaxed);
+    if (upper < lower) {
+        return nil;
+    }
+
+    atomic_fetch_add(&OPOperationGraphSequence, 1);
+    NSArray *cycle = [self graph_reorderForDependency:dependency lower:lower upper:upper];
+    atomic_fetch_add(&OPOperationGraphSequence, 1);
+
+    return cycle;
+}
+
+/**
+ *  The search and reorder behind `-graph_cycleFromAddingDependency:`. Each
+ *  operation's edges are visited in place under its own lock, and the
+ *  operations found are kept in the shared buffers.
+ */
+- (NSArray *)graph_reorderForDependency:(OPOperation *)dependency lower:(uint64_t)lower upper:(uint64_t)upper
+{
+    Class operationClass = [OPOperation class];
+    OPOperationGraphBuffer *stack = &OPOperationGraphStack;
+    OPOperationGraphBuffer *forward = &OPOperationGraphForward;
+    OPOperationGraphBuffer *backward = &OPOperationGraphBackward;
+    stack->count = 0;
+    forward->count = 0;
+    backward->count = 0;
+
+    // Search forward from the receiver through its dependents, for
+    // operations which would have to be ordered after the new dependency.
+    uint64_t forwardEpoch = ++OPOperationGraphEpoch;
+    _graphVisitEpoch = forwardEpoch;
+    _graphVisitParent = nil;
+    OPOperationGraphBufferPush(stack, self);
+
+    while (stack->count > 0) {
+        OPOperation *node = stack->operations[--stack->count];
+        OPOperationGraphBufferPush(forward, node);
+
+        BOOL closesCycle = NO;
+        OPOperationSpinLock(&node->_dependencyLock);
+        for (id dependent in node->_dependents) {
+            if (dependent == dependency) {
+                closesCycle = YES;
+                break;
+            }
+
+            // Other dependents, such as a group tracking its children,
+            // aren't part of the graph.
+            if (![dependent isKindOfClass:operationClass]) {
+                continue;
+            }
+
+            OPOperation *candidate = dependent;
+            if (candidate->_graphVisitEpoch != forwardEpoch && atomic_load_explicit(&candidate->_topologicalIndex, memory_order_relaxed) < upper) {
+                candidate->_graphVisitEpoch = forwardEpoch;
+                candidate->_graphVisitParent = node;
+                OPOperationGraphBufferPush(stack, candidate);
+            }
+        }
+        OPOperationSpinUnlock(&node->_dependencyLock);
+
+        if (closesCycle) {
+            NSMutableArray *cycle = [[NSMutableArray alloc] initWithObjects:dependency, nil];
+            for (OPOperation *step = node; step; step = step->_graphVisitParent) {
+                [cycle insertObject:step atIndex:1];
+            }
+            return cycle;
+        }
+    }
+
+    // Search backward from the new dependency through its own dependencies,
+    // for operations which would have to be ordered before the receiver.
+    uint64_t backwardEpoch = ++OPOperationGraphEpoch;
+    dependency->_graphVisitEpoch = backwardEpoch;
+    OPOperationGraphBufferPush(stack, dependency);
+
+    while (stack->count > 0) {
+        OPOperation *node = stack->operations[--stack->count];
+        OPOperationGraphBufferPush(backward, node);
+
+        OPOperationSpinLock(&node->_dependencyLock);
+        for (NSOperation *predecessor in node->_dependencies) {
+            if (![predecessor isKindOfClass:operationClass]) {
+                continue;
+            }
+
+            OPOperation *candidate = (OPOperation *)predecessor;
+            if (candidate->_graphVisitEpoch != backwardEpoch && atomic_load_explicit(&candidate->_topologicalIndex, memory_order_relaxed) > lower) {
+                candidate->_graphVisitEpoch = backwardEpoch;
+                OPOperationGraphBufferPush(stack, candidate);
+            }
+        }
+        OPOperationSpinUnlock(&node->_dependencyLock);
+    }
+
+    // Reuse the indices of both sets, giving the lowest to the backward set
+    // and keeping the relative order within each.
+    NSUInteger total = backward->count + forward->count;
+    if (total > OPOperationGraphIndexPoolCapacity) {
+        OPOperationGraphIndexPoolCapacity = MAX(total, OPOperationGraphIndexPoolCapacity * 2);
+        OPOperationGraphIndexPool = realloc(OPOperationGraphIndexPool, OPOperationGraphIndexPoolCapacity * sizeof(uint64_t));
+    }
+
+    qsort(backward->operations, backward->count, sizeof(OPOperation *), OPOperationGraphCompareOperations);
+    qsort(forward->operations, forward->count, sizeof(OPOperation *), OPOperationGraphCompareOperations);
+
+    uint64_t *pool = OPOperationGraphIndexPool;
+    for (NSUInteger idx = 0; idx < backward->count; idx++) {
+        pool[idx] = atomic_load_explicit(&backward->operations[idx]->_topologicalIndex, memory_order_relaxed);
+    }
+    for (NSUInteger idx = 0; idx < forward->count; idx++) {
+        pool[backward->count + idx] = atomic_load_explicit(&forward->operations[idx]->_topologicalIndex, memory_order_relaxed);
+    }
+    qsort(pool, total, sizeof(uint64_t), OPOperationGraphCompareIndices);
+
+    for (NSUInteger idx = 0; idx < backward->count; idx++) {
+        atomic_store_explicit(&backward->operations[idx]->_topologicalIndex, pool[idx], memory_order_relaxed);
+    }
+    for (NSUInteger idx = 0; idx < forward->count; idx++) {
+        atomic_store_explicit(&forward->operations[idx]->_topologicalIndex, pool[backward->count + idx], memory_order_relaxed);
+    }
+
+    return nil;
+}
+
++ (NSArray *)dependencyCycleReachableFromOperations:(NSArray *)operations
+{
+    /**
+     *  A depth first search over every dependency, including plain
+     *  `NSOperation`s which the incremental check can't see. Operations on
+     *  the current path are gray, and operations fully explored are black.
+     */
+    NSMapTable *colors = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsObjectPointerPersonality
+                                               valueOptions:NSPointerFunctionsStrongMemory];
+    NSNumber *gray = @1;
+    NSNumber *black = @2;
+
+    NSMutableArray *path = [[NSMutableArray alloc] init];
+    NSMutableArray *remaining = [[NSMutableArray alloc] init];
+
+    for (NSOperation *root in operations) {
+        if ([colors objectForKey:root]) {
+            continue;
+        }
+
+        [colors setObject:gray forKey:root];
+        [path addObject:root];
+        [remaining addObject:[[root dependencies] mutableCopy]];
+
+        while ([path count] > 0) {
+            NSMutableArray *dependencies = [remaining lastObject];
+
+            if ([dependencies count] == 0) {
+                [colors setObject:black forKey:[path lastObject]];
+                [path removeLastObject];
+                [remaining removeLastObject];
+                continue;
+            }
+
+            NSOperation *dependency = [dependencies lastObject];
+            [dependencies removeLastObject];
+
+            NSNumber *color = [colors objectForKey:dependency];
+            if (color == gray) {
+                // Each operation on the path depends on the next, so the
+                // cycle runs in reverse.
+                NSUInteger start = [path indexOfObjectIdenticalTo:dependency];
+                NSArray *cycle = [path subarrayWithRange:NSMakeRange(start, [path count] - start)];
+                return [[cycle reverseObjectEnumerator] allObjects];
+            }
+
+            if (!color) {
+                [colors setObject:gray forKey:dependency];
+                [path addObject:dependency];
+                [remaining addObject:[[dependency dependencies] mutableCopy]];
+            }
+        }
+    }
+
+    return nil;
+}
+
++ (NSError *)dependencyCycleErrorWithOperations:(NSArray *)cycle
+{
+    NSMutableArray *names = [[NSMutableArray alloc] initWithCapacity:[cycle count]];
+    for (NSOperation *operation in cycle) {
+        NSString *name = [operation name] ?: [NSString stringWithFormat:@"<%@: %p>", NSStringFromClass([operation class]), operation];
+        [names addObject:name];
+    }
+
+    NSString *description = [NSString stringWithFormat:@"Dependency cycle: %@ -> %@",
+                             [names componentsJoinedByString:@" -> "], [names firstObject]];
+
+    return [NSError errorWithCode:OPOperationErrorCodeDependencyCycle userInfo:@{
+        kOPOperationDependencyCycleKey : [names copy],
+        NSLocalizedDescriptionKey : description
+    }];
 }
 
 
@@ -304,12 +1079,31 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
 {
     NSAssert([self state] == OPOperationStateReady, @"This operation must be performed on an operation queue.");
 
-    if ([self.internalErrors count] == 0 && ![self isCancelled]) {
+    // An attached duplicate completes as the operation it was attached to did.
+    OPOperation *deduplicatedOperation = [self deduplicatedOperation];
+    if (deduplicatedOperation && ![self isCancelled]) {
+        if ([deduplicatedOperation isCancelled]) {
+            [self cancel];
+        }
+        [self finishWithResult:[deduplicatedOperation result] errors:[deduplicatedOperation finishedErrors]];
+        return;
+    }
 
-        [self setState:OPOperationStateExecuting];
+    if (![self hasInternalErrors] && ![self isCancelled]) {
 
-        for (id <OPOperationObserver>observer in [self observers]) {
-            [observer operationDidStart:self];
+        if (![self transitionToState:OPOperationStateExecuting]) {
+            // We were finished (e.g. by cancellation) before we could begin.
+            return;
+        }
+
+        if (OPOperationBeginNotifying(self)) {
+            for (NSUInteger idx = 0; idx < _observerCount; idx++) {
+                id <OPOperationObserver> observer = OPOperationObserverAtIndex(self, idx);
+                OP_TRACE_SPAN_BEGIN(traceStart);
+                [observer operationDidStart:self];
+                OP_TRACE_SPAN_END(traceStart, OPTraceEventTypeObserverStart, self, object_getClassName(observer));
+            }
+            OPOperationEndNotifying(self);
         }
 
         [self execute];
@@ -341,7 +1135,7 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
 - (void)cancelWithError:(NSError *)error
 {
     if (error) {
-        [self.internalErrors addObject:error];
+        [self.internalErrors addError:error];
     }
 
     [self cancel];
@@ -349,8 +1143,33 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
 
 - (void)produceOperation:(NSOperation *)operation
 {
-    for (id <OPOperationObserver>observer in [self observers]) {
-        [observer operation:self didProduceOperation:operation];
+    [self produceOperation:operation whenAccepted:nil];
+}
+
+- (void)produceOperation:(NSOperation *)operation whenAccepted:(void (^)(void))accepted
+{
+    // Only the first observer able to defer the operation is responsible
+    // for reporting its acceptance.
+    BOOL delivered = NO;
+
+    // Nobody is left to hand the operation to once the producer has finished.
+    if (OPOperationBeginNotifying(self)) {
+        for (NSUInteger idx = 0; idx < _observerCount; idx++) {
+            id <OPOperationObserver> observer = OPOperationObserverAtIndex(self, idx);
+            OP_TRACE_SPAN_BEGIN(traceStart);
+            if (!delivered && [observer respondsToSelector:@selector(operation:didProduceOperation:whenAccepted:)]) {
+                [(id <OPOperationProductionObserver>)observer operation:self didProduceOperation:operation whenAccepted:accepted];
+                delivered = YES;
+            } else {
+                [observer operation:self didProduceOperation:operation];
+            }
+            OP_TRACE_SPAN_END(traceStart, OPTraceEventTypeObserverProduce, self, object_getClassName(observer));
+        }
+        OPOperationEndNotifying(self);
+    }
+
+    if (!delivered && accepted) {
+        accepted();
     }
 }
 
@@ -370,19 +1189,50 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
 
 - (void)finishWithErrors:(NSArray *)errors
 {
-    if (![self hasFinishedAlready]) {
-        [self setHasFinishedAlready:YES];
-        [self setState:OPOperationStateFinishing];
+    [self finishWithResult:nil errors:errors];
+}
 
-        NSArray *combinedErrors = [self.internalErrors arrayByAddingObjectsFromArray:errors];
+- (void)finishWithResult:(id)result
+{
+    [self finishWithResult:result errors:@[]];
+}
+
+- (void)finishWithResult:(id)result errors:(NSArray *)errors
+{
+    // Winning the transition to Finishing guarantees observers are only
+    // notified once, regardless of how many threads race to finish.
+    if ([self transitionToState:OPOperationStateFinishing]) {
+        // Without internal errors, the caller's array is passed on as is.
+        NSArray *combinedErrors = errors ?: @[];
+        if ([self hasInternalErrors]) {
+            combinedErrors = [[self.internalErrors errors] arrayByAddingObjectsFromArray:errors];
+        }
+        _finishedErrors = combinedErrors;
+
+        // Published to dependents by the release ordering of the Finished
+        // transition below.
+        if (result) {
+            atomic_store_explicit(&_result, (__bridge_retained const void *)result, memory_order_release);
+        }
 
         [self finishedWithErrors:combinedErrors];
 
-        for (id <OPOperationObserver>observer in [self observers]) {
+        for (NSUInteger idx = 0; idx < _observerCount; idx++) {
+            id <OPOperationObserver> observer = OPOperationObserverAtIndex(self, idx);
+            OP_TRACE_SPAN_BEGIN(traceStart);
             [observer operation:self didFinishWithErrors:combinedErrors];
+            OP_TRACE_SPAN_END(traceStart, OPTraceEventTypeObserverFinish, self, object_getClassName(observer));
         }
 
-        [self setState:OPOperationStateFinished];
+        [self transitionToState:OPOperationStateFinished];
+
+        // Nothing is notified once finished, so keep only what dependents
+        // read, once any producer or starter still reading is done.
+        OPOperationDrainNotifiers(self);
+
+        [self notifyDependents];
+
+        [[self scheduler] operationDidFinish:self];
     }
 }
 
@@ -391,6 +1241,56 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
     // No-op
 }
 
+- (id)result
+{
+    return (__bridge id)atomic_load_explicit(&_result, memory_order_acquire);
+}
+
+- (id)takeResult
+{
+    return CFBridgingRelease(atomic_exchange_explicit(&_result, NULL, memory_order_acq_rel));
+}
+
+- (id)dependencyResultOfClass:(Class)resultClass
+{
+    for (NSOperation *dependency in [self dependencies]) {
+        if (![dependency isKindOfClass:[OPOperation class]]) {
+            continue;
+        }
+
+        id result = [(OPOperation *)dependency result];
+        if ([result isKindOfClass:resultClass]) {
+            return result;
+        }
+    }
+
+    return nil;
+}
+
+- (OPErrorAccumulator *)internalErrors
+{
+    const void *existing = atomic_load_explicit(&_internalErrors, memory_order_acquire);
+    if (existing) {
+        return (__bridge OPErrorAccumulator *)existing;
+    }
+
+    // Threads racing to add the first error agree on a single accumulator.
+    OPErrorAccumulator *accumulator = [[OPErrorAccumulator alloc] init];
+    const void *created = (__bridge_retained const void *)accumulator;
+    if (atomic_compare_exchange_strong(&_internalErrors, &existing, created)) {
+        return accumulator;
+    }
+
+    CFRelease(created);
+    return (__bridge OPErrorAccumulator *)existing;
+}
+
+- (BOOL)hasInternalErrors
+{
+    const void *internalErrors = atomic_load_explicit(&_internalErrors, memory_order_acquire);
+    return internalErrors && ![(__bridge OPErrorAccumulator *)internalErrors isEmpty];
+}
+
 - (void)waitUntilFinished
 {
     NSAssert(NO, @"I'm pretty sure you don't want to do this.");
@@ -407,13 +1307,76 @@ typedef NS_ENUM(NSUInteger, OPOperationState) {
         return nil;
     }
 
-    _state = OPOperationStateInitialized;
-    _observers = [[NSMutableArray alloc] init];
-    _conditions = [[NSMutableArray alloc] init];
+    atomic_init(&_state, OPOperationStateInitialized);
+    atomic_init(&_unfinishedDependencyCount, 0);
+    atomic_flag_clear(&_dependencyLock);
+    atomic_init(&_topologicalIndex, atomic_fetch_add(&OPOperationNextTopologicalIndex, 1));
+    atomic_init(&_internalErrors, NULL);
+    atomic_init(&_notifiers, 0);
+    atomic_init(&_notifierStorageReleased, false);
+    atomic_init(&_result, NULL);
+    _traceID = OPTraceNextOperationID();
+
+    return self;
+}
+
+- (void)dealloc
+{
+    // Stop observing any dependencies which never finished.
+    for (OPOperationDependencyEdge *edge in _dependencyEdges) {
+        [edge resolve];
+    }
+
+    const void *internalErrors = atomic_load(&_internalErrors);
+    if (internalErrors) {
+        CFRelease(internalErrors);
+    }
+
+    const void *result = atomic_load(&_result);
+    if (result) {
+        CFRelease(result);
+    }
+}
+
+@end
+
+
+@implementation OPOperationDependencyEdge
 
-    _internalErrors = [[NSMutableArray alloc] init];
+- (instancetype)initWithDependency:(NSOperation *)dependency dependent:(OPOperation *)dependent
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    atomic_flag_clear(&_resolved);
+    _dependency = dependency;
+    _dependent = dependent;
 
     return self;
 }
 
+- (BOOL)resolve
+{
+    if (atomic_flag_test_and_set(&_resolved)) {
+        return NO;
+    }
+
+    [self.dependency removeObserver:self forKeyPath:@"isFinished" context:OPOperationDependencyKVOContext];
+
+    return YES;
+}
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary *)change context:(void *)context
+{
+    if (context == OPOperationDependencyKVOContext) {
+        if ([self.dependency isFinished] && [self resolve]) {
+            [self.dependent dependencyDidFinish];
+        }
+    } else {
+        [super observeValueForKeyPath:keyPath ofObject:object change:change context:context];
+    }
+}
+
 @end
@@ -0,0 +1,55 @@
+// OPNetlinkReachabilityBackend.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPReachabilityBackend.h"
+
+#if defined(__linux__)
+
+/**
+ *  Reachability for Linux. A host is reachable when one of its addresses
+ *  has a route, which is checked by connecting a UDP socket: no packets
+ *  are sent. With `probesWithTCPConnect`, a non-blocking TCP connection to
+ *  `probePort` is attempted as well, and the host must answer in time.
+ *
+ *  Link, address and route events from an rtnetlink socket are reported
+ *  through `changeHandler`, so that results are re-probed only after the
+ *  network has changed.
+ */
+@interface OPNetlinkReachabilityBackend : NSObject <OPReachabilityBackend>
+
+/**
+ *  Whether to attempt a TCP connection to the host. Defaults to `NO`.
+ */
+@property (assign, atomic) BOOL probesWithTCPConnect;
+
+/**
+ *  Port for TCP probes. Defaults to 80.
+ */
+@property (assign, atomic) uint16_t probePort;
+
+/**
+ *  How long a TCP probe waits for the connection. Defaults to 2 seconds.
+ */
+@property (assign, atomic) NSTimeInterval probeTimeout;
+
+@end
+
+#endif
@@ -0,0 +1,241 @@
+// OPNetlinkReachabilityBackend.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPNetlinkReachabilityBackend.h"
+
+#if defined(__linux__)
+
+#import <errno.h>
+#import <fcntl.h>
+#import <netdb.h>
+#import <poll.h>
+#import <sys/socket.h>
+#import <unistd.h>
+
+#import <linux/netlink.h>
+#import <linux/rtnetlink.h>
+
+
+/**
+ *  Connecting a datagram socket only selects a route, so it succeeds exactly
+ *  when the kernel has somewhere to send packets for the address.
+ */
+static BOOL OPNetlinkReachabilityHasRoute(struct addrinfo *address)
+{
+    int fd = socket(address->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return NO;
+    }
+
+    BOOL hasRoute = connect(fd, address->ai_addr, address->ai_addrlen) == 0;
+    close(fd);
+
+    return hasRoute;
+}
+
+/**
+ *  A refused connection still means the host answered, so it counts as
+ *  reachable. Only a timeout or a network error doesn't.
+ */
+static BOOL OPNetlinkReachabilityConnect(struct addrinfo *address, int timeout)
+{
+    int fd = socket(address->ai_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return NO;
+    }
+
+    BOOL reachable = NO;
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+        reachable = YES;
+    } else if (errno == EINPROGRESS) {
+        struct pollfd descriptor = { fd, POLLOUT, 0 };
+        if (poll(&descriptor, 1, timeout) == 1) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            reachable = (error == 0 || error == ECONNREFUSED);
+        }
+    } else {
+        reachable = (errno == ECONNREFUSED);
+    }
+
+    close(fd);
+
+    return reachable;
+}
+
+
+@implementation OPNetlinkReachabilityBackend {
+    dispatch_queue_t _eventQueue;
+    dispatch_source_t _eventSource;
+}
+
+@synthesize changeHandler = _changeHandler;
+
+
+#pragma mark - OPReachabilityBackend Protocol
+#pragma mark -
+
+- (void)probeHost:(NSString *)host completion:(void (^)(BOOL reachable))completion
+{
+    BOOL probesWithTCPConnect = [self probesWithTCPConnect];
+    uint16_t port = [self probePort];
+    int timeout = (int)([self probeTimeout] * 1000);
+
+    // Name resolution blocks, so probes run concurrently on their own.
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+        struct addrinfo hints = { 0 };
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = probesWithTCPConnect ? SOCK_STREAM : SOCK_DGRAM;
+
+        char service[8];
+        snprintf(service, sizeof(service), "%u", port);
+
+        struct addrinfo *addresses = NULL;
+        if (getaddrinfo([host UTF8String], service, &hints, &addresses) != 0) {
+            completion(NO);
+            return;
+        }
+
+        BOOL reachable = NO;
+        for (struct addrinfo *address = addresses; address && !reachable; address = address->ai_next) {
+            if (probesWithTCPConnect) {
+                reachable = OPNetlinkReachabilityConnect(address, timeout);
+            } else {
+                reachable = OPNetlinkReachabilityHasRoute(address);
+            }
+        }
+
+        freeaddrinfo(addresses);
+        completion(reachable);
+    });
+}
+
+
+#pragma mark - Events
+#pragma mark -
+
+- (BOOL)startMonitoring
+{
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if (fd < 0) {
+        return NO;
+    }
+
+    struct sockaddr_nl address = { 0 };
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        return NO;
+    }
+
+    _eventSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)fd, 0, _eventQueue);
+
+    __weak __typeof__(self) weakSelf = self;
+    dispatch_source_set_event_handler(_eventSource, ^{
+        [weakSelf readEventsFromSocket:fd];
+    });
+    dispatch_source_set_cancel_handler(_eventSource, ^{
+        close(fd);
+    });
+    dispatch_resume(_eventSource);
+
+    return YES;
+}
+
+- (void)readEventsFromSocket:(int)fd
+{
+    char buffer[8192] __attribute__((aligned(__alignof__(struct nlmsghdr))));
+    BOOL changed = NO;
+    ssize_t length;
+
+    // Drain everything queued, so that a burst of events is reported once.
+    while ((length = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        int remaining = (int)length;
+        for (struct nlmsghdr *header = (struct nlmsghdr *)buffer; NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+            switch (header->nlmsg_type) {
+                case RTM_NEWLINK:
+                case RTM_DELLINK:
+                case RTM_NEWADDR:
+                case RTM_DELADDR:
+                case RTM_NEWROUTE:
+                case RTM_DELROUTE:
+                    changed = YES;
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    // Overflowing the socket's buffer loses events, so assume a change.
+    if (length < 0 && errno == ENOBUFS) {
+        changed = YES;
+    }
+
+    void (^changeHandler)(NSString *) = [self changeHandler];
+    if (changed && changeHandler) {
+        changeHandler(nil);
+    }
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _probePort = 80;
+    _probeTimeout = 2.0;
+    _eventQueue = dispatch_queue_create("Operative.Reachability", DISPATCH_QUEUE_SERIAL);
+
+    if (![self startMonitoring]) {
+        NSLog(@"%@ could not open an rtnetlink socket; results will only expire by age.", NSStringFromClass([self class]));
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_eventSource) {
+        dispatch_source_cancel(_eventSource);
+#if !OS_OBJECT_USE_OBJC
+        dispatch_release(_eventSource);
+#endif
+    }
+
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(_eventQueue);
+#endif
+}
+
+@end
+
+#endif
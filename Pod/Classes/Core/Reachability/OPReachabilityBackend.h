@@ -0,0 +1,57 @@
+// OPReachabilityBackend.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *  A source of reachability information for `OPReachabilityController`.
+ *
+ *  The controller caches each host's result and makes sure only one probe
+ *  per host is in flight, so a backend may probe however it likes without
+ *  caching anything itself. It reports changes to the network through
+ *  `changeHandler`, which lets cached results be kept until they change
+ *  rather than re-probed on every request.
+ */
+@protocol OPReachabilityBackend <NSObject>
+
+/**
+ *  Determines whether `host` is reachable. `completion` must be called
+ *  exactly once, on any thread, and may be called before returning.
+ */
+- (void)probeHost:(NSString *)host completion:(void (^)(BOOL reachable))completion;
+
+/**
+ *  Set by the controller. Call it whenever a previously probed result may
+ *  have changed, with the host concerned, or `nil` if the change could
+ *  affect any host.
+ */
+@property (copy, atomic) void (^changeHandler)(NSString *host);
+
+@optional
+
+/**
+ *  The controller no longer holds a result for `host`. Backends which keep
+ *  per-host state, such as monitoring, may release it.
+ */
+- (void)forgetHost:(NSString *)host;
+
+@end
@@ -0,0 +1,82 @@
+// OPReachabilityController.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPReachabilityBackend.h"
+
+
+/**
+ *  Answers reachability requests for `OPReachabilityCondition` from a
+ *  per-host cache, probing through a pluggable `OPReachabilityBackend` only
+ *  when nothing is cached.
+ *
+ *  Concurrent requests for a host which isn't cached share a single probe.
+ *  A cached result is kept until the backend reports a change affecting
+ *  it, or until it is older than `resultTimeToLive`, so most requests are
+ *  answered from memory, on the calling thread.
+ */
+@interface OPReachabilityController : NSObject
+
+/**
+ *  The controller used by `OPReachabilityCondition`, created with the
+ *  default backend for the platform.
+ */
++ (OPReachabilityController *)sharedController;
+
+/**
+ *  SystemConfiguration on Apple platforms, and netlink on Linux.
+ */
++ (id <OPReachabilityBackend>)defaultBackend;
+
+- (instancetype)initWithBackend:(id <OPReachabilityBackend>)backend NS_DESIGNATED_INITIALIZER;
+
+/**
+ *  Unused `-init` method.
+ *  @see -initWithBackend:
+ */
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (strong, nonatomic, readonly) id <OPReachabilityBackend> backend;
+
+/**
+ *  The longest a result is used for, even if the backend reports no change.
+ *  Expired results of hosts which aren't requested again are discarded, and
+ *  forgotten by the backend, during a later request for any host. Defaults
+ *  to 60 seconds.
+ */
+@property (assign, atomic) NSTimeInterval resultTimeToLive;
+
+/**
+ *  Number of probes the controller has asked its backend for.
+ */
+@property (assign, nonatomic, readonly) NSUInteger probeCount;
+
+/**
+ *  Calls `completion` with whether `host` is reachable. When the result is
+ *  cached, `completion` is called before returning.
+ */
+- (void)requestReachabilityOfHost:(NSString *)host completion:(void (^)(BOOL reachable))completion;
+
+/**
+ *  Discards the cached result for `host`, or every result if `host` is `nil`.
+ */
+- (void)invalidateHost:(NSString *)host;
+
+@end
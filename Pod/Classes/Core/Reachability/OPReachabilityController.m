@@ -0,0 +1,274 @@
+// OPReachabilityController.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPReachabilityController.h"
+
+#if defined(__APPLE__)
+#import "OPSystemConfigurationReachabilityBackend.h"
+#elif defined(__linux__)
+#import "OPNetlinkReachabilityBackend.h"
+#endif
+
+#import <pthread.h>
+
+
+/**
+ *  What the controller knows about one host: either a probe in flight and
+ *  the requests waiting for it, or a result and when it was obtained.
+ */
+@interface OPReachabilityEntry : NSObject {
+    @package
+    BOOL _resolved;
+    BOOL _reachable;
+    NSTimeInterval _resolvedAt;
+    NSMutableArray *_waiters;
+}
+@end
+
+@implementation OPReachabilityEntry
+@end
+
+
+@implementation OPReachabilityController {
+    pthread_mutex_t _lock;
+
+    /**
+     *  Entries keyed by host. Guarded by `_lock`, as are `_probeCount` and
+     *  `_nextSweepAt`.
+     */
+    NSMutableDictionary *_entries;
+    NSUInteger _probeCount;
+
+    /**
+     *  When expired results of hosts which haven't been requested again are
+     *  next discarded.
+     */
+    NSTimeInterval _nextSweepAt;
+}
+
+
+#pragma mark - Reachability
+#pragma mark -
+
+- (void)requestReachabilityOfHost:(NSString *)host completion:(void (^)(BOOL reachable))completion
+{
+    if (!host) {
+        completion(NO);
+        return;
+    }
+
+    NSTimeInterval now = [[NSProcessInfo processInfo] systemUptime];
+    NSTimeInterval timeToLive = [self resultTimeToLive];
+    BOOL expired = NO;
+
+    pthread_mutex_lock(&_lock);
+
+    NSArray *sweptHosts = [self sweepEntriesExpiredAt:now timeToLive:timeToLive];
+    OPReachabilityEntry *entry = _entries[host];
+
+    if (entry && entry->_resolved) {
+        if (now - entry->_resolvedAt < timeToLive) {
+            BOOL reachable = entry->_reachable;
+            pthread_mutex_unlock(&_lock);
+
+            [self backendForgetHosts:sweptHosts];
+            completion(reachable);
+            return;
+        }
+
+        [_entries removeObjectForKey:host];
+        entry = nil;
+        expired = YES;
+    }
+
+    if (entry) {
+        // A probe is already in flight, so wait for its result.
+        [entry->_waiters addObject:[completion copy]];
+        pthread_mutex_unlock(&_lock);
+
+        [self backendForgetHosts:sweptHosts];
+        return;
+    }
+
+    entry = [[OPReachabilityEntry alloc] init];
+    entry->_waiters = [[NSMutableArray alloc] initWithObjects:[completion copy], nil];
+    _entries[host] = entry;
+    _probeCount++;
+
+    pthread_mutex_unlock(&_lock);
+
+    [self backendForgetHosts:sweptHosts];
+    if (expired) {
+        [self backendForgetHost:host];
+    }
+
+    [self.backend probeHost:host completion:^(BOOL reachable) {
+        [self entry:entry forHost:host didResolve:reachable];
+    }];
+}
+
+- (void)entry:(OPReachabilityEntry *)entry forHost:(NSString *)host didResolve:(BOOL)reachable
+{
+    pthread_mutex_lock(&_lock);
+
+    NSArray *waiters = entry->_waiters;
+    entry->_waiters = nil;
+
+    // An entry invalidated while its probe was in flight isn't cached, as
+    // the result may predate the change.
+    if (_entries[host] == entry) {
+        entry->_resolved = YES;
+        entry->_reachable = reachable;
+        entry->_resolvedAt = [[NSProcessInfo processInfo] systemUptime];
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    for (void (^waiter)(BOOL) in waiters) {
+        waiter(reachable);
+    }
+}
+
+/**
+ *  Discards resolved entries older than `timeToLive`, at most once per
+ *  `timeToLive`, so a host which is never requested again doesn't keep its
+ *  entry and the backend's state for it forever. Called with `_lock` held.
+ *
+ *  @return The hosts discarded, for the backend to forget once unlocked
+ */
+- (NSArray *)sweepEntriesExpiredAt:(NSTimeInterval)now timeToLive:(NSTimeInterval)timeToLive
+{
+    if (now < _nextSweepAt) {
+        return nil;
+    }
+    _nextSweepAt = now + timeToLive;
+
+    NSMutableArray *hosts = nil;
+    for (NSString *host in _entries) {
+        OPReachabilityEntry *entry = _entries[host];
+        if (entry->_resolved && now - entry->_resolvedAt >= timeToLive) {
+            if (!hosts) {
+                hosts = [[NSMutableArray alloc] init];
+            }
+            [hosts addObject:host];
+        }
+    }
+
+    [_entries removeObjectsForKeys:hosts ?: @[]];
+
+    return hosts;
+}
+
+- (void)invalidateHost:(NSString *)host
+{
+    NSArray *hosts;
+
+    pthread_mutex_lock(&_lock);
+    if (host) {
+        hosts = _entries[host] ? @[host] : @[];
+        [_entries removeObjectForKey:host];
+    } else {
+        hosts = [_entries allKeys];
+        [_entries removeAllObjects];
+    }
+    pthread_mutex_unlock(&_lock);
+
+    [self backendForgetHosts:hosts];
+}
+
+- (void)backendForgetHost:(NSString *)host
+{
+    if ([self.backend respondsToSelector:@selector(forgetHost:)]) {
+        [self.backend forgetHost:host];
+    }
+}
+
+- (void)backendForgetHosts:(NSArray *)hosts
+{
+    for (NSString *host in hosts) {
+        [self backendForgetHost:host];
+    }
+}
+
+- (NSUInteger)probeCount
+{
+    pthread_mutex_lock(&_lock);
+    NSUInteger probeCount = _probeCount;
+    pthread_mutex_unlock(&_lock);
+
+    return probeCount;
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
++ (OPReachabilityController *)sharedController
+{
+    static OPReachabilityController *_sharedInstance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedInstance = [[OPReachabilityController alloc] initWithBackend:[self defaultBackend]];
+    });
+
+    return _sharedInstance;
+}
+
++ (id <OPReachabilityBackend>)defaultBackend
+{
+#if defined(__APPLE__)
+    return [[OPSystemConfigurationReachabilityBackend alloc] init];
+#elif defined(__linux__)
+    return [[OPNetlinkReachabilityBackend alloc] init];
+#else
+    return nil;
+#endif
+}
+
+- (instancetype)initWithBackend:(id <OPReachabilityBackend>)backend
+{
+    NSParameterAssert(backend);
+
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    pthread_mutex_init(&_lock, NULL);
+    _entries = [[NSMutableDictionary alloc] init];
+    _backend = backend;
+    _resultTimeToLive = 60;
+
+    __weak __typeof__(self) weakSelf = self;
+    [backend setChangeHandler:^(NSString *host) {
+        [weakSelf invalidateHost:host];
+    }];
+
+    return self;
+}
+
+- (void)dealloc
+{
+    [_backend setChangeHandler:nil];
+    pthread_mutex_destroy(&_lock);
+}
+
+@end
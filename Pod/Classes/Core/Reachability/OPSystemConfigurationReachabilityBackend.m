@@ -0,0 +1,184 @@
+// OPSystemConfigurationReachabilityBackend.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPSystemConfigurationReachabilityBackend.h"
+
+#if defined(__APPLE__)
+
+#import <SystemConfiguration/SystemConfiguration.h>
+#import <pthread.h>
+
+
+/**
+ *  The context passed to a monitored host's callback.
+ */
+@interface OPSystemConfigurationReachabilityTarget : NSObject
+
+@property (copy, nonatomic) NSString *host;
+
+@property (weak, nonatomic) OPSystemConfigurationReachabilityBackend *backend;
+
+@end
+
+@implementation OPSystemConfigurationReachabilityTarget
+@end
+
+
+@interface OPSystemConfigurationReachabilityBackend ()
+
+- (void)hostDidChange:(NSString *)host;
+
+@end
+
+
+static void OPSystemConfigurationReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags flags, void *info)
+{
+    OPSystemConfigurationReachabilityTarget *context = (__bridge OPSystemConfigurationReachabilityTarget *)info;
+    [context.backend hostDidChange:context.host];
+}
+
+
+@implementation OPSystemConfigurationReachabilityBackend {
+    pthread_mutex_t _lock;
+
+    /**
+     *  `SCNetworkReachabilityRef`s of monitored hosts. Guarded by `_lock`.
+     */
+    NSMutableDictionary *_references;
+
+    dispatch_queue_t _callbackQueue;
+}
+
+@synthesize changeHandler = _changeHandler;
+
+
+#pragma mark - OPReachabilityBackend Protocol
+#pragma mark -
+
+- (void)probeHost:(NSString *)host completion:(void (^)(BOOL reachable))completion
+{
+    // Getting the flags of a new reference may wait on name resolution, so
+    // probes run concurrently rather than one at a time.
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+        SCNetworkReachabilityRef reference = [self copyReferenceForHost:host];
+
+        BOOL reachable = NO;
+        if (reference) {
+            SCNetworkReachabilityFlags flags = 0;
+            if (SCNetworkReachabilityGetFlags(reference, &flags) != 0) {
+                reachable = ((flags & kSCNetworkReachabilityFlagsReachable) != 0);
+            }
+            CFRelease(reference);
+        }
+
+        completion(reachable);
+    });
+}
+
+- (void)forgetHost:(NSString *)host
+{
+    pthread_mutex_lock(&_lock);
+    id reference = _references[host];
+    [_references removeObjectForKey:host];
+    pthread_mutex_unlock(&_lock);
+
+    if (reference) {
+        SCNetworkReachabilitySetDispatchQueue((__bridge SCNetworkReachabilityRef)reference, NULL);
+        SCNetworkReachabilitySetCallback((__bridge SCNetworkReachabilityRef)reference, NULL, NULL);
+    }
+}
+
+
+#pragma mark - Monitoring
+#pragma mark -
+
+- (SCNetworkReachabilityRef)copyReferenceForHost:(NSString *)host
+{
+    pthread_mutex_lock(&_lock);
+
+    SCNetworkReachabilityRef reference = (__bridge SCNetworkReachabilityRef)_references[host];
+    if (reference) {
+        CFRetain(reference);
+    } else {
+        reference = SCNetworkReachabilityCreateWithName(NULL, [host UTF8String]);
+
+        if (reference) {
+            OPSystemConfigurationReachabilityTarget *target = [[OPSystemConfigurationReachabilityTarget alloc] init];
+            target.host = host;
+            target.backend = self;
+
+            SCNetworkReachabilityContext context = { 0, (__bridge void *)target, CFRetain, CFRelease, NULL };
+            if (SCNetworkReachabilitySetCallback(reference, OPSystemConfigurationReachabilityCallback, &context)) {
+                SCNetworkReachabilitySetDispatchQueue(reference, _callbackQueue);
+            }
+
+            _references[host] = (__bridge id)reference;
+        }
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    return reference;
+}
+
+- (void)hostDidChange:(NSString *)host
+{
+    void (^changeHandler)(NSString *) = [self changeHandler];
+    if (changeHandler) {
+        changeHandler(host);
+    }
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    pthread_mutex_init(&_lock, NULL);
+    _references = [[NSMutableDictionary alloc] init];
+    _callbackQueue = dispatch_queue_create("Operative.Reachability", DISPATCH_QUEUE_SERIAL);
+
+    return self;
+}
+
+- (void)dealloc
+{
+    for (id reference in [_references allValues]) {
+        SCNetworkReachabilitySetDispatchQueue((__bridge SCNetworkReachabilityRef)reference, NULL);
+        SCNetworkReachabilitySetCallback((__bridge SCNetworkReachabilityRef)reference, NULL, NULL);
+    }
+
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(_callbackQueue);
+#endif
+
+    pthread_mutex_destroy(&_lock);
+}
+
+@end
+
+#endif
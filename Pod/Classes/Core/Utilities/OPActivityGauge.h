@@ -0,0 +1,95 @@
+// OPActivityGauge.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *  Block invoked when an `OPActivityGauge` reports a change.
+ *
+ *  @param activityCount The number of activities in flight when the change was delivered
+ *  @param active        Whether the gauge is considered active, after hysteresis
+ */
+typedef void (^OPActivityGaugeChangeHandler)(NSUInteger activityCount, BOOL active);
+
+
+/**
+ *  `OPActivityGauge` keeps an in-flight count for a named resource, such as
+ *  a database, a disk or a remote service.
+ *
+ *  Starting and ending an activity is an atomic increment or decrement and
+ *  never leaves the calling thread. Transitions are coalesced into at most
+ *  one change notification per `minimumNotificationInterval`, delivered on
+ *  the queue given to `-setChangeHandler:queue:`.
+ *
+ *  The gauge becomes active as soon as an activity starts, but only reports
+ *  itself inactive once it has been idle for `idleDelay`, so that a resource
+ *  that is briefly idle between two activities does not flicker.
+ */
+@interface OPActivityGauge : NSObject
+
+/**
+ *  Returns the process-wide gauge with the given name, creating it if needed.
+ */
++ (OPActivityGauge *)gaugeNamed:(NSString *)name;
+
+- (instancetype)initWithName:(NSString *)name NS_DESIGNATED_INITIALIZER;
+
+/**
+ *  Unused `-init` method.
+ *  @see -initWithName:
+ */
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (copy, nonatomic, readonly) NSString *name;
+
+/**
+ *  The number of activities currently in flight.
+ */
+@property (assign, nonatomic, readonly) NSUInteger activityCount;
+
+/**
+ *  Shortest time between two change notifications. Defaults to 0.1 seconds.
+ */
+@property (assign, atomic) NSTimeInterval minimumNotificationInterval;
+
+/**
+ *  How long the gauge must stay idle before it is reported inactive.
+ *  Defaults to 1 second.
+ */
+@property (assign, atomic) NSTimeInterval idleDelay;
+
+/**
+ *  Sets the block notified of changes, and the queue it is invoked on.
+ *  Notifications are serialized even if `queue` is concurrent, and across
+ *  calls to this method; one already scheduled may still run on the
+ *  previous queue.
+ *
+ *  @param handler Change handler, or `nil` to stop notifications
+ *  @param queue   Queue to deliver notifications on
+ */
+- (void)setChangeHandler:(OPActivityGaugeChangeHandler)handler queue:(dispatch_queue_t)queue;
+
+- (void)activityDidStart;
+
+- (void)activityDidEnd;
+
+@end
@@ -0,0 +1,282 @@
+// OPActivityGauge.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPActivityGauge.h"
+
+#import <stdatomic.h>
+
+
+static inline uint64_t OPActivityGaugeNow(void)
+{
+    return (uint64_t)([[NSProcessInfo processInfo] systemUptime] * NSEC_PER_SEC);
+}
+
+
+@implementation OPActivityGauge {
+    atomic_long _activityCount;
+
+    /**
+     *  Set while a coalesced delivery is waiting to run. Transitions that
+     *  find it set do nothing beyond updating the count.
+     */
+    atomic_bool _deliveryScheduled;
+
+    /**
+     *  When the count last dropped to zero, and when the last delivery ran.
+     */
+    atomic_uint_fast64_t _idleSince;
+    atomic_uint_fast64_t _lastDelivery;
+
+    /**
+     *  Serial queue created once for the gauge's lifetime, and retargeted at
+     *  the caller's queue, so that deliveries already scheduled stay
+     *  serialized with later ones. The change handler is guarded by `self`.
+     */
+    dispatch_queue_t _deliveryQueue;
+    OPActivityGaugeChangeHandler _changeHandler;
+
+    /**
+     *  What was last reported, and whether an idle check is pending. Only
+     *  touched on `_deliveryQueue`.
+     */
+    NSUInteger _reportedCount;
+    BOOL _reportedActive;
+    BOOL _hasReported;
+    BOOL _idleCheckScheduled;
+}
+
+#pragma mark - Registry
+#pragma mark -
+
++ (OPActivityGauge *)gaugeNamed:(NSString *)name
+{
+    NSParameterAssert(name);
+
+    static NSMutableDictionary *gauges;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        gauges = [[NSMutableDictionary alloc] init];
+    });
+
+    @synchronized(gauges) {
+        OPActivityGauge *gauge = [gauges objectForKey:name];
+        if (!gauge) {
+            gauge = [[OPActivityGauge alloc] initWithName:name];
+            [gauges setObject:gauge forKey:name];
+        }
+        return gauge;
+    }
+}
+
+
+#pragma mark - Activity
+#pragma mark -
+
+- (NSUInteger)activityCount
+{
+    long activityCount = atomic_load(&_activityCount);
+    return activityCount > 0 ? (NSUInteger)activityCount : 0;
+}
+
+- (void)activityDidStart
+{
+    atomic_fetch_add(&_activityCount, 1);
+    [self scheduleDeliveryAfterDelay:0];
+}
+
+- (void)activityDidEnd
+{
+    long previous = atomic_fetch_sub(&_activityCount, 1);
+    NSAssert(previous > 0, @"Activity ended on gauge \"%@\" without a matching start.", [self name]);
+
+    if (previous == 1) {
+        atomic_store(&_idleSince, OPActivityGaugeNow());
+    }
+
+    [self scheduleDeliveryAfterDelay:0];
+}
+
+
+#pragma mark - Delivery
+#pragma mark -
+
+- (void)setChangeHandler:(OPActivityGaugeChangeHandler)handler queue:(dispatch_queue_t)queue
+{
+    NSParameterAssert(!handler || queue);
+
+    @synchronized(self) {
+        _changeHandler = [handler copy];
+
+        if (handler) {
+            dispatch_set_target_queue(_deliveryQueue, queue);
+        }
+    }
+
+    if (handler) {
+        [self scheduleDeliveryAfterDelay:0];
+    }
+}
+
+- (void)scheduleDeliveryAfterDelay:(NSTimeInterval)minimumDelay
+{
+    if (atomic_exchange(&_deliveryScheduled, true)) {
+        return;
+    }
+
+    BOOL hasHandler;
+    @synchronized(self) {
+        hasHandler = _changeHandler != nil;
+    }
+
+    if (!hasHandler) {
+        atomic_store(&_deliveryScheduled, false);
+        return;
+    }
+
+    // Hold the delivery back until the rate limit allows it.
+    uint64_t earliest = atomic_load(&_lastDelivery) + (uint64_t)([self minimumNotificationInterval] * NSEC_PER_SEC);
+    uint64_t now = OPActivityGaugeNow();
+    int64_t delay = MAX((int64_t)(minimumDelay * NSEC_PER_SEC), earliest > now ? (int64_t)(earliest - now) : 0);
+
+    if (delay > 0) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, delay), _deliveryQueue, ^{
+            [self deliverChange];
+        });
+    } else {
+        dispatch_async(_deliveryQueue, ^{
+            [self deliverChange];
+        });
+    }
+}
+
+/**
+ *  Must be called on `_deliveryQueue`.
+ */
+- (void)scheduleIdleCheckAfterDelay:(NSTimeInterval)delay
+{
+    if (_idleCheckScheduled) {
+        return;
+    }
+    _idleCheckScheduled = YES;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), _deliveryQueue, ^{
+        self->_idleCheckScheduled = NO;
+        [self reportChange];
+    });
+}
+
+- (void)deliverChange
+{
+    // Clear first, so that a transition racing with this delivery schedules
+    // another one rather than being lost.
+    atomic_store(&_deliveryScheduled, false);
+    [self reportChange];
+}
+
+- (void)reportChange
+{
+    OPActivityGaugeChangeHandler handler;
+    @synchronized(self) {
+        handler = _changeHandler;
+    }
+
+    if (!handler) {
+        return;
+    }
+
+    uint64_t now = OPActivityGaugeNow();
+    atomic_store(&_lastDelivery, now);
+
+    NSUInteger activityCount = [self activityCount];
+    BOOL active = _reportedActive;
+
+    if (activityCount > 0) {
+        active = YES;
+    } else if (active) {
+        /**
+         *  To prevent the gauge from flickering between active and inactive,
+         *  it is only reported inactive once it has stayed idle for the
+         *  whole idle delay. Until then, check again when the delay is up.
+         */
+        uint64_t idleSince = atomic_load(&_idleSince);
+        NSTimeInterval idleFor = now > idleSince ? (NSTimeInterval)(now - idleSince) / NSEC_PER_SEC : 0;
+        NSTimeInterval idleDelay = [self idleDelay];
+
+        if (idleFor >= idleDelay) {
+            active = NO;
+        } else {
+            [self scheduleIdleCheckAfterDelay:idleDelay - idleFor];
+        }
+    }
+
+    if (_hasReported && activityCount == _reportedCount && active == _reportedActive) {
+        return;
+    }
+
+    _hasReported = YES;
+    _reportedCount = activityCount;
+    _reportedActive = active;
+
+    handler(activityCount, active);
+}
+
+
+#pragma mark - Debugging
+#pragma mark -
+
+- (NSString *)debugDescription
+{
+    return [NSString stringWithFormat:@"%@ (%@, activityCount=%lu)", [super debugDescription], [self name], (unsigned long)[self activityCount]];
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
+- (instancetype)initWithName:(NSString *)name
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _name = [name copy];
+    _minimumNotificationInterval = 0.1;
+    _idleDelay = 1.0;
+
+    atomic_init(&_activityCount, 0);
+    atomic_init(&_deliveryScheduled, false);
+    atomic_init(&_idleSince, 0);
+    atomic_init(&_lastDelivery, 0);
+
+    _deliveryQueue = dispatch_queue_create("Operative.ActivityGauge", DISPATCH_QUEUE_SERIAL);
+
+    return self;
+}
+
+#if !OS_OBJECT_USE_OBJC
+- (void)dealloc
+{
+    dispatch_release(_deliveryQueue);
+}
+#endif
+
+@end
@@ -0,0 +1,64 @@
+// OPCancellationToken.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *  A node in a tree of cancellation tokens. Cancelling a token cancels every
+ *  token beneath it, at constant cost however large the subtree: nothing
+ *  is told, and descendants instead find out when they next check.
+ *
+ *  `OPGroupOperation` shares its token with its children, and nests the
+ *  tokens of child groups beneath its own, so cancelling a group reaches
+ *  every operation within it without visiting any of them.
+ *
+ *  @see -[OPOperation cancellationToken]
+ */
+@interface OPCancellationToken : NSObject
+
+- (instancetype)initWithParent:(OPCancellationToken *)parent NS_DESIGNATED_INITIALIZER;
+
+/**
+ *  Initializes a token with no parent.
+ */
+- (instancetype)init;
+
+/**
+ *  The token whose cancellation also cancels this one, if any.
+ */
+@property (strong, nonatomic, readonly) OPCancellationToken *parent;
+
+/**
+ *  Attaches a token created without a parent beneath `parent`. A token's
+ *  parent can only be set once.
+ */
+- (void)attachToParent:(OPCancellationToken *)parent;
+
+/**
+ *  `YES` if this token or any of its ancestors has been cancelled. Costs
+ *  one atomic load per level of the tree.
+ */
+@property (assign, nonatomic, readonly, getter=isCancelled) BOOL cancelled;
+
+- (void)cancel;
+
+@end
@@ -0,0 +1,102 @@
+// OPCancellationToken.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPCancellationToken.h"
+
+#import <stdatomic.h>
+
+
+@implementation OPCancellationToken {
+    atomic_bool _cancelled;
+
+    /**
+     *  The parent, retained while set. Set at most once, so it can be read
+     *  without a lock.
+     */
+    _Atomic(const void *) _parent;
+}
+
+- (OPCancellationToken *)parent
+{
+    return (__bridge OPCancellationToken *)atomic_load_explicit(&_parent, memory_order_acquire);
+}
+
+- (void)attachToParent:(OPCancellationToken *)parent
+{
+    NSParameterAssert(parent);
+
+    const void *expected = NULL;
+    const void *retained = (__bridge_retained const void *)parent;
+    if (!atomic_compare_exchange_strong(&_parent, &expected, retained)) {
+        CFRelease(retained);
+        NSAssert(NO, @"A cancellation token's parent can only be set once.");
+    }
+}
+
+- (BOOL)isCancelled
+{
+    OPCancellationToken *token = self;
+    while (token) {
+        if (atomic_load_explicit(&token->_cancelled, memory_order_acquire)) {
+            return YES;
+        }
+        token = (__bridge OPCancellationToken *)atomic_load_explicit(&token->_parent, memory_order_acquire);
+    }
+
+    return NO;
+}
+
+- (void)cancel
+{
+    atomic_store_explicit(&_cancelled, true, memory_order_release);
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
+- (instancetype)initWithParent:(OPCancellationToken *)parent
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    atomic_init(&_cancelled, false);
+    atomic_init(&_parent, parent ? (__bridge_retained const void *)parent : NULL);
+
+    return self;
+}
+
+- (void)dealloc
+{
+    const void *parent = atomic_load(&_parent);
+    if (parent) {
+        CFRelease(parent);
+    }
+}
+
+- (instancetype)init
+{
+    return [self initWithParent:nil];
+}
+
+@end
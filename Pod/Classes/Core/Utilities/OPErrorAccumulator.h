@@ -0,0 +1,54 @@
+// OPErrorAccumulator.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *  Collects errors reported concurrently from many threads without locking.
+ *
+ *  Adding an error is a single allocation and compare-and-swap. Errors are
+ *  kept until the accumulator is deallocated.
+ */
+@interface OPErrorAccumulator : NSObject
+
+/**
+ *  Adds an error. `nil` is ignored.
+ */
+- (void)addError:(NSError *)error;
+
+/**
+ *  Adds each error in `errors`.
+ */
+- (void)addErrors:(NSArray *)errors;
+
+/**
+ *  `YES` if no errors have been added
+ */
+@property (assign, nonatomic, readonly, getter=isEmpty) BOOL empty;
+
+/**
+ *  A snapshot of the errors added so far. Errors added by a single thread
+ *  appear in the order they were added.
+ */
+- (NSArray *)errors;
+
+@end
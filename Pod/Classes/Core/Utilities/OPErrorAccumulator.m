@@ -0,0 +1,112 @@
+// OPErrorAccumulator.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPErrorAccumulator.h"
+
+#import <stdatomic.h>
+#import <stdlib.h>
+
+
+typedef struct OPErrorAccumulatorNode {
+    struct OPErrorAccumulatorNode *next;
+    const void *error;
+} OPErrorAccumulatorNode;
+
+
+@implementation OPErrorAccumulator {
+    /**
+     *  Most recently added error first. Nodes are only freed on dealloc, so
+     *  a snapshot of the head can always be walked safely.
+     */
+    _Atomic(OPErrorAccumulatorNode *) _head;
+    atomic_ulong _count;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    atomic_init(&_head, NULL);
+    atomic_init(&_count, 0);
+
+    return self;
+}
+
+- (void)dealloc
+{
+    OPErrorAccumulatorNode *node = atomic_load(&_head);
+    while (node) {
+        OPErrorAccumulatorNode *next = node->next;
+        CFRelease(node->error);
+        free(node);
+        node = next;
+    }
+}
+
+- (void)addError:(NSError *)error
+{
+    if (!error) {
+        return;
+    }
+
+    OPErrorAccumulatorNode *node = malloc(sizeof(OPErrorAccumulatorNode));
+    node->error = (__bridge_retained const void *)error;
+
+    OPErrorAccumulatorNode *head = atomic_load_explicit(&_head, memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&_head, &head, node, memory_order_release, memory_order_relaxed));
+
+    atomic_fetch_add_explicit(&_count, 1, memory_order_relaxed);
+}
+
+- (void)addErrors:(NSArray *)errors
+{
+    for (NSError *error in errors) {
+        [self addError:error];
+    }
+}
+
+- (BOOL)isEmpty
+{
+    return atomic_load_explicit(&_head, memory_order_acquire) == NULL;
+}
+
+- (NSArray *)errors
+{
+    OPErrorAccumulatorNode *node = atomic_load_explicit(&_head, memory_order_acquire);
+    if (!node) {
+        return @[];
+    }
+
+    NSMutableArray *errors = [[NSMutableArray alloc] initWithCapacity:atomic_load_explicit(&_count, memory_order_relaxed)];
+    for (; node; node = node->next) {
+        [errors addObject:(__bridge NSError *)node->error];
+    }
+
+    // The list is newest first.
+    return [[errors reverseObjectEnumerator] allObjects];
+}
+
+@end
@@ -0,0 +1,135 @@
+// OPStreamChannel.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *  A bounded, single-producer single-consumer channel of data chunks, used to
+ *  hand a body from the operation producing it to an operation consuming it
+ *  while it is still arriving.
+ *
+ *  Sending never blocks, so that it may be called from callbacks. Instead
+ *  the producer is told when the channel is full, and should stop producing
+ *  until `spaceAvailableHandler` is called. Memory held by the channel is
+ *  therefore bounded by its capacity plus the size of one chunk.
+ *
+ *  A consumer which gives up before the end of the stream should call
+ *  `-stopReceiving`, so the producer isn't left waiting for room forever.
+ */
+@interface OPStreamChannel : NSObject
+
+/**
+ *  @param capacity Number of buffered bytes at which the channel is full
+ */
+- (instancetype)initWithCapacity:(NSUInteger)capacity NS_DESIGNATED_INITIALIZER;
+
+/**
+ *  Unused `-init` method.
+ *  @see -initWithCapacity:
+ */
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (assign, nonatomic, readonly) NSUInteger capacity;
+
+/**
+ *  Bytes sent but not yet received.
+ */
+@property (assign, nonatomic, readonly) NSUInteger bufferedByteCount;
+
+/**
+ *  The highest `bufferedByteCount` reached.
+ */
+@property (assign, nonatomic, readonly) NSUInteger highWaterMark;
+
+
+///---------------
+/// @name Sending
+///---------------
+
+/**
+ *  Called, on the receiving thread, once a full channel has room again.
+ *  Only called after `-sendData:` has returned `NO`.
+ */
+@property (copy, atomic) void (^spaceAvailableHandler)(void);
+
+/**
+ *  Called, on the receiving thread, if the consumer stops receiving before
+ *  the channel is closed. The producer should stop producing altogether.
+ */
+@property (copy, atomic) void (^stoppedReceivingHandler)(void);
+
+/**
+ *  Appends a chunk. Chunks sent after the channel is closed are dropped.
+ *
+ *  @return `NO` if the channel is now full, and the producer should wait
+ *  for `spaceAvailableHandler` before sending more
+ */
+- (BOOL)sendData:(NSData *)data;
+
+/**
+ *  Appends a chunk as `-sendData:` does, calling `pauseHandler` before
+ *  returning `NO`. The handler is called with the channel locked, so the
+ *  producer is paused before the consumer can make room and call
+ *  `spaceAvailableHandler`, however the two threads interleave. It must
+ *  not call back into the channel.
+ *
+ *  @param pauseHandler Pauses the producer, such as by suspending a task
+ */
+- (BOOL)sendData:(NSData *)data pauseHandler:(void (^)(void))pauseHandler;
+
+/**
+ *  Marks the end of the stream. Chunks already sent can still be received.
+ *
+ *  @param error The error which ended the stream early, or `nil`
+ */
+- (void)closeWithError:(NSError *)error;
+
+
+///-----------------
+/// @name Receiving
+///-----------------
+
+/**
+ *  Waits until a chunk is available and returns it.
+ *
+ *  @return The next chunk, or `nil` once the channel is closed and empty
+ */
+- (NSData *)receiveData;
+
+/**
+ *  Closes the channel from the consumer's side, dropping any buffered
+ *  chunks, and calls `stoppedReceivingHandler` if the producer hadn't
+ *  already closed it.
+ */
+- (void)stopReceiving;
+
+/**
+ *  `YES` once the channel has been closed.
+ */
+@property (assign, nonatomic, readonly, getter=isClosed) BOOL closed;
+
+/**
+ *  The error the channel was closed with, if any.
+ */
+@property (strong, nonatomic, readonly) NSError *error;
+
+@end
@@ -0,0 +1,217 @@
+// OPStreamChannel.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPStreamChannel.h"
+
+#import <pthread.h>
+
+
+@implementation OPStreamChannel {
+    pthread_mutex_t _lock;
+    pthread_cond_t _available;
+
+    /**
+     *  Chunks waiting to be received, oldest first. Guarded by `_lock`, as
+     *  are the counters and flags below.
+     */
+    NSMutableArray *_chunks;
+    NSUInteger _bufferedByteCount;
+    NSUInteger _highWaterMark;
+    BOOL _closed;
+    NSError *_error;
+
+    /**
+     *  Set when the producer has been told the channel is full.
+     */
+    BOOL _producerWaiting;
+}
+
+#pragma mark - Sending
+#pragma mark -
+
+- (BOOL)sendData:(NSData *)data
+{
+    return [self sendData:data pauseHandler:nil];
+}
+
+- (BOOL)sendData:(NSData *)data pauseHandler:(void (^)(void))pauseHandler
+{
+    pthread_mutex_lock(&_lock);
+
+    if (!_closed && [data length] > 0) {
+        [_chunks addObject:[data copy]];
+        _bufferedByteCount += [data length];
+        _highWaterMark = MAX(_highWaterMark, _bufferedByteCount);
+        pthread_cond_signal(&_available);
+    }
+
+    BOOL hasSpace = _closed || _bufferedByteCount < _capacity;
+    if (!hasSpace) {
+        // Paused before `_producerWaiting` can be seen by the consumer, so
+        // the producer is never resumed before it has been paused.
+        if (pauseHandler) {
+            pauseHandler();
+        }
+        _producerWaiting = YES;
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    return hasSpace;
+}
+
+- (void)closeWithError:(NSError *)error
+{
+    pthread_mutex_lock(&_lock);
+    if (!_closed) {
+        _closed = YES;
+        _error = error;
+        pthread_cond_broadcast(&_available);
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+
+#pragma mark - Receiving
+#pragma mark -
+
+- (NSData *)receiveData
+{
+    pthread_mutex_lock(&_lock);
+
+    while ([_chunks count] == 0 && !_closed) {
+        pthread_cond_wait(&_available, &_lock);
+    }
+
+    NSData *data = [_chunks firstObject];
+    BOOL resumeProducer = NO;
+
+    if (data) {
+        [_chunks removeObjectAtIndex:0];
+        _bufferedByteCount -= [data length];
+
+        if (_producerWaiting && _bufferedByteCount < _capacity) {
+            _producerWaiting = NO;
+            resumeProducer = YES;
+        }
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    // Called without the lock, so the handler is free to send straight away.
+    if (resumeProducer) {
+        void (^spaceAvailableHandler)(void) = [self spaceAvailableHandler];
+        if (spaceAvailableHandler) {
+            spaceAvailableHandler();
+        }
+    }
+
+    return data;
+}
+
+- (void)stopReceiving
+{
+    pthread_mutex_lock(&_lock);
+    BOOL wasOpen = !_closed;
+    _closed = YES;
+    _producerWaiting = NO;
+    [_chunks removeAllObjects];
+    _bufferedByteCount = 0;
+    pthread_cond_broadcast(&_available);
+    pthread_mutex_unlock(&_lock);
+
+    if (wasOpen) {
+        void (^stoppedReceivingHandler)(void) = [self stoppedReceivingHandler];
+        if (stoppedReceivingHandler) {
+            stoppedReceivingHandler();
+        }
+    }
+}
+
+
+#pragma mark - Accessors
+#pragma mark -
+
+- (NSUInteger)bufferedByteCount
+{
+    pthread_mutex_lock(&_lock);
+    NSUInteger bufferedByteCount = _bufferedByteCount;
+    pthread_mutex_unlock(&_lock);
+
+    return bufferedByteCount;
+}
+
+- (NSUInteger)highWaterMark
+{
+    pthread_mutex_lock(&_lock);
+    NSUInteger highWaterMark = _highWaterMark;
+    pthread_mutex_unlock(&_lock);
+
+    return highWaterMark;
+}
+
+- (BOOL)isClosed
+{
+    pthread_mutex_lock(&_lock);
+    BOOL closed = _closed;
+    pthread_mutex_unlock(&_lock);
+
+    return closed;
+}
+
+- (NSError *)error
+{
+    pthread_mutex_lock(&_lock);
+    NSError *error = _error;
+    pthread_mutex_unlock(&_lock);
+
+    return error;
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+{
+    NSParameterAssert(capacity > 0);
+
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    pthread_mutex_init(&_lock, NULL);
+    pthread_cond_init(&_available, NULL);
+
+    _capacity = capacity;
+    _chunks = [[NSMutableArray alloc] init];
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_cond_destroy(&_available);
+    pthread_mutex_destroy(&_lock);
+}
+
+@end
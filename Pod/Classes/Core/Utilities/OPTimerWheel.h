@@ -0,0 +1,111 @@
+// OPTimerWheel.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *  A timer registered with an `OPTimerWheel`. Entries are embedded directly
+ *  in the object which owns them, typically as an instance variable, so that
+ *  arming and cancelling a timer never allocates. A zeroed entry is a valid,
+ *  unarmed entry.
+ *
+ *  The fields are private to `OPTimerWheel` and guarded by its lock.
+ */
+typedef struct OPTimerWheelEntry {
+    struct OPTimerWheelEntry *next;
+    struct OPTimerWheelEntry *previous;
+    uint64_t deadline;
+    void *target;
+    BOOL armed;
+} OPTimerWheelEntry;
+
+
+/**
+ *  Implemented by the owners of `OPTimerWheelEntry`s to be told when one
+ *  expires.
+ */
+@protocol OPTimerWheelTarget <NSObject>
+
+/**
+ *  Invoked on a global dispatch queue once `entry` has expired. Entries which
+ *  expire in the same tick are delivered together, one after another.
+ *
+ *  An expiry may race with `-cancelEntry:`; if cancelling returned `NO`, this
+ *  is still called.
+ */
+- (void)timerWheelEntryDidExpire:(OPTimerWheelEntry *)entry;
+
+@end
+
+
+/**
+ *  `OPTimerWheel` runs any number of timers from a single dispatch timer,
+ *  using a hierarchical timing wheel: four levels of 256 slots, each level
+ *  counting ticks 256 times coarser than the one below. Arming and
+ *  cancelling are constant time; entries are moved down a level at most
+ *  three times as their deadline approaches.
+ *
+ *  The wheel only ticks while entries are armed. Deadlines are rounded up to
+ *  a whole tick, so a timer fires between zero and two ticks late.
+ */
+@interface OPTimerWheel : NSObject
+
+/**
+ *  A process wide timer wheel with a tick of 10 milliseconds, used by
+ *  `OPTimeoutObserver` and `OPDelayOperation`.
+ */
++ (OPTimerWheel *)sharedTimerWheel;
+
+- (instancetype)initWithTickInterval:(NSTimeInterval)tickInterval NS_DESIGNATED_INITIALIZER;
+
+@property (assign, nonatomic, readonly) NSTimeInterval tickInterval;
+
+/**
+ *  Number of entries currently armed
+ */
+@property (assign, nonatomic, readonly) NSUInteger armedCount;
+
+/**
+ *  Arms `entry` to expire after `timeout`. An entry which is already armed is
+ *  re-armed with the new timeout.
+ *
+ *  @param entry   Entry, which must remain valid while it is armed
+ *  @param timeout Seconds until the entry expires
+ *  @param target  Told when the entry expires; retained while it is armed
+ */
+- (void)armEntry:(OPTimerWheelEntry *)entry timeout:(NSTimeInterval)timeout target:(id <OPTimerWheelTarget>)target;
+
+/**
+ *  Disarms `entry`.
+ *
+ *  @return `YES` if the entry was armed, and so will not expire
+ */
+- (BOOL)cancelEntry:(OPTimerWheelEntry *)entry;
+
+/**
+ *  Unused `-init` method.
+ *  @see -initWithTickInterval:
+ *  @see +sharedTimerWheel
+ */
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
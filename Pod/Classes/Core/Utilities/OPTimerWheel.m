@@ -0,0 +1,353 @@
+// OPTimerWheel.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPTimerWheel.h"
+
+#import <math.h>
+#import <pthread.h>
+#import <stdlib.h>
+
+
+#define kOPTimerWheelLevelCount 4
+#define kOPTimerWheelSlotBits 8
+#define kOPTimerWheelSlotCount (1 << kOPTimerWheelSlotBits)
+#define kOPTimerWheelSlotMask (kOPTimerWheelSlotCount - 1)
+
+/**
+ *  The furthest deadline the wheel can hold, in ticks. Later deadlines are
+ *  clamped to it.
+ */
+static const uint64_t kOPTimerWheelMaximumDelta = (1ULL << (kOPTimerWheelLevelCount * kOPTimerWheelSlotBits)) - 1;
+
+
+@implementation OPTimerWheel {
+    pthread_mutex_t _lock;
+
+    /**
+     *  Circular lists of entries, one per slot per level, each headed by a
+     *  sentinel entry.
+     */
+    OPTimerWheelEntry _slots[kOPTimerWheelLevelCount][kOPTimerWheelSlotCount];
+
+    /**
+     *  The last tick processed, counted from `_origin`.
+     */
+    uint64_t _currentTick;
+    NSTimeInterval _origin;
+    NSUInteger _armedCount;
+
+    dispatch_queue_t _queue;
+    dispatch_source_t _timer;
+    BOOL _ticking;
+}
+
++ (OPTimerWheel *)sharedTimerWheel
+{
+    static OPTimerWheel *sharedTimerWheel;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedTimerWheel = [[OPTimerWheel alloc] initWithTickInterval:0.01];
+    });
+
+    return sharedTimerWheel;
+}
+
+- (NSUInteger)armedCount
+{
+    pthread_mutex_lock(&_lock);
+    NSUInteger armedCount = _armedCount;
+    pthread_mutex_unlock(&_lock);
+
+    return armedCount;
+}
+
+
+#pragma mark - Arming
+#pragma mark -
+
+- (void)armEntry:(OPTimerWheelEntry *)entry timeout:(NSTimeInterval)timeout target:(id <OPTimerWheelTarget>)target
+{
+    NSParameterAssert(entry);
+    NSParameterAssert(target);
+
+    void *retainedTarget = (__bridge_retained void *)target;
+    void *previousTarget = NULL;
+
+    pthread_mutex_lock(&_lock);
+
+    if (entry->armed) {
+        previousTarget = entry->target;
+        [self unlinkEntry:entry];
+    }
+
+    NSTimeInterval now = [[NSProcessInfo processInfo] systemUptime];
+
+    // Nothing is armed while the wheel is idle, so it can skip straight to now.
+    if (!_ticking) {
+        _currentTick = MAX(_currentTick, [self tickForTime:now]);
+    }
+
+    entry->deadline = (uint64_t)ceil((now - _origin + MAX(timeout, 0)) / _tickInterval);
+    entry->target = retainedTarget;
+    entry->armed = YES;
+    [self insertEntry:entry];
+    _armedCount++;
+
+    if (!_ticking) {
+        _ticking = YES;
+        dispatch_resume(_timer);
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    if (previousTarget) {
+        CFRelease(previousTarget);
+    }
+}
+
+- (BOOL)cancelEntry:(OPTimerWheelEntry *)entry
+{
+    NSParameterAssert(entry);
+
+    void *target = NULL;
+
+    pthread_mutex_lock(&_lock);
+    if (entry->armed) {
+        target = entry->target;
+        [self unlinkEntry:entry];
+        _armedCount--;
+    }
+    pthread_mutex_unlock(&_lock);
+
+    if (!target) {
+        return NO;
+    }
+
+    CFRelease(target);
+    return YES;
+}
+
+
+#pragma mark - Private
+#pragma mark -
+
+- (uint64_t)tickForTime:(NSTimeInterval)time
+{
+    return (uint64_t)floor((time - _origin) / _tickInterval);
+}
+
+/**
+ *  The following methods must be called with `_lock` held.
+ */
+
+- (void)insertEntry:(OPTimerWheelEntry *)entry
+{
+    // Anything already due fires on the next tick.
+    if (entry->deadline <= _currentTick) {
+        entry->deadline = _currentTick + 1;
+    }
+
+    uint64_t delta = entry->deadline - _currentTick;
+    if (delta > kOPTimerWheelMaximumDelta) {
+        delta = kOPTimerWheelMaximumDelta;
+        entry->deadline = _currentTick + delta;
+    }
+
+    NSUInteger level = 0;
+    while (level < kOPTimerWheelLevelCount - 1 && delta >= (1ULL << ((level + 1) * kOPTimerWheelSlotBits))) {
+        level++;
+    }
+
+    NSUInteger slot = (NSUInteger)((entry->deadline >> (level * kOPTimerWheelSlotBits)) & kOPTimerWheelSlotMask);
+    OPTimerWheelEntry *head = &_slots[level][slot];
+
+    entry->previous = head->previous;
+    entry->next = head;
+    head->previous->next = entry;
+    head->previous = entry;
+}
+
+- (void)unlinkEntry:(OPTimerWheelEntry *)entry
+{
+    entry->previous->next = entry->next;
+    entry->next->previous = entry->previous;
+    entry->next = NULL;
+    entry->previous = NULL;
+    entry->armed = NO;
+}
+
+/**
+ *  Moves every entry in a slot of a coarser level down to the level their
+ *  deadline now falls in.
+ */
+- (void)cascadeLevel:(NSUInteger)level slot:(NSUInteger)slot
+{
+    OPTimerWheelEntry *head = &_slots[level][slot];
+    OPTimerWheelEntry *entry = head->next;
+
+    head->next = head;
+    head->previous = head;
+
+    while (entry != head) {
+        OPTimerWheelEntry *next = entry->next;
+        [self insertEntry:entry];
+        entry = next;
+    }
+}
+
+/**
+ *  Advances `_currentTick` to now, collecting expired entries.
+ *
+ *  @param expired Entries are appended here, if not `NULL`
+ *  @param targets Their retained targets, in the same order
+ *  @param count   Number of entries collected
+ *  @param capacity Allocated length of `expired` and `targets`
+ */
+- (void)advanceCollectingEntries:(OPTimerWheelEntry ***)expired
+                         targets:(void ***)targets
+                           count:(NSUInteger *)count
+                        capacity:(NSUInteger *)capacity
+{
+    uint64_t now = [self tickForTime:[[NSProcessInfo processInfo] systemUptime]];
+
+    while (_currentTick < now) {
+        // With nothing armed, there's nothing to walk through.
+        if (_armedCount == 0) {
+            _currentTick = now;
+            break;
+        }
+
+        _currentTick++;
+
+        // Bring entries down from coarser levels as each level wraps.
+        for (NSUInteger level = 1; level < kOPTimerWheelLevelCount; level++) {
+            if ((_currentTick & ((1ULL << (level * kOPTimerWheelSlotBits)) - 1)) != 0) {
+                break;
+            }
+            [self cascadeLevel:level slot:(NSUInteger)((_currentTick >> (level * kOPTimerWheelSlotBits)) & kOPTimerWheelSlotMask)];
+        }
+
+        OPTimerWheelEntry *head = &_slots[0][_currentTick & kOPTimerWheelSlotMask];
+        while (head->next != head) {
+            OPTimerWheelEntry *entry = head->next;
+            void *target = entry->target;
+            [self unlinkEntry:entry];
+            _armedCount--;
+
+            if (*count == *capacity) {
+                *capacity = MAX(*capacity * 2, (NSUInteger)64);
+                *expired = realloc(*expired, *capacity * sizeof(OPTimerWheelEntry *));
+                *targets = realloc(*targets, *capacity * sizeof(void *));
+            }
+            (*expired)[*count] = entry;
+            (*targets)[*count] = target;
+            (*count)++;
+        }
+    }
+}
+
+- (void)tick
+{
+    NSUInteger count = 0;
+    NSUInteger capacity = 0;
+    OPTimerWheelEntry **expired = NULL;
+    void **targets = NULL;
+
+    pthread_mutex_lock(&_lock);
+    [self advanceCollectingEntries:&expired targets:&targets count:&count capacity:&capacity];
+    if (_armedCount == 0 && _ticking) {
+        _ticking = NO;
+        dispatch_suspend(_timer);
+    }
+    pthread_mutex_unlock(&_lock);
+
+    if (count == 0) {
+        return;
+    }
+
+    // Deliver the whole batch with a single hop off the wheel's queue.
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        for (NSUInteger idx = 0; idx < count; idx++) {
+            id <OPTimerWheelTarget> target = (__bridge_transfer id <OPTimerWheelTarget>)targets[idx];
+            [target timerWheelEntryDidExpire:expired[idx]];
+        }
+        free(expired);
+        free(targets);
+    });
+}
+
+
+#pragma mark - Lifecycle
+#pragma mark -
+
+- (instancetype)initWithTickInterval:(NSTimeInterval)tickInterval
+{
+    NSParameterAssert(tickInterval > 0);
+
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    pthread_mutex_init(&_lock, NULL);
+
+    for (NSUInteger level = 0; level < kOPTimerWheelLevelCount; level++) {
+        for (NSUInteger slot = 0; slot < kOPTimerWheelSlotCount; slot++) {
+            _slots[level][slot].next = &_slots[level][slot];
+            _slots[level][slot].previous = &_slots[level][slot];
+        }
+    }
+
+    _tickInterval = tickInterval;
+    _origin = [[NSProcessInfo processInfo] systemUptime];
+
+    _queue = dispatch_queue_create("Operative.TimerWheel", DISPATCH_QUEUE_SERIAL);
+    _timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _queue);
+
+    uint64_t interval = (uint64_t)(tickInterval * NSEC_PER_SEC);
+    dispatch_source_set_timer(_timer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+
+    // The wheel doesn't retain itself through its timer.
+    __weak OPTimerWheel *weakSelf = self;
+    dispatch_source_set_event_handler(_timer, ^{
+        [weakSelf tick];
+    });
+
+    return self;
+}
+
+- (void)dealloc
+{
+    // A dispatch source must be resumed before it is released.
+    if (!_ticking) {
+        dispatch_resume(_timer);
+    }
+    dispatch_source_cancel(_timer);
+
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(_timer);
+    dispatch_release(_queue);
+#endif
+
+    pthread_mutex_destroy(&_lock);
+}
+
+@end
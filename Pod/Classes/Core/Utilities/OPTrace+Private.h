@@ -0,0 +1,108 @@
+// OPTrace+Private.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPTrace.h"
+
+#import <stdatomic.h>
+#import <stdint.h>
+
+
+/**
+ *  Kinds of event recorded by `OPTrace`.
+ */
+typedef NS_ENUM(uint32_t, OPTraceEventType) {
+    /**
+     *  An operation entered the state named by the event
+     */
+    OPTraceEventTypeStateTransition,
+    /**
+     *  A condition was evaluated for an operation
+     */
+    OPTraceEventTypeCondition,
+    /**
+     *  An observer was told an operation started
+     */
+    OPTraceEventTypeObserverStart,
+    /**
+     *  An observer was told an operation produced another
+     */
+    OPTraceEventTypeObserverProduce,
+    /**
+     *  An observer was told an operation finished
+     */
+    OPTraceEventTypeObserverFinish,
+};
+
+
+/**
+ *  Whether `OPTrace` is recording. Read through `OP_TRACE_IS_ENABLED()`.
+ */
+extern atomic_bool OPTraceEnabled;
+
+#if OP_TRACING
+#define OP_TRACE_IS_ENABLED() __builtin_expect(atomic_load_explicit(&OPTraceEnabled, memory_order_relaxed), 0)
+#else
+#define OP_TRACE_IS_ENABLED() 0
+#endif
+
+/**
+ *  Declares `var` holding the start time of a span, or 0 if tracing is
+ *  disabled.
+ */
+#define OP_TRACE_SPAN_BEGIN(var) \
+    uint64_t var = OP_TRACE_IS_ENABLED() ? OPTraceNow() : 0
+
+/**
+ *  Records a span started with `OP_TRACE_SPAN_BEGIN`.
+ */
+#define OP_TRACE_SPAN_END(var, type, operation, name) \
+    do { if (var) { OPTraceRecord((type), [(operation) traceID], (name), NULL, (var), OPTraceNow() - (var)); } } while (0)
+
+/**
+ *  Records an event with no duration.
+ */
+#define OP_TRACE_INSTANT(type, operation, name, detail) \
+    do { if (OP_TRACE_IS_ENABLED()) { OPTraceRecord((type), [(operation) traceID], (name), (detail), OPTraceNow(), 0); } } while (0)
+
+
+/**
+ *  @return A monotonic timestamp in nanoseconds
+ */
+uint64_t OPTraceNow(void);
+
+/**
+ *  @return A new identifier for an operation's events, never returned before
+ */
+uint64_t OPTraceNextOperationID(void);
+
+/**
+ *  Appends an event to the calling thread's buffer.
+ *
+ *  @param type        The kind of event
+ *  @param operationID The operation's `traceID`
+ *  @param name        Name of the state, condition or observer. Must remain
+ *                     valid for the life of the process, such as a string
+ *                     literal or a class name.
+ *  @param detail      Optional additional name with the same lifetime
+ *  @param timestamp   Start of the event, from `OPTraceNow()`
+ *  @param duration    Duration of the event in nanoseconds
+ */
+void OPTraceRecord(OPTraceEventType type, uint64_t operationID, const char *name, const char *detail, uint64_t timestamp, uint64_t duration);
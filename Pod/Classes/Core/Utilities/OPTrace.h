@@ -0,0 +1,92 @@
+// OPTrace.h
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *  Set `OP_TRACING` to 0 to compile tracing out entirely. When compiled in,
+ *  tracing is disabled until `+start` is called, and each trace point costs
+ *  a single relaxed load and a branch.
+ */
+#ifndef OP_TRACING
+#define OP_TRACING 1
+#endif
+
+
+/**
+ *  `OPTrace` records a timestamp for every `OPOperation` state transition,
+ *  condition evaluation and observer callback.
+ *
+ *  Events are written to a fixed size ring buffer owned by the recording
+ *  thread, so recording never takes a lock. When a buffer fills, the oldest
+ *  events are overwritten.
+ *
+ *  Recorded events can be exported in the Chrome trace event format, which
+ *  can be loaded by `chrome://tracing` and by the Perfetto UI. Each operation
+ *  is shown as an asynchronous track of its states, and condition and
+ *  observer callbacks as slices on the thread which ran them.
+ */
+@interface OPTrace : NSObject
+
+/**
+ *  Begins recording events.
+ */
++ (void)start;
+
+/**
+ *  Stops recording events. Previously recorded events are kept.
+ */
++ (void)stop;
+
+/**
+ *  @return `YES` if events are currently being recorded
+ */
++ (BOOL)isEnabled;
+
+/**
+ *  Discards every event recorded so far.
+ */
++ (void)reset;
+
+/**
+ *  Number of events each thread keeps before overwriting the oldest.
+ *  Must be set before the first event is recorded. Defaults to 16384.
+ */
++ (void)setEventsPerThread:(NSUInteger)eventsPerThread;
+
+/**
+ *  Recorded events as Chrome trace event JSON.
+ *
+ *  Events recorded concurrently with the export may be missing or, if a
+ *  buffer wraps during the export, inconsistent; call `+stop` first for an
+ *  exact trace.
+ */
++ (NSData *)chromeTraceData;
+
+/**
+ *  Writes `+chromeTraceData` to the file at `path`.
+ *
+ *  @return `YES` if the file was written
+ */
++ (BOOL)writeChromeTraceToFile:(NSString *)path error:(NSError **)error;
+
+@end
@@ -0,0 +1,397 @@
+// OPTrace.m
+// Copyright (c) 2015 Tom Wilson <tom@toms-stuff.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#import "OPTrace+Private.h"
+
+#import <pthread.h>
+#import <stdio.h>
+#import <stdlib.h>
+
+#ifdef __APPLE__
+#import <mach/mach_time.h>
+#else
+#import <time.h>
+#endif
+
+
+atomic_bool OPTraceEnabled;
+
+static atomic_size_t OPTraceEventsPerThread = 16384;
+
+
+#pragma mark - Buffers
+#pragma mark -
+
+typedef struct {
+    uint64_t timestamp;
+    uint64_t duration;
+    uint64_t operationID;
+    const char *name;
+    const char *detail;
+    OPTraceEventType type;
+
+    /**
+     *  The thread which recorded the event. A buffer outlives its thread,
+     *  so events written before it was reused keep their own thread.
+     */
+    uint32_t threadID;
+} OPTraceEvent;
+
+/**
+ *  A single-writer ring buffer of events. Buffers are never freed; when a
+ *  thread exits its buffer is released for reuse by the next new thread.
+ */
+typedef struct OPTraceBuffer {
+    struct OPTraceBuffer *next;
+    atomic_bool inUse;
+    uint32_t threadID;
+    size_t capacity;
+
+    /**
+     *  Total number of events ever written, published with release ordering
+     *  after each event is complete.
+     */
+    atomic_uint_fast64_t head;
+
+    /**
+     *  Events before this index were discarded by `+reset`.
+     */
+    atomic_uint_fast64_t tail;
+
+    OPTraceEvent events[];
+} OPTraceBuffer;
+
+static _Atomic(OPTraceBuffer *) OPTraceBuffers;
+static atomic_uint OPTraceNextThreadID;
+static atomic_uint_fast64_t OPTraceLastOperationID;
+static pthread_key_t OPTraceBufferKey;
+static __thread OPTraceBuffer *OPTraceCurrentBuffer;
+
+/**
+ *  The name of every thread which has recorded events, keyed by thread ID.
+ *  Only written as a thread takes a buffer.
+ */
+static pthread_mutex_t OPTraceThreadNamesLock = PTHREAD_MUTEX_INITIALIZER;
+static NSMutableDictionary *OPTraceThreadNames;
+
+static void OPTraceBufferRelease(void *buffer)
+{
+    atomic_store_explicit(&((OPTraceBuffer *)buffer)->inUse, false, memory_order_release);
+}
+
+static OPTraceBuffer *OPTraceBufferForCurrentThread(void)
+{
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        pthread_key_create(&OPTraceBufferKey, OPTraceBufferRelease);
+    });
+
+    // Reuse the buffer of a thread which has exited, if there is one.
+    OPTraceBuffer *buffer = atomic_load_explicit(&OPTraceBuffers, memory_order_acquire);
+    for (; buffer; buffer = buffer->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&buffer->inUse, &expected, true)) {
+            break;
+        }
+    }
+
+    if (!buffer) {
+        size_t capacity = MAX(atomic_load(&OPTraceEventsPerThread), (size_t)1);
+        buffer = calloc(1, sizeof(OPTraceBuffer) + capacity * sizeof(OPTraceEvent));
+        if (!buffer) {
+            return NULL;
+        }
+
+        buffer->capacity = capacity;
+        atomic_init(&buffer->inUse, true);
+        atomic_init(&buffer->head, 0);
+        atomic_init(&buffer->tail, 0);
+
+        OPTraceBuffer *next = atomic_load_explicit(&OPTraceBuffers, memory_order_relaxed);
+        do {
+            buffer->next = next;
+        } while (!atomic_compare_exchange_weak_explicit(&OPTraceBuffers, &next, buffer, memory_order_release, memory_order_relaxed));
+    }
+
+    // A reused buffer still holds the exited thread's events, which keep
+    // that thread's ID and name.
+    buffer->threadID = atomic_fetch_add(&OPTraceNextThreadID, 1) + 1;
+
+    char threadName[64];
+    if ([NSThread isMainThread]) {
+        snprintf(threadName, sizeof(threadName), "main");
+    } else if (pthread_getname_np(pthread_self(), threadName, sizeof(threadName)) != 0 || threadName[0] == '\0') {
+        snprintf(threadName, sizeof(threadName), "Thread %u", buffer->threadID);
+    }
+
+    pthread_mutex_lock(&OPTraceThreadNamesLock);
+    if (!OPTraceThreadNames) {
+        OPTraceThreadNames = [[NSMutableDictionary alloc] init];
+    }
+    OPTraceThreadNames[@(buffer->threadID)] = @(threadName);
+    pthread_mutex_unlock(&OPTraceThreadNamesLock);
+
+    pthread_setspecific(OPTraceBufferKey, buffer);
+    OPTraceCurrentBuffer = buffer;
+
+    return buffer;
+}
+
+
+#pragma mark - Recording
+#pragma mark -
+
+uint64_t OPTraceNow(void)
+{
+#ifdef __APPLE__
+    static mach_timebase_info_data_t timebase;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        mach_timebase_info(&timebase);
+    });
+
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+uint64_t OPTraceNextOperationID(void)
+{
+    return atomic_fetch_add_explicit(&OPTraceLastOperationID, 1, memory_order_relaxed) + 1;
+}
+
+void OPTraceRecord(OPTraceEventType type, uint64_t operationID, const char *name, const char *detail, uint64_t timestamp, uint64_t duration)
+{
+    OPTraceBuffer *buffer = OPTraceCurrentBuffer ?: OPTraceBufferForCurrentThread();
+    if (!buffer) {
+        return;
+    }
+
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+
+    OPTraceEvent *event = &buffer->events[head % buffer->capacity];
+    event->timestamp = timestamp;
+    event->duration = duration;
+    event->operationID = operationID;
+    event->name = name;
+    event->detail = detail;
+    event->type = type;
+    event->threadID = buffer->threadID;
+
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+
+#pragma mark - Export
+#pragma mark -
+
+static NSString *OPTraceOperationID(uint64_t operationID)
+{
+    return [NSString stringWithFormat:@"0x%llx", (unsigned long long)operationID];
+}
+
+static NSString *OPTraceString(const char *string)
+{
+    return string ? @(string) : @"";
+}
+
+static NSString *OPTraceCategory(OPTraceEventType type)
+{
+    switch (type) {
+        case OPTraceEventTypeStateTransition:
+            return @"operation";
+        case OPTraceEventTypeCondition:
+            return @"condition";
+        case OPTraceEventTypeObserverStart:
+            return @"observer.start";
+        case OPTraceEventTypeObserverProduce:
+            return @"observer.produce";
+        case OPTraceEventTypeObserverFinish:
+            return @"observer.finish";
+    }
+
+    return @"unknown";
+}
+
+
+@implementation OPTrace
+
++ (void)start
+{
+    atomic_store(&OPTraceEnabled, true);
+}
+
++ (void)stop
+{
+    atomic_store(&OPTraceEnabled, false);
+}
+
++ (BOOL)isEnabled
+{
+    return atomic_load(&OPTraceEnabled);
+}
+
++ (void)reset
+{
+    OPTraceBuffer *buffer = atomic_load_explicit(&OPTraceBuffers, memory_order_acquire);
+    for (; buffer; buffer = buffer->next) {
+        atomic_store(&buffer->tail, atomic_load_explicit(&buffer->head, memory_order_acquire));
+    }
+}
+
++ (void)setEventsPerThread:(NSUInteger)eventsPerThread
+{
+    NSAssert(atomic_load(&OPTraceBuffers) == NULL, @"The number of events per thread must be set before any are recorded.");
+
+    atomic_store(&OPTraceEventsPerThread, eventsPerThread);
+}
+
++ (NSData *)chromeTraceData
+{
+    NSMutableArray *traceEvents = [[NSMutableArray alloc] init];
+
+    // State transitions for each operation, which become consecutive
+    // asynchronous slices once every thread's events have been gathered.
+    NSMutableDictionary *transitions = [[NSMutableDictionary alloc] init];
+    NSMutableIndexSet *threadIDs = [[NSMutableIndexSet alloc] init];
+
+    OPTraceBuffer *buffer = atomic_load_explicit(&OPTraceBuffers, memory_order_acquire);
+    for (; buffer; buffer = buffer->next) {
+        uint64_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+        uint64_t tail = atomic_load(&buffer->tail);
+        if (head > buffer->capacity) {
+            tail = MAX(tail, head - buffer->capacity);
+        }
+
+        if (tail >= head) {
+            continue;
+        }
+
+        for (uint64_t idx = tail; idx < head; idx++) {
+            OPTraceEvent event = buffer->events[idx % buffer->capacity];
+            NSString *operationID = OPTraceOperationID(event.operationID);
+            [threadIDs addIndex:event.threadID];
+
+            if (event.type == OPTraceEventTypeStateTransition) {
+                NSMutableArray *operationTransitions = transitions[operationID];
+                if (!operationTransitions) {
+                    operationTransitions = [[NSMutableArray alloc] init];
+                    transitions[operationID] = operationTransitions;
+                }
+                [operationTransitions addObject:@{
+                    @"ts": @(event.timestamp),
+                    @"name": OPTraceString(event.name),
+                    @"class": OPTraceString(event.detail),
+                    @"tid": @(event.threadID)
+                }];
+                continue;
+            }
+
+            NSString *name = OPTraceString(event.name);
+            if (event.detail) {
+                name = [NSString stringWithFormat:@"%@ %s", name, event.detail];
+            }
+
+            [traceEvents addObject:@{
+                @"ph": @"X",
+                @"cat": OPTraceCategory(event.type),
+                @"name": name,
+                @"pid": @1,
+                @"tid": @(event.threadID),
+                @"ts": @(event.timestamp / 1000.0),
+                @"dur": @(event.duration / 1000.0),
+                @"args": @{ @"operation": operationID }
+            }];
+        }
+    }
+
+    pthread_mutex_lock(&OPTraceThreadNamesLock);
+    [threadIDs enumerateIndexesUsingBlock:^(NSUInteger threadID, BOOL *stop) {
+        [traceEvents addObject:@{
+            @"ph": @"M",
+            @"name": @"thread_name",
+            @"pid": @1,
+            @"tid": @(threadID),
+            @"args": @{ @"name": OPTraceThreadNames[@(threadID)] ?: @"" }
+        }];
+    }];
+    pthread_mutex_unlock(&OPTraceThreadNamesLock);
+
+    NSSortDescriptor *byTimestamp = [NSSortDescriptor sortDescriptorWithKey:@"ts" ascending:YES];
+
+    [transitions enumerateKeysAndObjectsUsingBlock:^(NSString *operationID, NSMutableArray *operationTransitions, BOOL *stop) {
+        [operationTransitions sortUsingDescriptors:@[byTimestamp]];
+
+        NSString *className = nil;
+        for (NSDictionary *transition in operationTransitions) {
+            if ([transition[@"class"] length]) {
+                className = transition[@"class"];
+                break;
+            }
+        }
+
+        NSUInteger count = [operationTransitions count];
+        for (NSUInteger idx = 0; idx < count; idx++) {
+            NSDictionary *transition = operationTransitions[idx];
+            double timestamp = [transition[@"ts"] doubleValue] / 1000.0;
+            NSDictionary *common = @{
+                @"cat": @"operation",
+                @"name": transition[@"name"],
+                @"id": operationID,
+                @"pid": @1,
+                @"tid": transition[@"tid"],
+                @"args": @{ @"class": className ?: @"" }
+            };
+
+            NSMutableDictionary *begin = [common mutableCopy];
+            begin[@"ts"] = @(timestamp);
+
+            if (idx + 1 < count) {
+                begin[@"ph"] = @"b";
+                [traceEvents addObject:begin];
+
+                NSMutableDictionary *end = [common mutableCopy];
+                end[@"ph"] = @"e";
+                end[@"ts"] = @([operationTransitions[idx + 1][@"ts"] doubleValue] / 1000.0);
+                [traceEvents addObject:end];
+            } else {
+                // The final state has no end; mark it with an instant.
+                begin[@"ph"] = @"n";
+                [traceEvents addObject:begin];
+            }
+        }
+    }];
+
+    return [NSJSONSerialization dataWithJSONObject:@{ @"traceEvents": traceEvents, @"displayTimeUnit": @"ns" }
+                                           options:0
+                                             error:nil];
+}
+
++ (BOOL)writeChromeTraceToFile:(NSString *)path error:(NSError **)error
+{
+    return [[self chromeTraceData] writeToFile:path options:NSDataWritingAtomic error:error];
+}
+
+@end
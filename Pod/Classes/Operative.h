@@ -25,11 +25,15 @@
 // Core
 #import "OPOperation.h"
 #import "OPOperationQueue.h"
+#import "OPOperationGraph.h"
+#import "OPWorkStealingExecutor.h"
+#import "OPPriorityPolicy.h"
 #import "OPOperationObserver.h"
 
 // Operations
 #import "OPBlockOperation.h"
 #import "OPURLSessionTaskOperation.h"
+#import "OPURLSessionStreamOperation.h"
 #import "OPGroupOperation.h"
 #import "OPDelayOperation.h"
 
@@ -43,6 +47,12 @@
 #import "OPOperationConditionMutuallyExclusive.h"
 #import "OPReachabilityCondition.h"
 
+// Reachability
+#import "OPReachabilityBackend.h"
+#import "OPReachabilityController.h"
+#import "OPSystemConfigurationReachabilityBackend.h"
+#import "OPNetlinkReachabilityBackend.h"
+
 #if TARGET_OS_IPHONE
 #import "OPLocationCondition.h"
 #import "OPOperationConditionUserNotification.h"
@@ -54,14 +64,23 @@
 
 #import "OPSilentCondition.h"
 #import "OPNoCancelledDependenciesCondition.h"
+#import "OPConditionCache.h"
 
 // Observers
 #import "OPBlockObserver.h"
 #import "OPTimeoutObserver.h"
+#import "OPActivityObserver.h"
 
 #if TARGET_OS_IPHONE
 #import "OPBackgroundObserver.h"
 #import "OPNetworkObserver.h"
 #endif
 
+// Utilities
+#import "OPActivityGauge.h"
+#import "OPCancellationToken.h"
+#import "OPStreamChannel.h"
+#import "OPTrace.h"
+#import "OPTimerWheel.h"
+
 #endif